@@ -0,0 +1,410 @@
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "async_db.h"
+#include "../log/log.h"
+#include "../timer/coarse_clock.h"
+
+async_db::async_db()
+{
+    m_conn_num = 0;
+    m_epollfd = -1;
+    m_eventfd = -1;
+    m_port = 0;
+    m_close_log = 0;
+}
+
+async_db::~async_db()
+{
+    for (size_t i = 0; i < m_conns.size(); ++i)
+    {
+        if (m_conns[i]->mysql)
+            mysql_close(m_conns[i]->mysql);
+        delete m_conns[i];
+    }
+    if (m_eventfd >= 0)
+        close(m_eventfd);
+}
+
+void async_db::init(string url, string User, string PassWord, string DBName, int Port, int conn_num, int close_log)
+{
+    m_url = url;
+    m_port = Port;
+    m_user = User;
+    m_password = PassWord;
+    m_database = DBName;
+    m_close_log = close_log;
+#if !ASYNC_DB_SUPPORTED
+    if (conn_num > 0)
+        LOG_WARN("%s", "MySQL client has no non-blocking API, async db disabled");
+    conn_num = 0;
+#endif
+    m_conn_num = conn_num;
+}
+
+void async_db::start(int epollfd)
+{
+    if (!m_conn_num)
+        return;
+    m_epollfd = epollfd;
+    m_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_eventfd < 0)
+    {
+        LOG_ERROR("%s", "async db eventfd failure, async db disabled");
+        m_conn_num = 0;
+        return;
+    }
+    epoll_event event;
+    event.data.fd = m_eventfd;
+    event.events = EPOLLIN;
+    epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_eventfd, &event);
+
+    for (int i = 0; i < m_conn_num; ++i)
+    {
+        db_conn *conn = new db_conn;
+        conn->mysql = NULL;
+        conn->state = DB_CLOSED;
+        conn->fd = -1;
+        conn->events = 0;
+        conn->req = NULL;
+        conn->connect_at = 0;
+        m_conns.push_back(conn);
+        reconnect(conn);
+        drive(conn);
+    }
+}
+
+void async_db::submit(db_request *req)
+{
+    req->err = 0;
+    req->found = false;
+    req->stored[0] = '\0';
+    req->retried = false;
+    req->deadline = coarse_clock::get_instance()->mono_ms() + DB_QUERY_TIMEOUT;
+
+    m_lock.lock();
+    m_queue.push_back(req);
+    m_lock.unlock();
+
+    //唤醒主线程分派
+    uint64_t one = 1;
+    if (write(m_eventfd, &one, sizeof(one)) < 0)
+        LOG_ERROR("async db wakeup failure:%d", errno);
+}
+
+void async_db::on_event(int fd)
+{
+    if (fd == m_eventfd)
+    {
+        uint64_t count;
+        if (read(m_eventfd, &count, sizeof(count)) > 0)
+            dispatch();
+        return;
+    }
+
+    db_conn *conn = m_by_fd[fd];
+    //空闲连接上出现事件说明服务端关闭了连接
+    if (DB_IDLE == conn->state)
+    {
+        LOG_WARN("async db connection %d closed by server, reconnecting", fd);
+        reset(conn);
+        reconnect(conn);
+    }
+    drive(conn);
+}
+
+db_request *async_db::take()
+{
+    db_request *req = NULL;
+    m_lock.lock();
+    if (!m_queue.empty())
+    {
+        req = m_queue.front();
+        m_queue.pop_front();
+    }
+    m_lock.unlock();
+    return req;
+}
+
+//把排队的请求分给空闲连接
+void async_db::dispatch()
+{
+    for (size_t i = 0; i < m_conns.size(); ++i)
+    {
+        if (DB_IDLE == m_conns[i]->state)
+            drive(m_conns[i]);
+    }
+}
+
+//同一用户名的注册只在一条连接上执行，后到的直接按重名结束，表上没有唯一索引时也不会重复插入
+bool async_db::registering(const char *name)
+{
+    for (size_t i = 0; i < m_conns.size(); ++i)
+    {
+        db_request *req = m_conns[i]->req;
+        if (req && DB_REGISTER == req->op && 0 == strcmp(req->name, name))
+            return true;
+    }
+    return false;
+}
+
+//给空闲连接取下一个请求并生成SQL
+bool async_db::assign(db_conn *conn)
+{
+    db_request *req;
+    while ((req = take()))
+    {
+        if (DB_REGISTER == req->op && registering(req->name))
+        {
+            complete(req, 1062);
+            continue;
+        }
+
+        char name[sizeof(req->name) * 2 + 1];
+        mysql_real_escape_string(conn->mysql, name, req->name, strlen(req->name));
+        if (DB_LOGIN == req->op)
+        {
+            conn->sql = string("SELECT passwd FROM user WHERE username = '") + name + "'";
+        }
+        else
+        {
+            char password[sizeof(req->password) * 2 + 1];
+            mysql_real_escape_string(conn->mysql, password, req->password, strlen(req->password));
+            conn->sql = string("INSERT INTO user(username, passwd) VALUES('") + name + "', '" + password + "')";
+        }
+        conn->req = req;
+        conn->state = DB_QUERYING;
+        return true;
+    }
+    return false;
+}
+
+//推进连接的状态机，直到需要等待socket事件或没有请求可做
+void async_db::drive(db_conn *conn)
+{
+#if ASYNC_DB_SUPPORTED
+    while (true)
+    {
+        net_async_status status;
+        switch (conn->state)
+        {
+        case DB_CONNECTING:
+        {
+            status = mysql_real_connect_nonblocking(conn->mysql, m_url.c_str(), m_user.c_str(), m_password.c_str(),
+                                                    m_database.c_str(), m_port, NULL, 0);
+            if (NET_ASYNC_NOT_READY == status)
+            {
+                watch(conn, EPOLLIN | EPOLLOUT);
+                return;
+            }
+            if (NET_ASYNC_ERROR == status)
+            {
+                LOG_ERROR("async db connect error:%u", mysql_errno(conn->mysql));
+                reset(conn);
+                return;
+            }
+            conn->state = DB_IDLE;
+            watch(conn, EPOLLIN);
+            break;
+        }
+        case DB_IDLE:
+        {
+            if (!assign(conn))
+                return;
+            break;
+        }
+        case DB_QUERYING:
+        {
+            //查询很短，一次就能写入socket发送缓冲区，只需等待可读
+            status = mysql_real_query_nonblocking(conn->mysql, conn->sql.data(), conn->sql.size());
+            if (NET_ASYNC_NOT_READY == status)
+            {
+                watch(conn, EPOLLIN);
+                return;
+            }
+            if (NET_ASYNC_ERROR == status)
+                fail(conn);
+            else if (DB_REGISTER == conn->req->op)
+                finish(conn, 0);
+            else
+                conn->state = DB_STORING;
+            break;
+        }
+        case DB_STORING:
+        {
+            MYSQL_RES *result = NULL;
+            status = mysql_store_result_nonblocking(conn->mysql, &result);
+            if (NET_ASYNC_NOT_READY == status)
+                return;
+            if (NET_ASYNC_ERROR == status)
+            {
+                fail(conn);
+                break;
+            }
+            if (result)
+            {
+                MYSQL_ROW row = mysql_fetch_row(result);
+                if (row && row[0])
+                {
+                    conn->req->found = true;
+                    snprintf(conn->req->stored, sizeof(conn->req->stored), "%s", row[0]);
+                }
+                mysql_free_result(result);
+            }
+            finish(conn, 0);
+            break;
+        }
+        default:
+            return;
+        }
+    }
+#endif
+}
+
+//查询出错：断线时重连，请求没有重试过就放回队首再执行一次
+void async_db::fail(db_conn *conn)
+{
+    unsigned int err = mysql_errno(conn->mysql);
+    if (2006 != err && 2013 != err && 2055 != err)
+    {
+        finish(conn, err ? err : 2000);
+        return;
+    }
+
+    LOG_WARN("async db connection lost:%u, reconnecting", err);
+    db_request *req = conn->req;
+    conn->req = NULL;
+    reset(conn);
+    reconnect(conn);
+    if (req->retried)
+    {
+        complete(req, err);
+        return;
+    }
+    req->retried = true;
+    m_lock.lock();
+    m_queue.push_front(req);
+    m_lock.unlock();
+}
+
+void async_db::finish(db_conn *conn, unsigned int err)
+{
+    db_request *req = conn->req;
+    conn->req = NULL;
+    conn->state = DB_IDLE;
+    complete(req, err);
+}
+
+void async_db::complete(db_request *req, unsigned int err)
+{
+    req->err = err;
+    req->done(req);
+    delete req;
+}
+
+void async_db::reconnect(db_conn *conn)
+{
+    conn->mysql = mysql_init(NULL);
+    conn->state = DB_CONNECTING;
+    conn->connect_at = coarse_clock::get_instance()->mono_ms();
+}
+
+//关闭连接，等待下一次定时器重连
+void async_db::reset(db_conn *conn)
+{
+    unwatch(conn);
+    if (conn->mysql)
+        mysql_close(conn->mysql);
+    conn->mysql = NULL;
+    conn->state = DB_CLOSED;
+}
+
+//连接的socket在建立和重连时才确定，每次等待事件前按当前socket注册
+void async_db::watch(db_conn *conn, unsigned int events)
+{
+    int fd = conn->mysql->net.fd;
+    if (fd != conn->fd)
+        unwatch(conn);
+    if (fd < 0)
+        return;
+
+    epoll_event event;
+    event.data.fd = fd;
+    event.events = events;
+    if (conn->fd < 0)
+    {
+        epoll_ctl(m_epollfd, EPOLL_CTL_ADD, fd, &event);
+        if (fd >= (int)m_by_fd.size())
+            m_by_fd.resize(fd + 1, NULL);
+        m_by_fd[fd] = conn;
+        conn->fd = fd;
+    }
+    else if (conn->events != events)
+    {
+        epoll_ctl(m_epollfd, EPOLL_CTL_MOD, fd, &event);
+    }
+    conn->events = events;
+}
+
+void async_db::unwatch(db_conn *conn)
+{
+    if (conn->fd < 0)
+        return;
+    epoll_ctl(m_epollfd, EPOLL_CTL_DEL, conn->fd, 0);
+    m_by_fd[conn->fd] = NULL;
+    conn->fd = -1;
+    conn->events = 0;
+}
+
+void async_db::tick()
+{
+    if (!m_conn_num)
+        return;
+    long long now = coarse_clock::get_instance()->mono_ms();
+
+    //排队超时，通常是所有连接都已断开
+    list<db_request *> expired;
+    m_lock.lock();
+    for (list<db_request *>::iterator it = m_queue.begin(); it != m_queue.end();)
+    {
+        if ((*it)->deadline <= now)
+        {
+            expired.push_back(*it);
+            it = m_queue.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    m_lock.unlock();
+    if (!expired.empty())
+        LOG_WARN("%d async db requests timed out in queue", (int)expired.size());
+    for (list<db_request *>::iterator it = expired.begin(); it != expired.end(); ++it)
+        complete(*it, DB_ERR_TIMEOUT);
+
+    for (size_t i = 0; i < m_conns.size(); ++i)
+    {
+        db_conn *conn = m_conns[i];
+        //执行超时或迟迟连不上，放弃这条连接
+        bool stuck = (conn->req && conn->req->deadline <= now) ||
+                     (DB_CONNECTING == conn->state && conn->connect_at + DB_QUERY_TIMEOUT <= now);
+        if (stuck)
+        {
+            LOG_WARN("async db connection %d timed out", conn->fd);
+            db_request *req = conn->req;
+            conn->req = NULL;
+            reset(conn);
+            if (req)
+                complete(req, DB_ERR_TIMEOUT);
+        }
+        if (DB_CLOSED == conn->state)
+        {
+            reconnect(conn);
+            drive(conn);
+        }
+    }
+}
@@ -0,0 +1,131 @@
+#ifndef ASYNC_DB_H
+#define ASYNC_DB_H
+
+#include <mysql/mysql.h>
+#include <string>
+#include <vector>
+#include <list>
+#include "../lock/locker.h"
+
+using namespace std;
+
+//客户端库的非阻塞接口从MySQL 8.0.16开始提供，MariaDB的非阻塞接口与之不同，不支持时请求仍走阻塞的连接池
+#if MYSQL_VERSION_ID >= 80016 && !defined(MARIADB_BASE_VERSION) && !defined(MARIADB_PACKAGE_VERSION_ID)
+#define ASYNC_DB_SUPPORTED 1
+#else
+#define ASYNC_DB_SUPPORTED 0
+#endif
+
+/*
+* 事件循环中的非阻塞数据库访问
+* 专用连接使用客户端库的非阻塞接口，连接的socket注册在服务器的epoll中，由主线程按可读事件推进
+* 任意线程提交请求后立即返回，不占用工作线程和连接池；请求排队到空闲连接上执行，完成时在主线程回调
+* 非阻塞接口没有对应的预处理语句版本，参数用mysql_real_escape_string转义后拼进SQL
+*/
+const int DB_QUERY_TIMEOUT = 5000;  //请求从提交到完成、连接从发起到建立的最长时间，毫秒，短于HTTP连接的空闲超时
+const unsigned int DB_ERR_TIMEOUT = 3024; //请求超时的错误码，沿用服务端的ER_QUERY_TIMEOUT
+
+enum DB_OP
+{
+    DB_LOGIN = 0, //按用户名查密码
+    DB_REGISTER   //插入新用户
+};
+
+struct db_request
+{
+    DB_OP op;
+    char name[100];
+    char password[100];
+    void (*done)(db_request *); //完成回调，在主线程调用，返回后请求被释放
+    void *arg;
+    unsigned int tag;           //调用者用来识别回调是否已过期
+    unsigned int err;           //错误码，0为成功，1062为用户名重复
+    bool found;                 //登录：用户存在
+    char stored[100];           //登录：数据库中的密码
+    bool retried;               //已因断线重新执行过一次
+    long long deadline;
+};
+
+enum DB_CONN_STATE
+{
+    DB_CLOSED = 0, //等待定时器重连
+    DB_CONNECTING,
+    DB_IDLE,
+    DB_QUERYING,   //发送查询并读取结果头
+    DB_STORING     //读取结果集
+};
+
+struct db_conn
+{
+    MYSQL *mysql;
+    DB_CONN_STATE state;
+    int fd;              //注册在epoll中的socket，-1为未注册
+    unsigned int events;
+    db_request *req;
+    string sql;
+    long long connect_at; //发起连接的时间
+};
+
+class async_db
+{
+public:
+    //C++11以后,使用局部变量懒汉不用加锁
+    static async_db *get_instance()
+    {
+        static async_db instance;
+        return &instance;
+    }
+
+    //conn_num为0时不启用
+    void init(string url, string User, string PassWord, string DataBaseName, int Port, int conn_num, int close_log);
+    //注册提交队列的eventfd并开始建立连接，之后的事件都由调用者的epoll送回on_event
+    void start(int epollfd);
+    bool enabled() { return m_conn_num > 0; }
+
+    //提交请求，可在任意线程调用，请求由调用者new，回调返回后由async_db释放
+    void submit(db_request *req);
+
+    //以下只在主线程调用
+    bool owns(int fd)
+    {
+        return m_conn_num > 0 && (fd == m_eventfd || (fd >= 0 && fd < (int)m_by_fd.size() && m_by_fd[fd]));
+    }
+    void on_event(int fd);
+    //定时器调用：重连断开的连接，结束超时的请求
+    void tick();
+
+private:
+    async_db();
+    ~async_db();
+
+    db_request *take();
+    void dispatch();
+    bool assign(db_conn *conn);
+    bool registering(const char *name);
+    void drive(db_conn *conn);
+    void fail(db_conn *conn);
+    void finish(db_conn *conn, unsigned int err);
+    void complete(db_request *req, unsigned int err);
+    void reconnect(db_conn *conn);
+    void reset(db_conn *conn);
+    void watch(db_conn *conn, unsigned int events);
+    void unwatch(db_conn *conn);
+
+private:
+    int m_conn_num;
+    int m_epollfd;
+    int m_eventfd;
+    vector<db_conn *> m_conns;
+    vector<db_conn *> m_by_fd;  //socket到连接的映射
+    list<db_request *> m_queue; //等待空闲连接的请求
+    locker m_lock;              //保护m_queue
+
+    string m_url;
+    int m_port;
+    string m_user;
+    string m_password;
+    string m_database;
+    int m_close_log;
+};
+
+#endif
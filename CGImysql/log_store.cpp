@@ -0,0 +1,272 @@
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include "log_store.h"
+#include "../log/log.h"
+
+log_store::log_store()
+{
+    m_fd = -1;
+    m_size = 0;
+    m_close_log = 0;
+}
+
+log_store::~log_store()
+{
+    if (m_fd >= 0)
+        close(m_fd);
+}
+
+uint32_t log_store::checksum(const user_record_header &header, const char *name, const char *password)
+{
+    uint32_t h = 2166136261u;
+    const unsigned char *parts[3] = {(const unsigned char *)&header.name_len, (const unsigned char *)name,
+                                     (const unsigned char *)password};
+    size_t lens[3] = {sizeof(header.name_len) + sizeof(header.pass_len), header.name_len, header.pass_len};
+    for (int k = 0; k < 3; ++k)
+    {
+        for (size_t i = 0; i < lens[k]; ++i)
+        {
+            h ^= parts[k][i];
+            h *= 16777619u;
+        }
+    }
+    return h;
+}
+
+bool log_store::init(const char *path, int close_log)
+{
+    m_close_log = close_log;
+    m_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (m_fd < 0)
+    {
+        LOG_ERROR("open user store %s failed:%d", path, errno);
+        return false;
+    }
+    if (!recover())
+        return false;
+    LOG_INFO("user store %s: %zu users, %llu bytes", path, m_index.size(), (unsigned long long)m_size);
+    return true;
+}
+
+//顺序扫描数据文件重建索引，截掉末尾写到一半的记录
+//只有末尾的记录可能写到一半：越过文件末尾，或文件已扩展而数据块还没落盘(从该处到末尾全为0)
+//其余位置校验不符说明文件已损坏，此时记录长度也不可信，无法跳过，拒绝启动，以免截断丢掉其后完好的记录
+bool log_store::recover()
+{
+    struct stat st;
+    if (fstat(m_fd, &st) < 0)
+        return false;
+    uint64_t file_size = st.st_size;
+
+    //新文件：写入文件头
+    if (0 == file_size)
+    {
+        if (write(m_fd, LOG_STORE_MAGIC, sizeof(LOG_STORE_MAGIC)) != (ssize_t)sizeof(LOG_STORE_MAGIC) ||
+            fdatasync(m_fd) < 0)
+            return false;
+        m_size = sizeof(LOG_STORE_MAGIC);
+        return true;
+    }
+
+    char *data = (char *)mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+    if (MAP_FAILED == data)
+        return false;
+    if (file_size < sizeof(LOG_STORE_MAGIC) || memcmp(data, LOG_STORE_MAGIC, sizeof(LOG_STORE_MAGIC)))
+    {
+        LOG_ERROR("%s", "user store: bad file header");
+        munmap(data, file_size);
+        return false;
+    }
+    madvise(data, file_size, MADV_SEQUENTIAL);
+
+    uint64_t pos = sizeof(LOG_STORE_MAGIC);
+    bool corrupt = false;
+    while (pos + sizeof(user_record_header) <= file_size)
+    {
+        user_record_header header;
+        memcpy(&header, data + pos, sizeof(header));
+        uint64_t end = pos + sizeof(header) + header.name_len + header.pass_len;
+        if (end > file_size)
+            break;
+        const char *name = data + pos + sizeof(header);
+        if (header.checksum != checksum(header, name, name + header.name_len))
+        {
+            uint64_t zero = pos;
+            while (zero < file_size && 0 == data[zero])
+                ++zero;
+            corrupt = zero < file_size;
+            break;
+        }
+        m_index[string(name, header.name_len)] = pos;
+        pos = end;
+    }
+    munmap(data, file_size);
+
+    if (corrupt)
+    {
+        LOG_ERROR("user store: corrupt record at offset %llu of %llu bytes, refusing to start",
+                  (unsigned long long)pos, (unsigned long long)file_size);
+        m_index.clear();
+        return false;
+    }
+
+    if (pos < file_size)
+    {
+        LOG_WARN("user store: truncate %llu bytes of incomplete records", (unsigned long long)(file_size - pos));
+        if (ftruncate(m_fd, pos) < 0)
+            return false;
+    }
+    m_size = pos;
+    return true;
+}
+
+unsigned int log_store::lookup(const char *name, char *password, size_t size, bool &found)
+{
+    found = false;
+    uint64_t offset = 0;
+    m_lock.lock();
+    unordered_map<string, uint64_t>::iterator it = m_index.find(name);
+    if (it != m_index.end())
+    {
+        offset = it->second;
+        found = true;
+    }
+    m_lock.unlock();
+    if (!found)
+        return 0;
+
+    //记录写入后不再修改，不需要持锁读取；常见长度的记录一次pread读完
+    char small[512];
+    ssize_t got = pread(m_fd, small, sizeof(small), offset);
+    if (got < (ssize_t)sizeof(user_record_header))
+        return STORE_ERR_UNAVAILABLE;
+    user_record_header header;
+    memcpy(&header, small, sizeof(header));
+    size_t len = header.name_len + header.pass_len;
+    const char *buf = small + sizeof(header);
+    vector<char> big;
+    if (sizeof(header) + len > sizeof(small))
+    {
+        big.resize(len);
+        if (pread(m_fd, &big[0], len, offset + sizeof(header)) != (ssize_t)len)
+            return STORE_ERR_UNAVAILABLE;
+        buf = &big[0];
+    }
+    else if (got < (ssize_t)(sizeof(header) + len))
+    {
+        return STORE_ERR_UNAVAILABLE;
+    }
+    size_t n = header.pass_len < size - 1 ? header.pass_len : size - 1;
+    memcpy(password, buf + header.name_len, n);
+    password[n] = '\0';
+    return 0;
+}
+
+void log_store::insert(vector<user_row *> &rows)
+{
+    //只有写入线程调用，查重和登记之间索引不会被别人修改
+    string batch;
+    vector<user_row *> written;
+    vector<uint64_t> offsets;
+    m_lock.lock();
+    for (size_t i = 0; i < rows.size(); ++i)
+    {
+        user_row *row = rows[i];
+        size_t name_len = strlen(row->name);
+        size_t pass_len = strlen(row->password);
+        if (m_index.count(row->name))
+        {
+            row->err = STORE_ERR_DUPLICATE;
+            continue;
+        }
+        if (name_len > 65535 || pass_len > 65535)
+        {
+            row->err = 1406; //ER_DATA_TOO_LONG
+            continue;
+        }
+        user_record_header header;
+        header.name_len = name_len;
+        header.pass_len = pass_len;
+        header.checksum = checksum(header, row->name, row->password);
+        offsets.push_back(m_size + batch.size());
+        batch.append((const char *)&header, sizeof(header));
+        batch.append(row->name, name_len);
+        batch.append(row->password, pass_len);
+        written.push_back(row);
+    }
+    m_lock.unlock();
+    if (written.empty())
+        return;
+
+    //整批一次追加、一次刷盘；失败时截回原来的末尾，整批都不算写入
+    unsigned int err = 0;
+    ssize_t ret = pwrite(m_fd, batch.data(), batch.size(), m_size);
+    if (ret != (ssize_t)batch.size() || fdatasync(m_fd) < 0)
+    {
+        LOG_ERROR("user store write error:%d", errno);
+        if (ftruncate(m_fd, m_size) < 0)
+            LOG_ERROR("user store truncate error:%d", errno);
+        err = STORE_ERR_UNAVAILABLE;
+    }
+    else
+    {
+        m_size += batch.size();
+    }
+
+    m_lock.lock();
+    for (size_t i = 0; i < written.size(); ++i)
+    {
+        written[i]->err = err;
+        if (!err)
+            m_index[written[i]->name] = offsets[i];
+    }
+    m_lock.unlock();
+}
+
+unsigned int log_store::count(size_t &users)
+{
+    m_lock.lock();
+    users = m_index.size();
+    m_lock.unlock();
+    return 0;
+}
+
+//持锁只复制记录偏移，之后从文件映射中读用户名，遍历期间不阻塞注册写入
+//记录写入后不再修改，索引中的偏移都指向已刷盘的完整记录
+unsigned int log_store::scan(void (*visit)(const char *name, void *arg), void *arg)
+{
+    vector<uint64_t> offsets;
+    m_lock.lock();
+    offsets.reserve(m_index.size());
+    for (unordered_map<string, uint64_t>::iterator it = m_index.begin(); it != m_index.end(); ++it)
+        offsets.push_back(it->second);
+    m_lock.unlock();
+    if (offsets.empty())
+        return 0;
+
+    //按偏移排序后顺序读文件
+    sort(offsets.begin(), offsets.end());
+    struct stat st;
+    if (fstat(m_fd, &st) < 0)
+        return STORE_ERR_UNAVAILABLE;
+    char *data = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, m_fd, 0);
+    if (MAP_FAILED == data)
+        return STORE_ERR_UNAVAILABLE;
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    string name;
+    for (size_t i = 0; i < offsets.size(); ++i)
+    {
+        user_record_header header;
+        memcpy(&header, data + offsets[i], sizeof(header));
+        name.assign(data + offsets[i] + sizeof(header), header.name_len);
+        visit(name.c_str(), arg);
+    }
+    munmap(data, st.st_size);
+    return 0;
+}
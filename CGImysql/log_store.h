@@ -0,0 +1,62 @@
+#ifndef LOG_STORE_H
+#define LOG_STORE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "../lock/locker.h"
+#include "user_backend.h"
+
+using namespace std;
+
+/*
+* 嵌入式日志结构存储，单机部署时替代MySQL(-D指定数据文件)
+* 用户记录顺序追加到数据文件，从不原地修改；内存中只保留用户名到记录偏移的索引，密码按偏移pread读取
+* 启动时顺序扫描数据文件重建索引，末尾写到一半的记录(写入时进程退出)从该处截断，中间的记录校验不符时拒绝启动
+* 一批注册编码后一次write追加，再fdatasync一次，组提交把刷盘开销分摊到整批；刷盘完成后才登记索引
+* 用户只增不改，没有需要回收的旧记录，不做合并
+*/
+const char LOG_STORE_MAGIC[8] = {'T', 'W', 'S', 'U', 'S', 'E', 'R', '1'}; //文件头
+
+//记录格式：记录头之后紧跟用户名和密码，都不带'\0'
+struct user_record_header
+{
+    uint32_t checksum; //记录头其余字段、用户名和密码的FNV-1a
+    uint16_t name_len;
+    uint16_t pass_len;
+};
+
+class log_store : public user_backend
+{
+public:
+    //C++11以后,使用局部变量懒汉不用加锁
+    static log_store *get_instance()
+    {
+        static log_store instance;
+        return &instance;
+    }
+
+    //打开或新建数据文件并重建索引，失败返回false
+    bool init(const char *path, int close_log);
+
+    unsigned int lookup(const char *name, char *password, size_t size, bool &found);
+    void insert(vector<user_row *> &rows);
+    unsigned int count(size_t &users);
+    unsigned int scan(void (*visit)(const char *name, void *arg), void *arg);
+
+private:
+    log_store();
+    ~log_store();
+    static uint32_t checksum(const user_record_header &header, const char *name, const char *password);
+    bool recover();
+
+private:
+    int m_fd;
+    uint64_t m_size;                         //有效数据的末尾，只由写入线程修改
+    unordered_map<string, uint64_t> m_index; //用户名到记录偏移
+    locker m_lock;                           //保护m_index
+    int m_close_log;
+};
+
+#endif
@@ -0,0 +1,196 @@
+#include <string.h>
+#include <stdlib.h>
+#include "mysql_backend.h"
+#include "../log/log.h"
+
+mysql_backend::mysql_backend()
+{
+    m_connPool = NULL;
+    m_conn = NULL;
+    m_connected = false;
+    m_port = 0;
+    m_close_log = 0;
+}
+
+mysql_backend::~mysql_backend()
+{
+    if (m_conn)
+        mysql_close(m_conn);
+}
+
+void mysql_backend::init(connection_pool *connPool, string url, string User, string PassWord, string DBName, int Port,
+                         int close_log)
+{
+    m_connPool = connPool;
+    m_url = url;
+    m_port = Port;
+    m_user = User;
+    m_password = PassWord;
+    m_database = DBName;
+    m_close_log = close_log;
+
+    m_conn = mysql_init(NULL);
+    if (m_conn == NULL)
+    {
+        LOG_ERROR("MySQL Error");
+        exit(1);
+    }
+    //断线后由mysql_ping自动重连
+    bool reconnect = true;
+    mysql_options(m_conn, MYSQL_OPT_RECONNECT, &reconnect);
+    unsigned int timeout = POOL_CONNECT_TIMEOUT;
+    mysql_options(m_conn, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+    //连不上数据库也照常启动，写入时再连
+    connect();
+}
+
+unsigned int mysql_backend::lookup(const char *name, char *password, size_t size, bool &found)
+{
+    //按需从连接池取连接，等不到空闲连接时由调用者返回503
+    MYSQL *mysql = NULL;
+    connectionRAII mysqlcon(&mysql, m_connPool);
+    if (!mysql)
+        return STORE_ERR_UNAVAILABLE;
+    return m_connPool->QueryPassword(mysql, name, password, size, found);
+}
+
+bool mysql_backend::connect()
+{
+    m_connected = NULL != mysql_real_connect(m_conn, m_url.c_str(), m_user.c_str(), m_password.c_str(),
+                                             m_database.c_str(), m_port, NULL, 0);
+    if (!m_connected)
+        LOG_ERROR("MySQL connect error:%s", mysql_error(m_conn));
+    return m_connected;
+}
+
+string mysql_backend::values(user_row *row)
+{
+    size_t name_len = strlen(row->name);
+    size_t pass_len = strlen(row->password);
+    vector<char> buf((name_len > pass_len ? name_len : pass_len) * 2 + 1);
+
+    string sql = "('";
+    mysql_real_escape_string(m_conn, &buf[0], row->name, name_len);
+    sql += &buf[0];
+    sql += "', '";
+    mysql_real_escape_string(m_conn, &buf[0], row->password, pass_len);
+    sql += &buf[0];
+    sql += "')";
+    return sql;
+}
+
+//执行一条语句，断线时ping触发重连后再试一次
+unsigned int mysql_backend::query(const string &sql)
+{
+    unsigned int err = 0;
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        if (0 == mysql_real_query(m_conn, sql.data(), sql.size()))
+            return 0;
+        err = mysql_errno(m_conn);
+        if (2006 != err && 2013 != err)
+            return err;
+        mysql_ping(m_conn);
+    }
+    return err;
+}
+
+void mysql_backend::insert(vector<user_row *> &rows)
+{
+    //转义依赖连接的字符集，先确保已连接
+    if (!m_connected && !connect())
+    {
+        for (size_t i = 0; i < rows.size(); ++i)
+            rows[i]->err = 2006;
+        return;
+    }
+
+    //单条语句在自动提交下就是一个事务，整批要么全部写入，要么全部失败
+    string sql = "INSERT INTO user(username, passwd) VALUES";
+    for (size_t i = 0; i < rows.size(); ++i)
+    {
+        if (i)
+            sql += ", ";
+        sql += values(rows[i]);
+    }
+    unsigned int err = query(sql);
+
+    //整批失败时逐行重写，区分每行的结果
+    for (size_t i = 0; i < rows.size(); ++i)
+    {
+        if (err && rows.size() > 1)
+            rows[i]->err = query(string("INSERT INTO user(username, passwd) VALUES") + values(rows[i]));
+        else
+            rows[i]->err = err;
+    }
+    if (err && rows.size() > 1)
+        LOG_WARN("batch INSERT error:%u, rewrote %d rows one by one", err, (int)rows.size());
+}
+
+unsigned int mysql_backend::count(size_t &users)
+{
+    MYSQL *mysql = NULL;
+    connectionRAII mysqlcon(&mysql, m_connPool);
+    if (!mysql)
+        return STORE_ERR_UNAVAILABLE;
+
+    if (mysql_query(mysql, "SELECT COUNT(*) FROM user"))
+    {
+        LOG_ERROR("SELECT COUNT error:%s", mysql_error(mysql));
+        return mysql_errno(mysql) ? mysql_errno(mysql) : 2000;
+    }
+    MYSQL_RES *result = mysql_store_result(mysql);
+    if (!result)
+        return mysql_errno(mysql) ? mysql_errno(mysql) : 2000;
+    MYSQL_ROW row = mysql_fetch_row(result);
+    users = (row && row[0]) ? strtoull(row[0], NULL, 10) : 0;
+    mysql_free_result(result);
+    return 0;
+}
+
+//逐行读取，不把整张表装进内存
+unsigned int mysql_backend::scan(void (*visit)(const char *name, void *arg), void *arg)
+{
+    MYSQL *mysql = NULL;
+    connectionRAII mysqlcon(&mysql, m_connPool);
+    if (!mysql)
+        return STORE_ERR_UNAVAILABLE;
+
+    MYSQL_RES *result;
+    if (mysql_query(mysql, "SELECT username FROM user") || !(result = mysql_use_result(mysql)))
+        return mysql_errno(mysql) ? mysql_errno(mysql) : 2000;
+    while (MYSQL_ROW row = mysql_fetch_row(result))
+    {
+        if (row[0])
+            visit(row[0], arg);
+    }
+    unsigned int err = mysql_errno(mysql);
+    mysql_free_result(result);
+    return err;
+}
+
+//依赖user表的自增主键id，没有id列时返回1054(ER_BAD_FIELD_ERROR)
+unsigned int mysql_backend::scan_since(uint64_t after,
+                                       void (*visit)(uint64_t id, const char *name, const char *password, void *arg),
+                                       void *arg)
+{
+    MYSQL *mysql = NULL;
+    connectionRAII mysqlcon(&mysql, m_connPool);
+    if (!mysql)
+        return STORE_ERR_UNAVAILABLE;
+
+    char sql[128];
+    snprintf(sql, sizeof(sql), "SELECT id, username, passwd FROM user WHERE id > %llu ORDER BY id",
+             (unsigned long long)after);
+    MYSQL_RES *result;
+    if (mysql_query(mysql, sql) || !(result = mysql_use_result(mysql)))
+        return mysql_errno(mysql) ? mysql_errno(mysql) : 2000;
+    while (MYSQL_ROW row = mysql_fetch_row(result))
+    {
+        if (row[0] && row[1] && row[2])
+            visit(strtoull(row[0], NULL, 10), row[1], row[2], arg);
+    }
+    unsigned int err = mysql_errno(mysql);
+    mysql_free_result(result);
+    return err;
+}
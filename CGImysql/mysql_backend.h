@@ -0,0 +1,56 @@
+#ifndef MYSQL_BACKEND_H
+#define MYSQL_BACKEND_H
+
+#include <mysql/mysql.h>
+#include <string>
+#include <vector>
+#include "user_backend.h"
+#include "sql_connection_pool.h"
+
+using namespace std;
+
+/*
+* MySQL存储后端
+* 查找、计数和遍历从连接池取连接；写入使用注册写入线程独占的连接，不与工作线程争用连接池
+* 一批注册合并为一条多行INSERT，一次往返、一个事务；整批失败(如某行违反唯一索引)时逐行重写，区分每行的结果
+*/
+class mysql_backend : public user_backend
+{
+public:
+    //C++11以后,使用局部变量懒汉不用加锁
+    static mysql_backend *get_instance()
+    {
+        static mysql_backend instance;
+        return &instance;
+    }
+
+    void init(connection_pool *connPool, string url, string User, string PassWord, string DataBaseName, int Port,
+              int close_log);
+
+    unsigned int lookup(const char *name, char *password, size_t size, bool &found);
+    void insert(vector<user_row *> &rows);
+    unsigned int count(size_t &users);
+    unsigned int scan(void (*visit)(const char *name, void *arg), void *arg);
+    unsigned int scan_since(uint64_t after, void (*visit)(uint64_t id, const char *name, const char *password, void *arg),
+                            void *arg);
+
+private:
+    mysql_backend();
+    ~mysql_backend();
+    bool connect();
+    unsigned int query(const string &sql);
+    string values(user_row *row);
+
+private:
+    connection_pool *m_connPool;
+    MYSQL *m_conn;      //写入连接
+    bool m_connected;
+    string m_url;
+    int m_port;
+    string m_user;
+    string m_password;
+    string m_database;
+    int m_close_log;
+};
+
+#endif
@@ -0,0 +1,120 @@
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include "reg_writer.h"
+#include "user_store.h"
+#include "user_filter.h"
+#include "user_snapshot.h"
+#include "../log/log.h"
+
+reg_writer::reg_writer()
+{
+    m_close_log = 0;
+}
+
+reg_writer::~reg_writer()
+{
+}
+
+void reg_writer::init(int close_log)
+{
+    m_close_log = close_log;
+
+    pthread_t tid;
+    pthread_create(&tid, NULL, worker, NULL);
+    pthread_detach(tid);
+}
+
+unsigned int reg_writer::insert(const char *name, const char *password)
+{
+    if (!user_backend::get_instance())
+        return STORE_ERR_UNAVAILABLE;
+
+    reg_request req;
+    req.name = name;
+    req.password = password;
+    req.err = 0;
+
+    m_lock.lock();
+    m_queue.push_back(&req);
+    m_lock.unlock();
+    m_pending.post();
+
+    req.done.wait();
+    return req.err;
+}
+
+void *reg_writer::worker(void *args)
+{
+    reg_writer::get_instance()->run();
+    return NULL;
+}
+
+void reg_writer::run()
+{
+    while (true)
+    {
+        m_pending.wait();
+
+        //凑批：等到REG_BATCH_ROWS条或REG_BATCH_WAIT_MS毫秒，注册稀疏时只多等这一小段时间
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += REG_BATCH_WAIT_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_nsec -= 1000000000;
+            deadline.tv_sec++;
+        }
+        int count = 1;
+        while (count < REG_BATCH_ROWS && m_pending.timewait(deadline))
+            ++count;
+
+        vector<reg_request *> batch;
+        m_lock.lock();
+        for (int i = 0; i < count; ++i)
+        {
+            batch.push_back(m_queue.front());
+            m_queue.pop_front();
+        }
+        m_lock.unlock();
+
+        write_batch(batch);
+    }
+}
+
+void reg_writer::write_batch(vector<reg_request *> &batch)
+{
+    user_store *store = user_store::get_instance();
+
+    //用户缓存和批内已有的用户名都是重名
+    vector<user_row *> rows;
+    for (size_t i = 0; i < batch.size(); ++i)
+    {
+        reg_request *req = batch[i];
+        bool dup = store->exists(req->name);
+        for (size_t k = 0; !dup && k < rows.size(); ++k)
+            dup = 0 == strcmp(rows[k]->name, req->name);
+        if (dup)
+            req->err = STORE_ERR_DUPLICATE;
+        else
+            rows.push_back(req);
+    }
+
+    if (!rows.empty())
+        user_backend::get_instance()->insert(rows);
+
+    //先登记用户缓存、过滤器和快照再唤醒，之后的同名注册立即能看到
+    for (size_t i = 0; i < rows.size(); ++i)
+    {
+        if (!rows[i]->err)
+        {
+            store->insert(rows[i]->name, rows[i]->password);
+            user_filter::get_instance()->add(rows[i]->name);
+            user_snapshot::get_instance()->add(rows[i]->name, rows[i]->password);
+        }
+    }
+
+    for (size_t i = 0; i < batch.size(); ++i)
+        batch[i]->done.post();
+}
@@ -0,0 +1,53 @@
+#ifndef REG_WRITER_H
+#define REG_WRITER_H
+
+#include <vector>
+#include <list>
+#include "../lock/locker.h"
+#include "user_backend.h"
+
+using namespace std;
+
+/*
+* 注册写入线程(组提交)
+* 工作线程提交注册后等待结果，写入线程把几毫秒内或若干行的注册合并为一批，交给存储后端一次写入(MySQL为一条多行INSERT)
+* 批内重名和用户缓存中已有的用户名直接按重名(1062)结束，其余每个请求得到后端给出的结果
+* 阻塞路径上的注册都由写入线程写入，写入成功后先登记用户缓存和过滤器再唤醒等待者，替代原先串行化注册的全局锁
+*/
+const int REG_BATCH_ROWS = 64;   //每批最多行数
+const int REG_BATCH_WAIT_MS = 2; //收到第一条注册后最多等待凑批的时间，毫秒
+
+struct reg_request : user_row
+{
+    sem done;
+};
+
+class reg_writer
+{
+public:
+    //C++11以后,使用局部变量懒汉不用加锁
+    static reg_writer *get_instance()
+    {
+        static reg_writer instance;
+        return &instance;
+    }
+
+    void init(int close_log);
+    //注册新用户，阻塞到所在批次写入完成，返回错误码
+    unsigned int insert(const char *name, const char *password);
+
+private:
+    reg_writer();
+    ~reg_writer();
+    static void *worker(void *args);
+    void run();
+    void write_batch(vector<reg_request *> &batch);
+
+private:
+    list<reg_request *> m_queue;
+    locker m_lock;   //保护m_queue
+    sem m_pending;   //每提交一条注册post一次
+    int m_close_log;
+};
+
+#endif
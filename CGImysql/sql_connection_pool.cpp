@@ -4,9 +4,12 @@
 #include <string.h>
 #include <stdlib.h>
 #include <list>
+#include <vector>
+#include <unistd.h>
 #include <pthread.h>
 #include <iostream>
 #include "sql_connection_pool.h"
+#include "../timer/coarse_clock.h"
 
 /*池是一组资源的集合，这组资源在服务器启动之初就被完全创建好并初始化
 * 池的本质是空间换时间：当服务器需要相关的资源，可以直接从池中获取，无需动态分配，处理完客户的连接后,把相关的资源放回池中，无需通过系统调用释放资源
@@ -24,10 +27,46 @@
 
 using namespace std;
 
+//本线程在m_slots中的下标，-1为尚未分配，-2为槽已分完
+static __thread int t_slot = -1;
+//本线程最近取得且尚未归还的连接，查找它的状态不用加锁
+static __thread conn_info *t_info = NULL;
+
+static const char *statement_sql[STMT_COUNT] = {
+	"SELECT passwd FROM user WHERE username = ?",
+	"INSERT INTO user(username, passwd) VALUES(?, ?)"};
+
+//连接断开(2006/2013)或服务端已不认识语句句柄(1243)时需要重新准备
+static bool stale_statement(unsigned int err)
+{
+	return 2006 == err || 2013 == err || 1243 == err;
+}
+
+static void bind_string(MYSQL_BIND &bind, const char *value, unsigned long *length)
+{
+	memset(&bind, 0, sizeof(bind));
+	*length = strlen(value);
+	bind.buffer_type = MYSQL_TYPE_STRING;
+	bind.buffer = (void *)value;
+	bind.buffer_length = *length;
+	bind.length = length;
+}
+
 connection_pool::connection_pool()
 {
 	m_CurConn = 0;
 	m_FreeConn = 0;
+	m_MaxConn = 0;
+	m_MinConn = 0;
+	m_Opening = 0;
+	m_retry_at = 0;
+	m_waiting.store(0);
+	m_slot_count.store(0);
+	for (int i = 0; i < POOL_SLOTS; ++i)
+	{
+		m_slots[i].info.store(NULL);
+		m_slots[i].parked_at.store(0);
+	}
 }
 
 
@@ -86,8 +125,78 @@ connection_pool *connection_pool::GetInstance()
 	return &connPool;
 }
 
+//打开一个连接，失败返回NULL
+MYSQL *connection_pool::Open()
+{
+	MYSQL *con = mysql_init(NULL); //初始化一个连接对象
+	if (con == NULL)
+	{
+		LOG_ERROR("MySQL Error");
+		return NULL;
+	}
+	//断线后由mysql_ping自动重连，预处理语句随后按thread_id的变化重新准备
+	bool reconnect = true;
+	mysql_options(con, MYSQL_OPT_RECONNECT, &reconnect);
+	unsigned int timeout = POOL_CONNECT_TIMEOUT;
+	mysql_options(con, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+
+	//配置该连接使之可用
+	if (NULL == mysql_real_connect(con, m_url.c_str(), m_User.c_str(), m_PassWord.c_str(), m_DatabaseName.c_str(), m_Port, NULL, 0))
+	{
+		LOG_ERROR("MySQL connect error:%s", mysql_error(con));
+		mysql_close(con);
+		return NULL;
+	}
+	return con;
+}
+
+//登记新打开的连接，调用者持有lock
+void connection_pool::Add(MYSQL *con)
+{
+	conn_info &info = m_conns[con];
+	info.conn = con;
+	memset(info.stmts, 0, sizeof(info.stmts));
+	info.thread_id = mysql_thread_id(con);
+	info.idle_since = coarse_clock::get_instance()->mono_ms();
+	info.checked_at = info.idle_since;
+	info.broken = false;
+}
+
+//关闭已从池中取出的连接
+void connection_pool::Discard(MYSQL *con)
+{
+	lock.lock();
+	conn_info info = m_conns[con];
+	m_conns.erase(con);
+	lock.unlock();
+
+	for (int i = 0; i < STMT_COUNT; ++i)
+	{
+		if (info.stmts[i])
+			mysql_stmt_close(info.stmts[i]);
+	}
+	mysql_close(con);
+}
+
+conn_info *connection_pool::Info(MYSQL *con)
+{
+	if (t_info && t_info->conn == con)
+		return t_info;
+	lock.lock();
+	map<MYSQL *, conn_info>::iterator it = m_conns.find(con);
+	conn_info *info = it == m_conns.end() ? NULL : &it->second;
+	lock.unlock();
+	return info;
+}
+
+void *connection_pool::warm_up(void *arg)
+{
+	*(MYSQL **)arg = GetInstance()->Open();
+	return NULL;
+}
+
 //连接池的构造初始化
-void connection_pool::init(string url, string User, string PassWord, string DBName, int Port, int MaxConn, int close_log)
+void connection_pool::init(string url, string User, string PassWord, string DBName, int Port, int MinConn, int MaxConn, int close_log)
 {
 	m_url = url;
 	m_Port = Port;
@@ -95,90 +204,461 @@ void connection_pool::init(string url, string User, string PassWord, string DBNa
 	m_PassWord = PassWord;
 	m_DatabaseName = DBName;
 	m_close_log = close_log;
+	m_MaxConn = MaxConn;
+	m_MinConn = MinConn < MaxConn ? MinConn : MaxConn;
+
+	//客户端库的全局初始化(读取MYSQL_UNIX_PORT等)不是线程安全的，必须在多个线程调用mysql_init之前完成
+	mysql_library_init(0, NULL, NULL);
+
+	//常驻连接各由一个线程并行建立，启动耗时是一次连接而不是m_MinConn次
+	vector<MYSQL *> opened(m_MinConn, NULL);
+	vector<pthread_t> tids(m_MinConn);
+	vector<bool> started(m_MinConn, false);
+	for (int i = 0; i < m_MinConn; i++)
+		started[i] = 0 == pthread_create(&tids[i], NULL, warm_up, &opened[i]);
+	for (int i = 0; i < m_MinConn; i++)
+	{
+		if (started[i])
+			pthread_join(tids[i], NULL);
+		else
+			opened[i] = Open();
+	}
 
-	for (int i = 0; i < MaxConn; i++) //构造多个sql连接并存入链表，形成sql连接对象的资源池
+	lock.lock();
+	for (int i = 0; i < m_MinConn; i++)
 	{
-		MYSQL *con = NULL;
-		con = mysql_init(con); //初始化一个连接对象
+		if (!opened[i])
+			continue;
+		Add(opened[i]);
+		connList.push_back(opened[i]); //连接对象放入链表
+		++m_FreeConn; 			//资源池可用的空闲连接计数++
+	}
+	lock.unlock();
+	//连不上数据库也照常启动，由后台线程继续补足
+	if (m_FreeConn < m_MinConn)
+		LOG_ERROR("MySQL pool opened %d of %d connections", m_FreeConn, m_MinConn);
 
-		if (con == NULL)
-		{
-			LOG_ERROR("MySQL Error");
-			exit(1);
-		}
-		//配置该连接使之可用
-		con = mysql_real_connect(con, url.c_str(), User.c_str(), PassWord.c_str(), DBName.c_str(), Port, NULL, 0);
+	pthread_t tid;
+	pthread_create(&tid, NULL, maintain_thread, NULL);
+	pthread_detach(tid);
+}
+
+
+int connection_pool::MySlot()
+{
+	if (-1 == t_slot)
+	{
+		int n = m_slot_count.fetch_add(1);
+		t_slot = n < POOL_SLOTS ? n : -2;
+	}
+	return t_slot;
+}
 
-		if (con == NULL)
+//从其他线程的缓存槽中取一个连接
+conn_info *connection_pool::Steal()
+{
+	int count = m_slot_count.load();
+	if (count > POOL_SLOTS)
+		count = POOL_SLOTS;
+	for (int i = 0; i < count; ++i)
+	{
+		if (m_slots[i].info.load(memory_order_relaxed))
 		{
-			LOG_ERROR("MySQL Error");
-			exit(1);
+			conn_info *info = m_slots[i].info.exchange(NULL);
+			if (info)
+				return info;
 		}
-		
-		connList.push_back(con); //连接对象放入链表
-		++m_FreeConn; 			//资源池可用的空闲连接计数++
 	}
-	//将信号量初始化为最大连接次数，实现是sem_init，见locker.h
-	//reserve是connection_pool的sem类成员
-	reserve = sem(m_FreeConn); 
-	m_MaxConn = m_FreeConn; //最大可用连接
+	return NULL;
 }
 
-
 //当有请求时，从数据库连接池中返回一个可用连接，更新使用和空闲连接数
-MYSQL *connection_pool::GetConnection()
+//先取本线程缓存的连接；共享链表也没有空闲连接时，池未满则当场打开一个，否则从其他线程的缓存中取或等待归还，超过timeout_ms返回NULL
+MYSQL *connection_pool::GetConnection(int timeout_ms)
 {
-	MYSQL *con = NULL;
+	//快速路径：不加锁，不改计数，缓存中的连接本来就算作已使用
+	int slot = MySlot();
+	if (slot >= 0 && m_slots[slot].info.load(memory_order_relaxed))
+	{
+		conn_info *info = m_slots[slot].info.exchange(NULL);
+		if (info)
+		{
+			t_info = info;
+			return info->conn;
+		}
+	}
 
-	if (0 == connList.size())
-		return NULL;
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000)
+	{
+		deadline.tv_nsec -= 1000000000;
+		deadline.tv_sec++;
+	}
 
-	reserve.wait();  //实现是sem_wait，原子操作：若信号量(即资源计数)大于0，则计数-1并继续；若等于0，则阻塞在此
-	
 	lock.lock();
+	while (true)
+	{
+		if (!connList.empty())
+		{
+			MYSQL *con = connList.front(); //链表中选中一个sql连接对象
+			connList.pop_front(); //链表弹出该对象
+			--m_FreeConn;
+			++m_CurConn;
+			t_info = &m_conns[con];
+			lock.unlock();
+			return con;
+		}
 
-	con = connList.front(); //链表中选中一个sql连接对象
-	connList.pop_front(); //链表弹出该对象
-
-	--m_FreeConn;
-	++m_CurConn;
+		//最近打开失败过时不再尝试，避免每个请求都等一次连接超时
+		if (m_CurConn + m_FreeConn + m_Opening < m_MaxConn && coarse_clock::get_instance()->mono_ms() >= m_retry_at)
+		{
+			++m_Opening;
+			lock.unlock();
+			MYSQL *con = Open();
+			lock.lock();
+			--m_Opening;
+			if (con)
+			{
+				Add(con);
+				++m_CurConn;
+				t_info = &m_conns[con];
+				lock.unlock();
+				return con;
+			}
+			m_retry_at = coarse_clock::get_instance()->mono_ms() + POOL_RETRY_INTERVAL;
+			continue;
+		}
 
-	lock.unlock();
-	return con;
+		//先登记等待再检查各线程的缓存，与ReleaseConnection中先放入缓存再检查等待者配对，不会错过刚放入缓存的连接
+		m_waiting.fetch_add(1);
+		conn_info *info = Steal();
+		bool signaled = info || m_released.timewait(lock.get(), deadline);
+		m_waiting.fetch_sub(1);
+		if (!info && !signaled && connList.empty())
+			info = Steal();
+		if (info)
+		{
+			lock.unlock();
+			t_info = info;
+			return info->conn;
+		}
+		if (!signaled && connList.empty())
+		{
+			lock.unlock();
+			LOG_WARN("MySQL pool acquire timed out, %d in use", m_CurConn);
+			return NULL;
+		}
+	}
 }
 
-//释放当前使用的连接
+//释放当前使用的连接，坏连接直接关闭
+//本线程的缓存槽空着且没有线程在等待时放入缓存槽，否则放回共享链表并唤醒等待者
 bool connection_pool::ReleaseConnection(MYSQL *con)
 {
 	if (NULL == con)
 		return false;
 
-	lock.lock();
+	conn_info *cached = t_info && t_info->conn == con ? t_info : NULL;
+	if (cached)
+		t_info = NULL;
+	int slot = MySlot();
+	if (cached && !cached->broken && slot >= 0 && !m_slots[slot].info.load(memory_order_relaxed))
+	{
+		m_slots[slot].parked_at.store(coarse_clock::get_instance()->mono_ms(), memory_order_relaxed);
+		m_slots[slot].info.store(cached);
+		if (0 == m_waiting.load())
+			return true;
+		//有线程在等待：收回来放到共享链表，已被取走则不用管
+		if (!m_slots[slot].info.exchange(NULL))
+			return true;
+	}
 
-	connList.push_back(con); //连接对象放回资源池
-	++m_FreeConn;
+	lock.lock();
 	--m_CurConn;
-
+	conn_info &info = m_conns[con];
+	if (info.broken)
+	{
+		lock.unlock();
+		Discard(con);
+		//等待者可以打开新连接补上
+		m_released.signal();
+		return true;
+	}
+	info.idle_since = coarse_clock::get_instance()->mono_ms();
+	connList.push_front(con); //连接对象放回资源池
+	++m_FreeConn;
 	lock.unlock();
 
-	reserve.post(); //sem_post, 释放资源时，信号量计数+1
+	m_released.signal();
 	return true;
 }
 
+void *connection_pool::maintain_thread(void *arg)
+{
+	while (true)
+	{
+		usleep(POOL_CHECK_INTERVAL * 1000);
+		GetInstance()->Maintain();
+	}
+	return NULL;
+}
+
+//后台维护：关闭空闲过久的多余连接，ping长时间未用的连接，补足常驻连接
+void connection_pool::Maintain()
+{
+	long long now = coarse_clock::get_instance()->mono_ms();
+	vector<MYSQL *> expired, stale;
+
+	//空闲线程缓存的连接收回共享链表，供其他线程使用，也参与下面的空闲回收和检查
+	int count = m_slot_count.load();
+	for (int i = 0; i < count && i < POOL_SLOTS; ++i)
+	{
+		long long parked_at = m_slots[i].parked_at.load(memory_order_relaxed);
+		if (!m_slots[i].info.load(memory_order_relaxed) || now - parked_at < POOL_PARK_TIMEOUT)
+			continue;
+		conn_info *info = m_slots[i].info.exchange(NULL);
+		if (!info)
+			continue;
+		lock.lock();
+		--m_CurConn;
+		info->idle_since = parked_at;
+		connList.push_front(info->conn);
+		++m_FreeConn;
+		lock.unlock();
+		m_released.signal();
+	}
+
+	lock.lock();
+	//空闲最久的在链表尾部
+	while (!connList.empty() && m_CurConn + m_FreeConn + m_Opening > m_MinConn &&
+		   now - m_conns[connList.back()].idle_since >= POOL_IDLE_TIMEOUT)
+	{
+		expired.push_back(connList.back());
+		connList.pop_back();
+		--m_FreeConn;
+	}
+	//ping期间算作已使用
+	for (list<MYSQL *>::iterator it = connList.begin(); it != connList.end();)
+	{
+		if (now - m_conns[*it].checked_at >= POOL_PING_INTERVAL)
+		{
+			stale.push_back(*it);
+			it = connList.erase(it);
+			--m_FreeConn;
+			++m_CurConn;
+		}
+		else
+		{
+			++it;
+		}
+	}
+	int missing = m_MinConn - (m_CurConn + m_FreeConn + m_Opening);
+	if (missing > 0)
+		m_Opening += missing;
+	lock.unlock();
+
+	for (size_t i = 0; i < expired.size(); ++i)
+		Discard(expired[i]);
+
+	for (size_t i = 0; i < stale.size(); ++i)
+	{
+		MYSQL *con = stale[i];
+		//开启了自动重连，ping失败说明数据库仍不可用
+		bool alive = 0 == mysql_ping(con);
+		if (!alive)
+		{
+			LOG_WARN("MySQL connection lost:%s", mysql_error(con));
+			Discard(con);
+		}
+		lock.lock();
+		--m_CurConn;
+		if (alive)
+		{
+			//放回尾部，保持原来的空闲时间
+			m_conns[con].checked_at = now;
+			connList.push_back(con);
+			++m_FreeConn;
+		}
+		lock.unlock();
+		m_released.signal();
+	}
+
+	for (int i = 0; i < missing; ++i)
+	{
+		MYSQL *con = Open();
+		lock.lock();
+		--m_Opening;
+		if (!con)
+		{
+			//数据库仍不可用，剩下的留到下一轮
+			m_Opening -= missing - i - 1;
+			lock.unlock();
+			break;
+		}
+		Add(con);
+		connList.push_back(con);
+		++m_FreeConn;
+		lock.unlock();
+		m_released.signal();
+	}
+}
+
+MYSQL_STMT *connection_pool::GetStatement(MYSQL *con, SQL_STATEMENT which)
+{
+	conn_info *info = Info(con);
+	if (!info)
+		return NULL;
+	conn_info &cache = *info;
+
+	//重连后服务端的语句句柄都已失效
+	unsigned long thread_id = mysql_thread_id(con);
+	if (thread_id != cache.thread_id)
+	{
+		for (int i = 0; i < STMT_COUNT; ++i)
+		{
+			if (cache.stmts[i])
+				mysql_stmt_close(cache.stmts[i]);
+			cache.stmts[i] = NULL;
+		}
+		cache.thread_id = thread_id;
+	}
+
+	if (!cache.stmts[which])
+	{
+		MYSQL_STMT *stmt = mysql_stmt_init(con);
+		if (!stmt)
+			return NULL;
+		if (mysql_stmt_prepare(stmt, statement_sql[which], strlen(statement_sql[which])))
+		{
+			LOG_ERROR("prepare statement error:%s", mysql_stmt_error(stmt));
+			mysql_stmt_close(stmt);
+			return NULL;
+		}
+		cache.stmts[which] = stmt;
+	}
+	return cache.stmts[which];
+}
+
+unsigned int connection_pool::Execute(MYSQL *con, SQL_STATEMENT which, MYSQL_BIND *params)
+{
+	if (!con)
+		return 2006;
+	conn_info *info = Info(con);
+	unsigned int err = 0;
+	for (int attempt = 0; attempt < 2; ++attempt)
+	{
+		MYSQL_STMT *stmt = GetStatement(con, which);
+		if (!stmt)
+		{
+			err = mysql_errno(con) ? mysql_errno(con) : 2006;
+			break;
+		}
+		if (mysql_stmt_bind_param(stmt, params) || mysql_stmt_execute(stmt))
+			err = mysql_stmt_errno(stmt);
+		else
+			return 0;
+		if (!stale_statement(err))
+			return err;
+
+		//丢弃失效的语句，ping触发重连后再试一次
+		info->stmts[which] = NULL;
+		mysql_stmt_close(stmt);
+		mysql_ping(con);
+	}
+	//重连后仍然不可用，归还时关闭，由后台线程补足
+	if (info && stale_statement(err))
+		info->broken = true;
+	return err;
+}
+
+unsigned int connection_pool::QueryPassword(MYSQL *con, const char *name, char *password, unsigned long size, bool &found)
+{
+	found = false;
+	MYSQL_BIND param;
+	unsigned long name_len;
+	bind_string(param, name, &name_len);
+	unsigned int err = Execute(con, STMT_LOGIN, &param);
+	if (err)
+	{
+		LOG_ERROR("SELECT error:%u", err);
+		return err;
+	}
+
+	MYSQL_STMT *stmt = Info(con)->stmts[STMT_LOGIN];
+	MYSQL_BIND result;
+	unsigned long pass_len = 0;
+	bool is_null = false;
+	memset(&result, 0, sizeof(result));
+	result.buffer_type = MYSQL_TYPE_STRING;
+	result.buffer = password;
+	result.buffer_length = size - 1;
+	result.length = &pass_len;
+	result.is_null = &is_null;
+
+	//取结果出错与查询出错一样处理，不能当作用户不存在
+	if (0 == mysql_stmt_bind_result(stmt, &result) && 0 == mysql_stmt_store_result(stmt))
+	{
+		int ret = mysql_stmt_fetch(stmt);
+		if ((0 == ret || MYSQL_DATA_TRUNCATED == ret) && !is_null)
+		{
+			password[pass_len < size - 1 ? pass_len : size - 1] = '\0';
+			found = true;
+		}
+		else if (1 == ret)
+			err = mysql_stmt_errno(stmt);
+	}
+	else
+		err = mysql_stmt_errno(stmt);
+	mysql_stmt_free_result(stmt);
+	if (err)
+		LOG_ERROR("SELECT error:%u", err);
+	return err;
+}
+
+unsigned int connection_pool::InsertUser(MYSQL *con, const char *name, const char *password)
+{
+	MYSQL_BIND params[2];
+	unsigned long name_len, pass_len;
+	bind_string(params[0], name, &name_len);
+	bind_string(params[1], password, &pass_len);
+	return Execute(con, STMT_REGISTER, params);
+}
+
 //销毁数据库连接池
 void connection_pool::DestroyPool()
 {
 
 	lock.lock();
+	//收回各线程缓存的连接
+	int count = m_slot_count.load();
+	for (int i = 0; i < count && i < POOL_SLOTS; ++i)
+	{
+		conn_info *info = m_slots[i].info.exchange(NULL);
+		if (info)
+		{
+			connList.push_back(info->conn);
+			--m_CurConn;
+		}
+	}
 	if (connList.size() > 0)
 	{
 		list<MYSQL *>::iterator it;
 		for (it = connList.begin(); it != connList.end(); ++it)
 		{
 			MYSQL *con = *it;
+			conn_info &cache = m_conns[con];
+			for (int i = 0; i < STMT_COUNT; ++i)
+			{
+				if (cache.stmts[i])
+					mysql_stmt_close(cache.stmts[i]);
+				cache.stmts[i] = NULL;
+			}
 			mysql_close(con);
+			m_conns.erase(con);
 		}
-		m_CurConn = 0;
 		m_FreeConn = 0;
 		connList.clear();
 	}
@@ -3,20 +3,64 @@
 
 #include <stdio.h>
 #include <list>
+#include <map>
 #include <mysql/mysql.h>
 #include <error.h>
 #include <string.h>
 #include <iostream>
 #include <string>
+#include <atomic>
 #include "../lock/locker.h"
 #include "../log/log.h"
 
 using namespace std;
 
+//每个连接上缓存的预处理语句
+enum SQL_STATEMENT
+{
+	STMT_LOGIN = 0, //按用户名查密码
+	STMT_REGISTER,  //插入新用户
+	STMT_COUNT
+};
+
+const int POOL_ACQUIRE_TIMEOUT = 500;    //取连接最多等待的时间，毫秒，超时返回NULL，请求以503结束
+const int POOL_CONNECT_TIMEOUT = 2;      //建立连接的超时，秒
+const int POOL_RETRY_INTERVAL = 1000;    //打开连接失败后，这段时间内取连接的线程不再尝试打开，毫秒
+const int POOL_IDLE_TIMEOUT = 60000;     //多于常驻数的连接空闲这么久后关闭，毫秒
+const int POOL_PING_INTERVAL = 30000;    //空闲连接每隔这么久由后台线程ping一次，毫秒
+const int POOL_CHECK_INTERVAL = 1000;    //后台线程的检查周期，毫秒
+const int POOL_SLOTS = 64;               //缓存连接的线程数上限，更多的线程只使用共享链表
+const int POOL_PARK_TIMEOUT = 1000;      //线程缓存的连接闲置这么久后由后台线程收回共享链表，毫秒
+
+//池中每个连接的状态
+struct conn_info
+{
+	MYSQL *conn;
+	MYSQL_STMT *stmts[STMT_COUNT]; //缓存的预处理语句，第一次使用时准备
+	unsigned long thread_id;       //thread_id变化说明连接已重连，旧语句失效
+	long long idle_since;          //放回池中的时间
+	long long checked_at;          //上次确认可用的时间
+	bool broken;                   //重连后仍然失败，归还时关闭
+};
+
+//线程的连接缓存槽：归还时放入，下次取连接时不加锁直接取回；其他线程和后台线程可用exchange取走
+struct alignas(64) conn_slot
+{
+	atomic<conn_info *> info;
+	atomic<long long> parked_at;
+};
+
+/*
+* 连接数在常驻数和上限之间伸缩：启动时并行建立常驻连接，取不到空闲连接时由取连接的线程打开新连接直到上限
+* 后台线程关闭空闲过久的多余连接，ping长时间未用的连接，丢弃坏连接并补足常驻数
+* 数据库不可用时服务器照常启动，需要数据库的请求在取连接超时后返回503
+* 每个线程在自己的缓存槽中留一个连接，常见情况下取和还都只是一次原子交换；缓存中的连接计入已使用
+* 共享链表取空时从其他线程的缓存槽中取，有线程等待时归还直接走共享链表，闲置的缓存由后台线程收回
+*/
 class connection_pool
 {
 public:
-	MYSQL *GetConnection();				 //获取数据库连接
+	MYSQL *GetConnection(int timeout_ms = POOL_ACQUIRE_TIMEOUT); //获取数据库连接，超时返回NULL
 	bool ReleaseConnection(MYSQL *conn); //释放连接
 	int GetFreeConn();					 //获取连接
 	void DestroyPool();					 //销毁所有连接
@@ -24,22 +68,48 @@ public:
 	//单例模式：懒汉模式
 	static connection_pool *GetInstance();
 
-	void init(string url, string User, string PassWord, string DataBaseName, int Port, int MaxConn, int close_log); 
+	void init(string url, string User, string PassWord, string DataBaseName, int Port, int MinConn, int MaxConn, int close_log); 
+
+	//取连接上准备好的语句，连接重连过则重新准备
+	MYSQL_STMT *GetStatement(MYSQL *conn, SQL_STATEMENT which);
+	//绑定参数执行语句，语句因断线或重连失效时重新准备后再执行一次，返回错误码，0为成功
+	unsigned int Execute(MYSQL *conn, SQL_STATEMENT which, MYSQL_BIND *params);
+	//查询用户的密码，返回错误码，0为查询成功，found为用户存在
+	unsigned int QueryPassword(MYSQL *conn, const char *name, char *password, unsigned long size, bool &found);
+	//插入新用户，返回错误码，1062为用户名重复
+	unsigned int InsertUser(MYSQL *conn, const char *name, const char *password);
 
 private:
 	connection_pool();
 	~connection_pool();
 
+	MYSQL *Open();
+	void Add(MYSQL *conn);
+	void Discard(MYSQL *conn);
+	conn_info *Info(MYSQL *conn);
+	int MySlot();
+	conn_info *Steal();
+	void Maintain();
+	static void *warm_up(void *arg);
+	static void *maintain_thread(void *arg);
+
 	int m_MaxConn;  //最大连接数
+	int m_MinConn;  //常驻连接数
 	int m_CurConn;  //当前已使用的连接数
 	int m_FreeConn; //当前空闲的连接数
+	int m_Opening;  //正在打开的连接数
+	long long m_retry_at; //打开连接失败后，在此之前取连接的线程不再打开新连接
 	locker lock;
-	list<MYSQL *> connList; //连接池
-	sem reserve;
+	cond m_released; //有连接归还或打开失败
+	list<MYSQL *> connList; //空闲连接，最近归还的在前，空闲最久的在后
+	map<MYSQL *, conn_info> m_conns; //lock保护增删，每项的内容只由持有该连接的线程访问
+	conn_slot m_slots[POOL_SLOTS];
+	atomic<int> m_slot_count;        //已分配的缓存槽数
+	atomic<int> m_waiting;           //等待归还的线程数
 
 public:
 	string m_url;			 //主机地址
-	string m_Port;		 //数据库端口号
+	int m_Port;		 //数据库端口号
 	string m_User;		 //登陆数据库用户名
 	string m_PassWord;	 //登陆数据库密码
 	string m_DatabaseName; //使用数据库名
@@ -0,0 +1,60 @@
+#ifndef USER_BACKEND_H
+#define USER_BACKEND_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+using namespace std;
+
+/*
+* 用户存储后端
+* 登录查密码、注册写入和建立用户名过滤器都经过这个接口，启动时按-D选定：
+* mysql_backend访问MySQL(连接池和注册写入线程的专用连接)，log_store是进程内的日志结构文件，不依赖任何外部服务
+* 查找可在任意工作线程调用；写入只由注册写入线程调用，一次一批
+*/
+const unsigned int STORE_ERR_UNAVAILABLE = 2002; //后端暂时不可用(如取不到数据库连接)，请求以503结束
+const unsigned int STORE_ERR_DUPLICATE = 1062;   //用户名重复，沿用MySQL的ER_DUP_ENTRY
+const unsigned int STORE_ERR_UNSUPPORTED = 1235; //后端不支持该操作，沿用MySQL的ER_NOT_SUPPORTED_YET
+
+struct user_row
+{
+    const char *name;
+    const char *password;
+    unsigned int err; //写入结果，0为成功
+};
+
+class user_backend
+{
+public:
+    virtual ~user_backend() {}
+
+    //启动时选定的后端
+    static user_backend *get_instance() { return *slot(); }
+    static void use(user_backend *backend) { *slot() = backend; }
+
+    //按用户名查密码，password缓冲区为size字节；返回错误码，0为查询成功，found为用户存在
+    virtual unsigned int lookup(const char *name, char *password, size_t size, bool &found) = 0;
+    //写入一批新用户，每行的结果写入err；同一批内没有重名
+    virtual void insert(vector<user_row *> &rows) = 0;
+    //用户数，用于确定过滤器大小
+    virtual unsigned int count(size_t &users) = 0;
+    //遍历所有用户名
+    virtual unsigned int scan(void (*visit)(const char *name, void *arg), void *arg) = 0;
+    //按id递增遍历id大于after的用户，供快照追赶；不支持的后端返回STORE_ERR_UNSUPPORTED
+    virtual unsigned int scan_since(uint64_t after,
+                                    void (*visit)(uint64_t id, const char *name, const char *password, void *arg),
+                                    void *arg)
+    {
+        return STORE_ERR_UNSUPPORTED;
+    }
+
+private:
+    static user_backend **slot()
+    {
+        static user_backend *backend = NULL;
+        return &backend;
+    }
+};
+
+#endif
@@ -0,0 +1,161 @@
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "user_filter.h"
+#include "user_backend.h"
+#include "../log/log.h"
+
+user_filter::user_filter()
+{
+    m_filter.store(NULL);
+    m_retired = NULL;
+    m_building = false;
+    m_close_log = 0;
+}
+
+user_filter::~user_filter()
+{
+    destroy(m_filter.load());
+    destroy(m_retired);
+}
+
+void user_filter::destroy(bloom_filter *filter)
+{
+    if (!filter)
+        return;
+    delete[] filter->words;
+    delete filter;
+}
+
+void user_filter::init(int close_log)
+{
+    m_close_log = close_log;
+
+    pthread_t tid;
+    pthread_create(&tid, NULL, worker, NULL);
+    pthread_detach(tid);
+}
+
+void *user_filter::worker(void *args)
+{
+    user_filter::get_instance()->run();
+    return NULL;
+}
+
+void user_filter::run()
+{
+    while (true)
+        sleep(build() ? BLOOM_REBUILD_INTERVAL : BLOOM_RETRY_INTERVAL);
+}
+
+//FNV-1a再经过splitmix64的末尾混合，低位和高位都足够均匀，供双重哈希使用
+uint64_t user_filter::hash_name(const char *name)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (const char *p = name; *p; ++p)
+    {
+        h ^= (unsigned char)*p;
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+//双重哈希：第i个位置为h1 + i * h2
+void user_filter::set(bloom_filter *filter, uint64_t hash)
+{
+    uint64_t step = (hash >> 32) | 1;
+    for (int i = 0; i < BLOOM_HASHES; ++i, hash += step)
+    {
+        size_t bit = hash & filter->mask;
+        filter->words[bit >> 6].fetch_or((uint64_t)1 << (bit & 63), memory_order_relaxed);
+    }
+}
+
+bool user_filter::test(bloom_filter *filter, uint64_t hash)
+{
+    uint64_t step = (hash >> 32) | 1;
+    for (int i = 0; i < BLOOM_HASHES; ++i, hash += step)
+    {
+        size_t bit = hash & filter->mask;
+        if (!(filter->words[bit >> 6].load(memory_order_relaxed) & ((uint64_t)1 << (bit & 63))))
+            return false;
+    }
+    return true;
+}
+
+bool user_filter::may_contain(const char *name)
+{
+    bloom_filter *filter = m_filter.load(memory_order_acquire);
+    return !filter || test(filter, hash_name(name));
+}
+
+void user_filter::add(const char *name)
+{
+    uint64_t hash = hash_name(name);
+    m_lock.lock();
+    if (m_building)
+        m_pending.push_back(hash);
+    bloom_filter *filter = m_filter.load(memory_order_relaxed);
+    if (filter)
+        set(filter, hash);
+    m_lock.unlock();
+}
+
+void user_filter::visit(const char *name, void *filter)
+{
+    set((bloom_filter *)filter, hash_name(name));
+}
+
+bool user_filter::build()
+{
+    //按用户数的两倍确定大小，给重建前新注册的用户留出余量
+    user_backend *backend = user_backend::get_instance();
+    size_t rows = 0;
+    if (backend->count(rows))
+        return false;
+
+    size_t users = rows * 2 > BLOOM_MIN_USERS ? rows * 2 : BLOOM_MIN_USERS;
+    size_t bits = 64;
+    while (bits < users * BLOOM_BITS_PER_USER)
+        bits <<= 1;
+    bloom_filter *filter = new bloom_filter;
+    filter->mask = bits - 1;
+    filter->words = new atomic<uint64_t>[bits / 64];
+    for (size_t i = 0; i < bits / 64; ++i)
+        filter->words[i].store(0, memory_order_relaxed);
+
+    m_lock.lock();
+    m_building = true;
+    m_pending.clear();
+    m_lock.unlock();
+
+    unsigned int err = backend->scan(visit, filter);
+
+    m_lock.lock();
+    m_building = false;
+    if (!err)
+    {
+        for (size_t i = 0; i < m_pending.size(); ++i)
+            set(filter, m_pending[i]);
+        filter = m_filter.exchange(filter, memory_order_acq_rel);
+    }
+    m_pending.clear();
+    m_lock.unlock();
+
+    if (err)
+    {
+        LOG_ERROR("load usernames error:%u", err);
+        destroy(filter);
+        return false;
+    }
+    destroy(m_retired);
+    m_retired = filter;
+    LOG_INFO("user filter built: %zu users, %zu KB", rows, bits / 8 / 1024);
+    return true;
+}
@@ -0,0 +1,70 @@
+#ifndef USER_FILTER_H
+#define USER_FILTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+#include "../lock/locker.h"
+
+using namespace std;
+
+/*
+* 用户名布隆过滤器
+* 用户缓存(user_store)未命中时判断用户名是否可能存在：过滤器说不存在，登录直接失败、注册直接写入，都不必先查数据库
+* 后台线程启动后按用户数确定大小，从存储后端逐个读出用户名建立过滤器，启动过程和内存占用都不随表的大小增长
+* 建立完成前过滤器不可用，一律按"可能存在"处理，退化为直接查数据库
+* 建立期间注册的用户名先记下，新过滤器发布前补进去；之后定期重建，收录绕过服务器写入后端的用户，并随用户数的增长扩容
+* 替换下来的旧过滤器到下一次重建时才释放，仍在查询旧过滤器的线程早已结束
+*/
+const int BLOOM_BITS_PER_USER = 10;      //每个用户名占的位数，配合7个哈希函数误判率约1%
+const int BLOOM_HASHES = 7;
+const size_t BLOOM_MIN_USERS = 65536;    //过滤器至少能容纳的用户数
+const int BLOOM_REBUILD_INTERVAL = 600;  //重建间隔，秒
+const int BLOOM_RETRY_INTERVAL = 5;      //建立失败(如数据库不可用)后重试的间隔，秒
+
+struct bloom_filter
+{
+    size_t mask;             //位数减一，位数是2的幂
+    atomic<uint64_t> *words;
+};
+
+class user_filter
+{
+public:
+    //C++11以后,使用局部变量懒汉不用加锁
+    static user_filter *get_instance()
+    {
+        static user_filter instance;
+        return &instance;
+    }
+
+    //启动后台线程建立过滤器，立即返回
+    void init(int close_log);
+    //用户名可能存在；过滤器尚未建立时总是返回true
+    bool may_contain(const char *name);
+    //登记新注册的用户名
+    void add(const char *name);
+
+private:
+    user_filter();
+    ~user_filter();
+    static void *worker(void *args);
+    void run();
+    bool build();
+    static uint64_t hash_name(const char *name);
+    static void set(bloom_filter *filter, uint64_t hash);
+    static void visit(const char *name, void *filter);
+    static bool test(bloom_filter *filter, uint64_t hash);
+    static void destroy(bloom_filter *filter);
+
+private:
+    atomic<bloom_filter *> m_filter;
+    bloom_filter *m_retired;   //上一次替换下来的过滤器，只由后台线程访问
+    locker m_lock;             //保护m_building和m_pending，发布新过滤器时与add互斥
+    bool m_building;
+    vector<uint64_t> m_pending; //建立期间注册的用户名的哈希值
+    int m_close_log;
+};
+
+#endif
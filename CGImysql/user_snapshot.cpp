@@ -0,0 +1,410 @@
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vector>
+#include <algorithm>
+#include "user_snapshot.h"
+#include "user_backend.h"
+#include "../log/log.h"
+#include "../timer/coarse_clock.h"
+
+user_snapshot::user_snapshot()
+{
+    m_enabled.store(false);
+    m_current = NULL;
+    m_max_id = 0;
+    m_written_at = 0;
+    m_close_log = 0;
+}
+
+user_snapshot::~user_snapshot()
+{
+    release(m_current);
+}
+
+void user_snapshot::init(const string &path, int close_log)
+{
+    m_close_log = close_log;
+    if (path.empty())
+        return;
+    m_path = path;
+
+    //只映射，不解析，快照再大也只需几毫秒
+    snapshot_map *snapshot = map_file(path.c_str());
+    if (snapshot)
+    {
+        m_max_id = ((const snapshot_header *)snapshot->data)->max_id;
+        LOG_INFO("user snapshot %s: %llu users, max id %llu", path.c_str(), (unsigned long long)snapshot->count,
+                 (unsigned long long)m_max_id);
+    }
+    m_current = snapshot;
+    m_written_at = coarse_clock::get_instance()->mono_ms();
+    m_enabled.store(true);
+
+    pthread_t tid;
+    pthread_create(&tid, NULL, worker, NULL);
+    pthread_detach(tid);
+}
+
+//FNV-1a
+uint64_t user_snapshot::hash_name(const char *name, size_t len)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; ++i)
+    {
+        h ^= (unsigned char)name[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+snapshot_map *user_snapshot::map_file(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(snapshot_header))
+    {
+        close(fd);
+        return NULL;
+    }
+    char *data = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == data)
+        return NULL;
+
+    const snapshot_header *header = (const snapshot_header *)data;
+    size_t index_end = sizeof(snapshot_header) + header->count * sizeof(snapshot_entry);
+    if (memcmp(header->magic, USER_SNAPSHOT_MAGIC, sizeof(header->magic)) ||
+        header->count > (uint64_t)st.st_size / sizeof(snapshot_entry) || index_end > (size_t)st.st_size)
+    {
+        munmap(data, st.st_size);
+        return NULL;
+    }
+    //索引是二分查找要访问的部分，提前异步读入
+    madvise(data, index_end, MADV_WILLNEED);
+
+    snapshot_map *snapshot = new snapshot_map;
+    snapshot->data = data;
+    snapshot->size = st.st_size;
+    snapshot->count = header->count;
+    snapshot->entries = (const snapshot_entry *)(data + sizeof(snapshot_header));
+    snapshot->strings = data + index_end;
+    snapshot->strings_len = st.st_size - index_end;
+    snapshot->refcount = 1;
+    return snapshot;
+}
+
+void user_snapshot::unmap(snapshot_map *snapshot)
+{
+    if (!snapshot)
+        return;
+    munmap(snapshot->data, snapshot->size);
+    delete snapshot;
+}
+
+//取得当前映射的一次引用，查找结束后release
+snapshot_map *user_snapshot::acquire()
+{
+    m_map_lock.lock();
+    snapshot_map *snapshot = m_current;
+    if (snapshot)
+        ++snapshot->refcount;
+    m_map_lock.unlock();
+    return snapshot;
+}
+
+void user_snapshot::release(snapshot_map *snapshot)
+{
+    if (!snapshot)
+        return;
+    m_map_lock.lock();
+    bool dead = (0 == --snapshot->refcount);
+    m_map_lock.unlock();
+
+    if (dead)
+        unmap(snapshot);
+}
+
+bool user_snapshot::find_in(snapshot_map *snapshot, const char *name, char *password, size_t size)
+{
+    size_t len = strlen(name);
+    uint64_t hash = hash_name(name, len);
+
+    //二分查找第一个哈希值不小于hash的索引项
+    size_t lo = 0, hi = snapshot->count;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (snapshot->entries[mid].hash < hash)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for (size_t i = lo; i < snapshot->count && snapshot->entries[i].hash == hash; ++i)
+    {
+        const snapshot_entry &entry = snapshot->entries[i];
+        if ((size_t)entry.offset + entry.name_len + entry.pass_len > snapshot->strings_len)
+            return false;
+        const char *record = snapshot->strings + entry.offset;
+        if (entry.name_len != len || memcmp(record, name, len))
+            continue;
+        size_t n = entry.pass_len < size - 1 ? entry.pass_len : size - 1;
+        memcpy(password, record + len, n);
+        password[n] = '\0';
+        return true;
+    }
+    return false;
+}
+
+bool user_snapshot::find(const char *name, char *password, size_t size)
+{
+    snapshot_map *snapshot = acquire();
+    bool hit = snapshot && find_in(snapshot, name, password, size);
+    release(snapshot);
+    if (hit)
+        return true;
+
+    bool found = false;
+    m_lock.lock();
+    unordered_map<string, string>::iterator it = m_tail.find(name);
+    if (it != m_tail.end())
+    {
+        snprintf(password, size, "%s", it->second.c_str());
+        found = true;
+    }
+    m_lock.unlock();
+    return found;
+}
+
+void user_snapshot::add(const char *name, const char *password)
+{
+    if (!enabled())
+        return;
+    m_lock.lock();
+    m_tail[name] = password;
+    m_lock.unlock();
+}
+
+void *user_snapshot::worker(void *args)
+{
+    user_snapshot::get_instance()->run();
+    return NULL;
+}
+
+void user_snapshot::run()
+{
+    while (true)
+    {
+        unsigned int err = m_current ? catch_up() : write_first();
+        //1054(ER_BAD_FIELD_ERROR)：user表没有id列，无法追赶
+        if (1054 == err || STORE_ERR_UNSUPPORTED == err)
+        {
+            LOG_WARN("user snapshot disabled: backend cannot catch up by id (%u)", err);
+            m_enabled.store(false);
+            return;
+        }
+        if (err)
+            LOG_ERROR("user snapshot catch up error:%u", err);
+
+        m_lock.lock();
+        size_t tail = m_tail.size();
+        m_lock.unlock();
+        long long now = coarse_clock::get_instance()->mono_ms();
+        if (tail >= SNAPSHOT_TAIL_LIMIT || (tail > 0 && now - m_written_at >= SNAPSHOT_WRITE_INTERVAL * 1000LL))
+            write_snapshot();
+
+        sleep(SNAPSHOT_CATCHUP_INTERVAL);
+    }
+}
+
+void user_snapshot::caught_up(uint64_t id, const char *name, const char *password, void *arg)
+{
+    user_snapshot *self = (user_snapshot *)arg;
+    self->m_lock.lock();
+    self->m_tail[name] = password;
+    self->m_lock.unlock();
+    if (id > self->m_max_id)
+        self->m_max_id = id;
+}
+
+unsigned int user_snapshot::catch_up()
+{
+    return user_backend::get_instance()->scan_since(m_max_id, caught_up, this);
+}
+
+struct snapshot_item
+{
+    uint64_t hash;
+    const char *name;
+    size_t name_len;
+    const char *password;
+    size_t pass_len;
+};
+
+//第一份快照的查询结果：用户名和密码依次追加到arena，arena会扩容，行只记偏移
+struct first_row
+{
+    uint64_t hash;
+    size_t offset;
+    size_t name_len;
+    size_t pass_len;
+};
+
+struct first_rows
+{
+    string arena;
+    vector<first_row> rows;
+    uint64_t max_id;
+};
+
+void user_snapshot::collected(uint64_t id, const char *name, const char *password, void *arg)
+{
+    first_rows *first = (first_rows *)arg;
+    first_row row = {0, first->arena.size(), strlen(name), strlen(password)};
+    row.hash = hash_name(name, row.name_len);
+    first->arena.append(name, row.name_len);
+    first->arena.append(password, row.pass_len);
+    first->rows.push_back(row);
+    if (id > first->max_id)
+        first->max_id = id;
+}
+
+//还没有快照：全表查询的结果直接写成第一份快照，查询出错时下一轮重新来过
+unsigned int user_snapshot::write_first()
+{
+    first_rows first;
+    first.max_id = 0;
+    unsigned int err = user_backend::get_instance()->scan_since(0, collected, &first);
+    if (err)
+        return err;
+
+    const char *base = first.arena.data();
+    vector<snapshot_item> items;
+    items.reserve(first.rows.size());
+    for (size_t i = 0; i < first.rows.size(); ++i)
+    {
+        const first_row &row = first.rows[i];
+        snapshot_item item = {row.hash, base + row.offset, row.name_len, base + row.offset + row.name_len, row.pass_len};
+        items.push_back(item);
+    }
+    m_max_id = first.max_id;
+    if (!write_items(items, NULL))
+        m_max_id = 0;
+    return 0;
+}
+
+static bool item_less(const snapshot_item &a, const snapshot_item &b)
+{
+    if (a.hash != b.hash)
+        return a.hash < b.hash;
+    int cmp = memcmp(a.name, b.name, a.name_len < b.name_len ? a.name_len : b.name_len);
+    return cmp ? cmp < 0 : a.name_len < b.name_len;
+}
+
+static bool item_same(const snapshot_item &a, const snapshot_item &b)
+{
+    return a.hash == b.hash && a.name_len == b.name_len && 0 == memcmp(a.name, b.name, a.name_len);
+}
+
+//把当前快照和尾部合并写成新快照，替换后清掉已并入的尾部
+bool user_snapshot::write_snapshot()
+{
+    vector<pair<string, string> > tail;
+    m_lock.lock();
+    tail.assign(m_tail.begin(), m_tail.end());
+    m_lock.unlock();
+
+    //映射只由本线程替换，合并期间一直有效
+    snapshot_map *old = m_current;
+    vector<snapshot_item> items;
+    items.reserve((old ? old->count : 0) + tail.size());
+    for (size_t i = 0; i < tail.size(); ++i)
+    {
+        snapshot_item item = {hash_name(tail[i].first.data(), tail[i].first.size()), tail[i].first.data(),
+                              tail[i].first.size(), tail[i].second.data(), tail[i].second.size()};
+        items.push_back(item);
+    }
+    for (uint64_t i = 0; old && i < old->count; ++i)
+    {
+        const snapshot_entry &entry = old->entries[i];
+        const char *record = old->strings + entry.offset;
+        snapshot_item item = {entry.hash, record, entry.name_len, record + entry.name_len, entry.pass_len};
+        items.push_back(item);
+    }
+    if (!write_items(items, old))
+        return false;
+
+    m_lock.lock();
+    for (size_t i = 0; i < tail.size(); ++i)
+        m_tail.erase(tail[i].first);
+    m_lock.unlock();
+    return true;
+}
+
+//排序去重后写成快照文件并替换当前映射，同名用户保留靠前的一项
+bool user_snapshot::write_items(vector<snapshot_item> &items, snapshot_map *old)
+{
+    stable_sort(items.begin(), items.end(), item_less);
+    items.erase(unique(items.begin(), items.end(), item_same), items.end());
+
+    //索引和字符串区依次写入临时文件，fsync后rename，崩溃时旧快照保持完整
+    //文件中是明文密码，只允许本用户读写，不受umask影响；上次崩溃残留的临时文件先删掉
+    string tmp = m_path + ".tmp";
+    unlink(tmp.c_str());
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_TRUNC | O_CLOEXEC, 0600);
+    FILE *fp = fd < 0 ? NULL : fdopen(fd, "wb");
+    if (!fp)
+    {
+        LOG_ERROR("create user snapshot %s failed", tmp.c_str());
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+    snapshot_header header;
+    memcpy(header.magic, USER_SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.count = items.size();
+    header.max_id = m_max_id;
+    bool ok = 1 == fwrite(&header, sizeof(header), 1, fp);
+    uint64_t offset = 0;
+    for (size_t i = 0; ok && i < items.size(); ++i)
+    {
+        snapshot_entry entry;
+        entry.hash = items[i].hash;
+        entry.offset = offset;
+        entry.name_len = items[i].name_len;
+        entry.pass_len = items[i].pass_len;
+        offset += entry.name_len + entry.pass_len;
+        ok = offset <= UINT32_MAX && 1 == fwrite(&entry, sizeof(entry), 1, fp);
+    }
+    for (size_t i = 0; ok && i < items.size(); ++i)
+    {
+        ok = items[i].name_len == fwrite(items[i].name, 1, items[i].name_len, fp) &&
+             items[i].pass_len == fwrite(items[i].password, 1, items[i].pass_len, fp);
+    }
+    ok = ok && 0 == fflush(fp) && 0 == fsync(fileno(fp));
+    fclose(fp);
+    if (!ok || rename(tmp.c_str(), m_path.c_str()) < 0)
+    {
+        LOG_ERROR("write user snapshot %s failed", m_path.c_str());
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    snapshot_map *snapshot = map_file(m_path.c_str());
+    if (!snapshot)
+        return false;
+    m_map_lock.lock();
+    m_current = snapshot;
+    m_map_lock.unlock();
+    //放掉当前映射的那次引用，仍在查找旧映射的线程结束后才解除映射
+    release(old);
+    m_written_at = coarse_clock::get_instance()->mono_ms();
+    LOG_INFO("user snapshot written: %zu users, max id %llu", items.size(), (unsigned long long)m_max_id);
+    return true;
+}
@@ -0,0 +1,106 @@
+#ifndef USER_SNAPSHOT_H
+#define USER_SNAPSHOT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "../lock/locker.h"
+
+using namespace std;
+
+/*
+* 用户快照(-S)：完整的用户名密码表，位于用户缓存和数据库之间，快照中有的用户登录不必查数据库
+* 快照文件按(哈希值, 用户名)排序，启动时直接mmap，不逐行解析，几毫秒即可开始服务；查找为一次二分查找
+* 快照之后的新用户保存在内存中的尾部表：启动后由后台线程按快照记下的最大id从数据库追赶，之后定期追赶；本服务器的注册写入后立即加入
+* 还没有快照时，第一份快照直接由全表查询的结果写成，不经过尾部表
+* 快照中是明文密码，文件以0600权限创建
+* 尾部积累到一定数量或每隔一段时间，后台线程把快照和尾部合并写成新快照(临时文件fsync后rename替换)，重新映射后清掉已并入的尾部
+* 映射带引用计数，查找期间持有一次引用，被替换下来的旧映射在最后一个查找结束后才解除映射
+* 追赶依赖user表的自增主键id，表上没有id列或存储后端不支持时快照停用，请求照常走数据库
+*/
+const char USER_SNAPSHOT_MAGIC[8] = {'T', 'W', 'S', 'S', 'N', 'A', 'P', '1'};
+const int SNAPSHOT_CATCHUP_INTERVAL = 10; //从数据库追赶的间隔，秒
+const int SNAPSHOT_WRITE_INTERVAL = 300;  //尾部不为空时写新快照的最长间隔，秒
+const size_t SNAPSHOT_TAIL_LIMIT = 10000; //尾部达到这么多用户时立即写新快照
+
+struct snapshot_header
+{
+    char magic[8];
+    uint64_t count;  //用户数
+    uint64_t max_id; //已并入的最大id，启动后从这里开始追赶
+};
+
+//索引项按(hash, 用户名)排序，用户名和密码依次存放在索引之后的字符串区，offset相对字符串区起点
+struct snapshot_entry
+{
+    uint64_t hash;
+    uint32_t offset;
+    uint16_t name_len;
+    uint16_t pass_len;
+};
+
+struct snapshot_item;
+
+struct snapshot_map
+{
+    char *data;
+    size_t size;
+    uint64_t count;
+    const snapshot_entry *entries;
+    const char *strings;
+    size_t strings_len;
+    int refcount; //当前映射本身持有一次，每个正在查找的线程各持有一次
+};
+
+class user_snapshot
+{
+public:
+    //C++11以后,使用局部变量懒汉不用加锁
+    static user_snapshot *get_instance()
+    {
+        static user_snapshot instance;
+        return &instance;
+    }
+
+    //映射已有的快照并启动后台线程，path为空时不启用
+    void init(const string &path, int close_log);
+    bool enabled() { return m_enabled.load(memory_order_relaxed); }
+    //查找用户，命中时把密码写入password，缓冲区至少size字节
+    bool find(const char *name, char *password, size_t size);
+    //登记本服务器新注册的用户
+    void add(const char *name, const char *password);
+
+private:
+    user_snapshot();
+    ~user_snapshot();
+    static void *worker(void *args);
+    void run();
+    static uint64_t hash_name(const char *name, size_t len);
+    static snapshot_map *map_file(const char *path);
+    static void unmap(snapshot_map *snapshot);
+    snapshot_map *acquire();
+    void release(snapshot_map *snapshot);
+    static bool find_in(snapshot_map *snapshot, const char *name, char *password, size_t size);
+    static void caught_up(uint64_t id, const char *name, const char *password, void *arg);
+    static void collected(uint64_t id, const char *name, const char *password, void *arg);
+    unsigned int catch_up();
+    unsigned int write_first();
+    bool write_snapshot();
+    bool write_items(vector<snapshot_item> &items, snapshot_map *old);
+
+private:
+    string m_path;
+    atomic<bool> m_enabled;
+    snapshot_map *m_current;                //当前映射，只由后台线程替换
+    locker m_map_lock;                      //保护m_current和映射的引用计数
+    unordered_map<string, string> m_tail;   //快照之后的新用户
+    locker m_lock;                          //保护m_tail
+    uint64_t m_max_id;                      //已追赶到的最大id，只由后台线程访问
+    long long m_written_at;                 //上次写快照的时间，毫秒
+    int m_close_log;
+};
+
+#endif
@@ -0,0 +1,162 @@
+#include <string.h>
+#include "user_store.h"
+
+static void clear_bucket(user_bucket &bucket)
+{
+    bucket.seq.store(0, memory_order_relaxed);
+    bucket.referenced.store(0, memory_order_relaxed);
+    bucket.hand = 0;
+    for (int i = 0; i < USER_WAYS; ++i)
+        bucket.hash[i].store(0, memory_order_relaxed);
+}
+
+user_store::user_store()
+{
+    m_buckets = NULL;
+    m_mask = 0;
+    init(USER_CACHE_DEFAULT);
+}
+
+user_store::~user_store()
+{
+    delete[] m_buckets;
+}
+
+void user_store::init(size_t capacity)
+{
+    size_t count = 1;
+    while (count * USER_WAYS < capacity)
+        count <<= 1;
+
+    delete[] m_buckets;
+    m_buckets = new user_bucket[count];
+    m_mask = count - 1;
+    for (size_t i = 0; i < count; ++i)
+        clear_bucket(m_buckets[i]);
+}
+
+//FNV-1a，0留作空路的标记
+uint64_t user_store::hash_name(const char *name, size_t len)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; ++i)
+    {
+        h ^= (unsigned char)name[i];
+        h *= 1099511628211ULL;
+    }
+    return h ? h : 1;
+}
+
+bool user_store::find(const char *name, char *password)
+{
+    size_t len = strlen(name);
+    if (len >= (size_t)USER_FIELD_LEN)
+        return false;
+    uint64_t hash = hash_name(name, len);
+    user_bucket &bucket = bucket_of(hash);
+
+    while (true)
+    {
+        unsigned seq = bucket.seq.load(memory_order_acquire);
+        if (seq & 1)
+            continue;
+
+        //先比较哈希值，相等时才把条目复制出来比较用户名
+        int way = -1;
+        user_entry copy;
+        for (int i = 0; i < USER_WAYS && way < 0; ++i)
+        {
+            if (bucket.hash[i].load(memory_order_relaxed) != hash)
+                continue;
+            memcpy(&copy, &bucket.entries[i], sizeof(copy));
+            if (0 == memcmp(copy.name, name, len + 1))
+                way = i;
+        }
+        atomic_thread_fence(memory_order_acquire);
+        //期间桶被改写过，复制出的条目可能不完整
+        if (bucket.seq.load(memory_order_relaxed) != seq)
+            continue;
+
+        if (way < 0)
+            return false;
+        //访问位已置位时不再写，热点用户的查找不争用缓存行
+        uint8_t bit = 1 << way;
+        if (!(bucket.referenced.load(memory_order_relaxed) & bit))
+            bucket.referenced.fetch_or(bit, memory_order_relaxed);
+        if (password)
+        {
+            copy.password[USER_FIELD_LEN - 1] = '\0';
+            strcpy(password, copy.password);
+        }
+        return true;
+    }
+}
+
+bool user_store::check(const char *name, const char *password)
+{
+    char stored[USER_FIELD_LEN];
+    return find(name, stored) && 0 == strcmp(stored, password);
+}
+
+//写者之间用序号本身互斥：从偶数改为奇数成功的一方获得桶
+void user_store::lock(user_bucket &bucket)
+{
+    unsigned seq = bucket.seq.load(memory_order_relaxed);
+    while ((seq & 1) || !bucket.seq.compare_exchange_weak(seq, seq + 1, memory_order_acquire))
+        seq = bucket.seq.load(memory_order_relaxed);
+    //读者看到奇数序号之前，不能先看到对条目的修改
+    atomic_thread_fence(memory_order_release);
+}
+
+//持有桶时调用
+int user_store::probe(user_bucket &bucket, uint64_t hash, const char *name)
+{
+    for (int i = 0; i < USER_WAYS; ++i)
+    {
+        if (bucket.hash[i].load(memory_order_relaxed) == hash && 0 == strcmp(bucket.entries[i].name, name))
+            return i;
+    }
+    return -1;
+}
+
+bool user_store::insert(const char *name, const char *password)
+{
+    size_t name_len = strlen(name);
+    size_t pass_len = strlen(password);
+    if (name_len >= (size_t)USER_FIELD_LEN || pass_len >= (size_t)USER_FIELD_LEN)
+        return false;
+    uint64_t hash = hash_name(name, name_len);
+    user_bucket &bucket = bucket_of(hash);
+
+    lock(bucket);
+    if (probe(bucket, hash, name) >= 0)
+    {
+        unlock(bucket);
+        return false;
+    }
+
+    //优先用空路，桶满时CLOCK淘汰：跳过并清除访问位已置位的路，淘汰第一个未被访问的
+    int way = -1;
+    for (int i = 0; i < USER_WAYS && way < 0; ++i)
+    {
+        if (0 == bucket.hash[i].load(memory_order_relaxed))
+            way = i;
+    }
+    while (way < 0)
+    {
+        int i = bucket.hand;
+        bucket.hand = (bucket.hand + 1) % USER_WAYS;
+        uint8_t bit = 1 << i;
+        if (bucket.referenced.load(memory_order_relaxed) & bit)
+            bucket.referenced.fetch_and(~bit, memory_order_relaxed);
+        else
+            way = i;
+    }
+
+    memcpy(bucket.entries[way].name, name, name_len + 1);
+    memcpy(bucket.entries[way].password, password, pass_len + 1);
+    bucket.hash[way].store(hash, memory_order_relaxed);
+    bucket.referenced.fetch_and(~(1 << way), memory_order_relaxed);
+    unlock(bucket);
+    return true;
+}
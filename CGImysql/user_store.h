@@ -0,0 +1,73 @@
+#ifndef USER_STORE_H
+#define USER_STORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+using namespace std;
+
+/*
+* 用户名密码缓存
+* 容量有上限，启动时为空，登录和注册访问数据库后按需填入，不再在启动时装载整张用户表
+* 组相联结构：按哈希值定位到桶，每个桶有USER_WAYS路，桶满时用CLOCK(近似LRU)淘汰：命中置访问位，淘汰时指针跳过并清除已置位的路
+* 查找不加锁：桶带有序号(seqlock)，写者把序号改为奇数后修改、再改回偶数，读者把条目复制出来后核对序号，期间被改写则重试
+* 条目是定长数组，读到被并发改写的数据也不会越界，核对序号后才使用
+* 未命中不代表用户不存在，需结合user_filter判断是否要查数据库
+*/
+const int USER_WAYS = 8;               //每个桶的路数
+const int USER_FIELD_LEN = 100;        //用户名和密码的缓冲区长度，与登录表单一致，更长的不缓存
+const size_t USER_CACHE_DEFAULT = 65536; //默认容量(用户数)
+
+struct user_entry
+{
+    char name[USER_FIELD_LEN];
+    char password[USER_FIELD_LEN];
+};
+
+struct alignas(64) user_bucket
+{
+    atomic<unsigned> seq;              //写入时为奇数
+    atomic<uint8_t> referenced;        //每路一位，命中时置位
+    uint8_t hand;                      //CLOCK指针
+    atomic<uint64_t> hash[USER_WAYS];  //0为空路
+    user_entry entries[USER_WAYS];
+};
+
+class user_store
+{
+public:
+    //C++11以后,使用局部变量懒汉不用加锁
+    static user_store *get_instance()
+    {
+        static user_store instance;
+        return &instance;
+    }
+
+    //按容量(用户数)分配桶，在使用前调用一次
+    void init(size_t capacity);
+    //命中时把密码写入password(可为NULL)，缓冲区至少USER_FIELD_LEN字节
+    bool find(const char *name, char *password);
+    //命中且密码一致
+    bool check(const char *name, const char *password);
+    bool exists(const char *name) { return find(name, NULL); }
+    //填入缓存，桶满时淘汰一路；已存在时返回false
+    bool insert(const char *name, const char *password);
+    size_t capacity() { return (m_mask + 1) * USER_WAYS; }
+
+private:
+    user_store();
+    ~user_store();
+
+    static uint64_t hash_name(const char *name, size_t len);
+    user_bucket &bucket_of(uint64_t hash) { return m_buckets[hash & m_mask]; }
+    int probe(user_bucket &bucket, uint64_t hash, const char *name);
+    void lock(user_bucket &bucket);
+    void unlock(user_bucket &bucket) { bucket.seq.fetch_add(1, memory_order_release); }
+
+private:
+    user_bucket *m_buckets;
+    size_t m_mask;
+};
+
+#endif
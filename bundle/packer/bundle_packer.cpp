@@ -0,0 +1,258 @@
+/*
+* 站点包打包工具
+* 用法：./bundle_packer <网站根目录> <输出文件>
+* 递归收集根目录下的全部普通文件，按url路径排序后写成site_bundle格式，
+* 为每个文件预生成响应头，可压缩且压缩后明显变小的文件额外保存gzip版本，正文按页对齐
+* 先写临时文件再rename到输出路径，服务器侧通过SIGHUP重新加载即可原子切换
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "../site_bundle.h"
+
+using namespace std;
+
+struct pack_file
+{
+    string path;    //以/开头的url路径
+    string body;
+    string gz_body;
+    string header;
+    string gz_header;
+    uint64_t mtime;
+};
+
+static const char *content_type(const string &path)
+{
+    static const char *types[][2] = {
+        {".html", "text/html"}, {".htm", "text/html"}, {".css", "text/css"},
+        {".js", "application/javascript"}, {".txt", "text/plain"}, {".json", "application/json"},
+        {".jpg", "image/jpeg"}, {".jpeg", "image/jpeg"}, {".gif", "image/gif"},
+        {".png", "image/png"}, {".ico", "image/x-icon"}, {".svg", "image/svg+xml"},
+        {".mp4", "video/mp4"}};
+
+    size_t dot = path.rfind('.');
+    if (dot != string::npos)
+    {
+        string ext = path.substr(dot);
+        for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); ++i)
+        {
+            if (strcasecmp(ext.c_str(), types[i][0]) == 0)
+                return types[i][1];
+        }
+    }
+    return "application/octet-stream";
+}
+
+static bool read_file(const string &name, string &out)
+{
+    FILE *fp = fopen(name.c_str(), "rb");
+    if (!fp)
+        return false;
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        out.append(buf, n);
+    bool ok = !ferror(fp);
+    fclose(fp);
+    return ok;
+}
+
+static bool gzip(const string &in, string &out)
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    //windowBits加16输出gzip格式
+    if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+
+    out.resize(deflateBound(&zs, in.size()));
+    zs.next_in = (Bytef *)in.data();
+    zs.avail_in = in.size();
+    zs.next_out = (Bytef *)&out[0];
+    zs.avail_out = out.size();
+    int ret = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return ret == Z_STREAM_END;
+}
+
+static bool collect(const string &root, const string &rel, vector<pack_file> &files)
+{
+    string dir_name = root + rel;
+    DIR *dir = opendir(dir_name.c_str());
+    if (!dir)
+    {
+        perror(dir_name.c_str());
+        return false;
+    }
+
+    bool ok = true;
+    struct dirent *ent;
+    while (ok && (ent = readdir(dir)) != NULL)
+    {
+        if (ent->d_name[0] == '.')
+            continue;
+
+        string path = rel + "/" + ent->d_name;
+        struct stat st;
+        if (stat((root + path).c_str(), &st) < 0)
+            continue;
+
+        if (S_ISDIR(st.st_mode))
+        {
+            ok = collect(root, path, files);
+        }
+        else if (S_ISREG(st.st_mode) && (st.st_mode & S_IROTH))
+        {
+            pack_file f;
+            f.path = path;
+            f.mtime = st.st_mtime;
+            if (!read_file(root + path, f.body))
+            {
+                perror((root + path).c_str());
+                ok = false;
+                break;
+            }
+            files.push_back(f);
+        }
+    }
+    closedir(dir);
+    return ok;
+}
+
+static bool by_path(const pack_file &a, const pack_file &b)
+{
+    return a.path < b.path;
+}
+
+static uint64_t align_up(uint64_t off)
+{
+    return (off + BUNDLE_ALIGN - 1) / BUNDLE_ALIGN * BUNDLE_ALIGN;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "usage: %s <doc_root> <bundle>\n", argv[0]);
+        return 1;
+    }
+
+    string root = argv[1];
+    while (root.size() > 1 && root[root.size() - 1] == '/')
+        root.erase(root.size() - 1);
+
+    vector<pack_file> files;
+    if (!collect(root, "", files))
+        return 1;
+    sort(files.begin(), files.end(), by_path);
+
+    //生成响应头，压缩后至少小10%才保留gzip版本
+    char line[256];
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        pack_file &f = files[i];
+        const char *type = content_type(f.path);
+        snprintf(line, sizeof(line), "Content-Length:%zu\r\nContent-Type:%s\r\n", f.body.size(), type);
+        f.header = line;
+
+        string gz;
+        if (!f.body.empty() && gzip(f.body, gz) && gz.size() < f.body.size() * 9 / 10)
+        {
+            f.gz_body.swap(gz);
+            snprintf(line, sizeof(line), "Content-Length:%zu\r\nContent-Type:%s\r\nContent-Encoding:gzip\r\n",
+                     f.gz_body.size(), type);
+            f.gz_header = line;
+        }
+    }
+
+    //计算布局：包头、索引、路径和响应头字符串，最后是按页对齐的正文
+    vector<bundle_entry> entries(files.size());
+    uint64_t off = sizeof(bundle_header) + files.size() * sizeof(bundle_entry);
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        bundle_entry &e = entries[i];
+        memset(&e, 0, sizeof(e));
+        e.mtime = files[i].mtime;
+        e.path_offset = off;
+        e.path_len = files[i].path.size();
+        off += e.path_len;
+        e.header_offset = off;
+        e.header_len = files[i].header.size();
+        off += e.header_len;
+        e.gz_header_offset = off;
+        e.gz_header_len = files[i].gz_header.size();
+        off += e.gz_header_len;
+    }
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        bundle_entry &e = entries[i];
+        off = align_up(off);
+        e.body_offset = off;
+        e.body_len = files[i].body.size();
+        off += e.body_len;
+        if (!files[i].gz_body.empty())
+        {
+            off = align_up(off);
+            e.gz_body_offset = off;
+            e.gz_body_len = files[i].gz_body.size();
+            off += e.gz_body_len;
+        }
+    }
+
+    bundle_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BUNDLE_MAGIC, 8);
+    header.version = BUNDLE_VERSION;
+    header.entry_count = files.size();
+    header.index_offset = sizeof(bundle_header);
+    header.file_size = off;
+
+    string image(off, '\0');
+    memcpy(&image[0], &header, sizeof(header));
+    if (!entries.empty())
+        memcpy(&image[header.index_offset], &entries[0], entries.size() * sizeof(bundle_entry));
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        const bundle_entry &e = entries[i];
+        const pack_file &f = files[i];
+        memcpy(&image[e.path_offset], f.path.data(), e.path_len);
+        memcpy(&image[e.header_offset], f.header.data(), e.header_len);
+        if (e.gz_header_len)
+            memcpy(&image[e.gz_header_offset], f.gz_header.data(), e.gz_header_len);
+        if (e.body_len)
+            memcpy(&image[e.body_offset], f.body.data(), e.body_len);
+        if (e.gz_body_len)
+            memcpy(&image[e.gz_body_offset], f.gz_body.data(), e.gz_body_len);
+    }
+
+    //写临时文件后rename，保证正在运行的服务器看到的要么是旧包要么是完整的新包
+    string tmp = string(argv[2]) + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "wb");
+    if (!fp)
+    {
+        perror(tmp.c_str());
+        return 1;
+    }
+    bool ok = fwrite(image.data(), 1, image.size(), fp) == image.size();
+    ok = (fflush(fp) == 0) && ok;
+    ok = (fsync(fileno(fp)) == 0) && ok;
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok || rename(tmp.c_str(), argv[2]) < 0)
+    {
+        perror(argv[2]);
+        unlink(tmp.c_str());
+        return 1;
+    }
+
+    printf("packed %zu files into %s (%llu bytes)\n", files.size(), argv[2], (unsigned long long)off);
+    return 0;
+}
@@ -0,0 +1,154 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "site_bundle.h"
+
+site_bundle *site_bundle::open(const char *path)
+{
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (long)sizeof(bundle_header))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    char *address = (char *)mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == address)
+        return NULL;
+
+    //校验包头和索引，保证之后的查找不会越界
+    const bundle_header *header = (const bundle_header *)address;
+    uint64_t size = st.st_size;
+    bool ok = memcmp(header->magic, BUNDLE_MAGIC, 8) == 0 && header->version == BUNDLE_VERSION &&
+              header->file_size == size && header->index_offset <= size &&
+              header->entry_count <= (size - header->index_offset) / sizeof(bundle_entry);
+
+    const bundle_entry *entries = (const bundle_entry *)(address + header->index_offset);
+    for (uint32_t i = 0; ok && i < header->entry_count; ++i)
+    {
+        const bundle_entry &e = entries[i];
+        ok = in_range(e.path_offset, e.path_len, size) && in_range(e.header_offset, e.header_len, size) &&
+             in_range(e.body_offset, e.body_len, size) && in_range(e.gz_header_offset, e.gz_header_len, size) &&
+             in_range(e.gz_body_offset, e.gz_body_len, size);
+    }
+    if (!ok)
+    {
+        munmap(address, st.st_size);
+        return NULL;
+    }
+
+    //整个包提前读入页缓存
+    madvise(address, st.st_size, MADV_WILLNEED);
+
+    site_bundle *bundle = new site_bundle;
+    bundle->m_address = address;
+    bundle->m_size = st.st_size;
+    bundle->m_header = header;
+    bundle->m_entries = entries;
+    return bundle;
+}
+
+site_bundle::~site_bundle()
+{
+    if (m_address)
+        munmap(m_address, m_size);
+}
+
+const bundle_entry *site_bundle::find(const char *path) const
+{
+    size_t len = strlen(path);
+    int low = 0, high = (int)m_header->entry_count - 1;
+    while (low <= high)
+    {
+        int mid = low + (high - low) / 2;
+        const bundle_entry &e = m_entries[mid];
+        size_t n = e.path_len < len ? e.path_len : len;
+        int cmp = memcmp(m_address + e.path_offset, path, n);
+        if (0 == cmp)
+            cmp = e.path_len < len ? -1 : (e.path_len > len ? 1 : 0);
+
+        if (0 == cmp)
+            return &e;
+        else if (cmp < 0)
+            low = mid + 1;
+        else
+            high = mid - 1;
+    }
+    return NULL;
+}
+
+void site_bundle::ref()
+{
+    m_lock.lock();
+    ++m_refcount;
+    m_lock.unlock();
+}
+
+void site_bundle::unref()
+{
+    m_lock.lock();
+    bool dead = (0 == --m_refcount);
+    m_lock.unlock();
+
+    if (dead)
+        delete this;
+}
+
+bundle_root::~bundle_root()
+{
+    if (m_current)
+        m_current->unref();
+}
+
+bool bundle_root::init(const char *path)
+{
+    strncpy(m_path, path, sizeof(m_path) - 1);
+    m_path[sizeof(m_path) - 1] = '\0';
+    m_current = site_bundle::open(m_path);
+    m_enabled = (m_current != NULL);
+    return m_enabled;
+}
+
+bool bundle_root::reload()
+{
+    if (!m_enabled)
+        return false;
+
+    site_bundle *bundle = site_bundle::open(m_path);
+    if (!bundle)
+        return false;
+
+    m_lock.lock();
+    site_bundle *old = m_current;
+    m_current = bundle;
+    m_lock.unlock();
+
+    //旧包的引用由仍在发送它的连接持有
+    old->unref();
+    return true;
+}
+
+site_bundle *bundle_root::acquire()
+{
+    if (!m_enabled)
+        return NULL;
+
+    m_lock.lock();
+    site_bundle *bundle = m_current;
+    bundle->ref();
+    m_lock.unlock();
+    return bundle;
+}
+
+void bundle_root::release(site_bundle *bundle)
+{
+    if (bundle)
+        bundle->unref();
+}
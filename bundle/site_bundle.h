@@ -0,0 +1,110 @@
+#ifndef SITE_BUNDLE_H
+#define SITE_BUNDLE_H
+
+#include <stdint.h>
+#include "../lock/locker.h"
+
+/*
+* 站点包(site bundle)
+* 构建期由bundle_packer把整个网站根目录打包成一个带索引的只读文件，服务器启动时一次mmap即可提供全部静态资源，
+* 不再对每个文件做stat/open/mmap；发布新版本时只需把新包rename覆盖旧包并发送SIGHUP，切换是原子的
+*
+* 文件布局(小端)：
+*   bundle_header | bundle_entry[entry_count](按路径升序) | 路径字符串 | 预生成的响应头 | 按页对齐的正文(原文与gzip压缩版本)
+*/
+
+#define BUNDLE_MAGIC "TWSBNDL1"
+#define BUNDLE_VERSION 1
+#define BUNDLE_ALIGN 4096
+
+struct bundle_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_count;
+    uint64_t index_offset;  //bundle_entry数组的偏移
+    uint64_t file_size;     //整个包的大小，用于校验是否被截断
+};
+
+struct bundle_entry
+{
+    uint64_t path_offset;       //以/开头的url路径，不以\0结尾
+    uint64_t path_len;
+    uint64_t header_offset;     //预生成的Content-Length、Content-Type等响应头
+    uint64_t header_len;
+    uint64_t body_offset;       //正文，按BUNDLE_ALIGN对齐
+    uint64_t body_len;
+    uint64_t gz_header_offset;  //gzip版本的响应头，gz_body_len为0表示没有压缩版本
+    uint64_t gz_header_len;
+    uint64_t gz_body_offset;
+    uint64_t gz_body_len;
+    uint64_t mtime;
+};
+
+//一个已映射的站点包，引用计数归零时解除映射
+class site_bundle
+{
+public:
+    static site_bundle *open(const char *path);
+
+    //二分查找url路径对应的条目，找不到返回NULL
+    const bundle_entry *find(const char *path) const;
+    const char *at(uint64_t offset) const
+    {
+        return m_address + offset;
+    }
+
+    void ref();
+    void unref();
+
+private:
+    site_bundle() : m_address(NULL), m_size(0), m_refcount(1) {}
+    ~site_bundle();
+    //[offset, offset+len)是否落在包内，写成减法避免相加溢出
+    static bool in_range(uint64_t offset, uint64_t len, uint64_t size)
+    {
+        return offset <= size && len <= size - offset;
+    }
+
+    char *m_address;
+    long m_size;
+    const bundle_header *m_header;
+    const bundle_entry *m_entries;
+    int m_refcount;
+    locker m_lock;
+};
+
+//服务器当前使用的站点包，支持运行期原子替换
+class bundle_root
+{
+public:
+    //C++11以后,使用局部变量懒汉不用加锁
+    static bundle_root *get_instance()
+    {
+        static bundle_root instance;
+        return &instance;
+    }
+
+    bool init(const char *path);
+    //重新映射同一路径上的新包，旧包在最后一个使用者释放后解除映射
+    bool reload();
+    bool enabled() const
+    {
+        return m_enabled;
+    }
+
+    //取得当前包并增加引用，未启用时返回NULL
+    site_bundle *acquire();
+    void release(site_bundle *bundle);
+
+private:
+    bundle_root() : m_enabled(false), m_current(NULL) {}
+    ~bundle_root();
+
+    bool m_enabled;
+    char m_path[256];
+    site_bundle *m_current;
+    locker m_lock;
+};
+
+#endif
@@ -30,11 +30,39 @@ Config::Config(){
 
     //并发模型,默认是proactor
     actor_model = 0;
+
+    //站点包路径,默认不使用,直接读取root目录下的文件
+    bundle_path = "";
+
+    //日志刷盘阈值,默认积压1秒或64KB写入一次,ERROR级别立即写入
+    log_flush_interval = 1000;
+    log_flush_size = 65536;
+
+    //二进制日志,默认不使用
+    log_binary = 0;
+
+    //运行时日志级别,默认0(debug),运行中可用SIGUSR1/SIGUSR2调低/调高
+    log_level = 0;
+
+    //访问日志采样间隔,默认记录每个响应,0表示关闭
+    access_sample = 1;
+
+    //非阻塞数据库连接数,默认0,登录注册走阻塞的连接池
+    async_db_num = 0;
+
+    //用户缓存容量，默认65536个用户
+    user_cache = USER_CACHE_DEFAULT;
+
+    //嵌入式存储的数据文件，默认为空，使用MySQL
+    store_path = "";
+
+    //用户快照文件，默认为空，不使用快照
+    snapshot_path = "";
 }
 
 void Config::parse_arg(int argc, char*argv[]){
     int opt;
-    const char *str = "p:l:m:o:s:t:c:a:"; //选项字符串，分隔符'：'表示该选项带参数，'::'表示可不带参数
+    const char *str = "p:l:m:o:s:t:c:a:b:f:F:B:v:A:d:u:D:S:"; //选项字符串，分隔符'：'表示该选项带参数，'::'表示可不带参数
     while ((opt = getopt(argc, argv, str)) != -1) //getopt一次读一个选项，-1表示找不到更多选项，定义在unistd.h
     {
         switch (opt)
@@ -79,6 +107,56 @@ void Config::parse_arg(int argc, char*argv[]){
             actor_model = atoi(optarg);
             break;
         }
+        case 'b':
+        {
+            bundle_path = optarg;
+            break;
+        }
+        case 'f':
+        {
+            log_flush_interval = atoi(optarg);
+            break;
+        }
+        case 'F':
+        {
+            log_flush_size = atoi(optarg);
+            break;
+        }
+        case 'B':
+        {
+            log_binary = atoi(optarg);
+            break;
+        }
+        case 'v':
+        {
+            log_level = atoi(optarg);
+            break;
+        }
+        case 'A':
+        {
+            access_sample = atoi(optarg);
+            break;
+        }
+        case 'd':
+        {
+            async_db_num = atoi(optarg);
+            break;
+        }
+        case 'u':
+        {
+            user_cache = atoi(optarg);
+            break;
+        }
+        case 'D':
+        {
+            store_path = optarg;
+            break;
+        }
+        case 'S':
+        {
+            snapshot_path = optarg;
+            break;
+        }
         default:
             break;
         }
@@ -42,6 +42,36 @@ public:
 
     //并发模型选择
     int actor_model;
+
+    //站点包路径
+    string bundle_path;
+
+    //日志刷盘时间阈值(毫秒)
+    int log_flush_interval;
+
+    //日志刷盘大小阈值(字节)
+    int log_flush_size;
+
+    //二进制日志
+    int log_binary;
+
+    //运行时日志级别
+    int log_level;
+
+    //访问日志采样间隔
+    int access_sample;
+
+    //非阻塞数据库连接数
+    int async_db_num;
+
+    //用户缓存容量
+    int user_cache;
+
+    //嵌入式存储的数据文件
+    string store_path;
+
+    //用户快照文件
+    string snapshot_path;
 };
 
 #endif
\ No newline at end of file
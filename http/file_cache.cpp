@@ -0,0 +1,545 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "file_cache.h"
+#include "http_conn.h"
+#include "../timer/coarse_clock.h"
+
+//缓存容量默认256MB，映射本身只占虚拟地址空间，容量限制的是长期驻留的页缓存
+static const long DEFAULT_CACHE_BYTES = 256L * 1024 * 1024;
+
+file_cache::file_cache()
+{
+    m_bytes = 0;
+    m_max_bytes = DEFAULT_CACHE_BYTES;
+    m_io_thread_number = 0;
+    m_io_threads = NULL;
+    m_eventfd = -1;
+    m_close_log = 0;
+}
+
+file_cache::~file_cache()
+{
+    map<string, file_entry *>::iterator it;
+    for (it = m_entries.begin(); it != m_entries.end(); ++it)
+    {
+        destroy(it->second);
+    }
+    m_entries.clear();
+    m_lru.clear();
+    delete[] m_io_threads;
+    if (m_eventfd >= 0)
+        close(m_eventfd);
+}
+
+void file_cache::init(int io_thread_number)
+{
+    if (io_thread_number <= 0 || m_io_threads)
+        return;
+
+    m_io_threads = new pthread_t[io_thread_number];
+    for (int i = 0; i < io_thread_number; ++i)
+    {
+        if (pthread_create(m_io_threads + i, NULL, worker, this) != 0)
+            throw std::exception();
+        if (pthread_detach(m_io_threads[i]))
+            throw std::exception();
+    }
+    m_io_thread_number = io_thread_number;
+}
+
+void file_cache::start(int epollfd, int close_log)
+{
+    m_close_log = close_log;
+    m_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_eventfd < 0)
+    {
+        LOG_ERROR("file cache eventfd failure:%d", errno);
+        return;
+    }
+    epoll_event event;
+    event.data.fd = m_eventfd;
+    event.events = EPOLLIN;
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, m_eventfd, &event);
+}
+
+bool file_cache::same_file(const struct stat &a, const struct stat &b)
+{
+    return a.st_ino == b.st_ino && a.st_dev == b.st_dev &&
+           a.st_size == b.st_size && a.st_mtime == b.st_mtime;
+}
+
+void file_cache::destroy(file_entry *entry)
+{
+    if (entry->address)
+    {
+        munmap(entry->address, entry->file_stat.st_size);
+    }
+    delete entry;
+}
+
+//mincore逐页查询映射是否在页缓存中，区间起点需按页对齐
+//发送途中会频繁调用，结果放在栈上的定长数组里分段查询，不做堆分配
+bool file_cache::resident(const char *address, long length)
+{
+    if (!address || length <= 0)
+        return true;
+
+    static const long PROBE_PAGES = 256;
+    long page = sysconf(_SC_PAGESIZE);
+    unsigned long start = (unsigned long)address & ~(page - 1);
+    unsigned long end = (unsigned long)address + length;
+
+    unsigned char vec[PROBE_PAGES];
+    while (start < end)
+    {
+        unsigned long span = end - start;
+        if (span > (unsigned long)(PROBE_PAGES * page))
+            span = PROBE_PAGES * page;
+        long pages = (span + page - 1) / page;
+        if (mincore((void *)start, span, vec) != 0)
+            return false;
+        for (long i = 0; i < pages; ++i)
+        {
+            if (!(vec[i] & 1))
+                return false;
+        }
+        start += pages * page;
+    }
+    return true;
+}
+
+//提示内核提前读入，并逐页触发缺页，返回时数据已在页缓存中
+void file_cache::fault_in(const char *address, long length)
+{
+    if (!address || length <= 0)
+        return;
+
+    long page = sysconf(_SC_PAGESIZE);
+    unsigned long start = (unsigned long)address & ~(page - 1);
+    madvise((void *)start, (unsigned long)address + length - start, MADV_WILLNEED);
+
+    volatile char sum = 0;
+    for (long off = 0; off < length; off += page)
+    {
+        sum += address[off];
+    }
+    sum += address[length - 1];
+}
+
+//将缓存项移出索引，此后的请求不会再命中它；已持有引用的连接继续使用，引用归零时释放
+void file_cache::detach(file_entry *entry)
+{
+    m_entries.erase(entry->path);
+    m_lru.erase(entry->lru_pos);
+    m_bytes -= entry->file_stat.st_size;
+    entry->detached = true;
+}
+
+//从LRU表尾淘汰已加载完成且无人引用的缓存项，直到能容纳need字节
+void file_cache::evict(long need)
+{
+    list<file_entry *>::iterator it = m_lru.end();
+    while (m_bytes + need > m_max_bytes && it != m_lru.begin())
+    {
+        --it;
+        file_entry *entry = *it;
+        if (entry->refcount > 0 || entry->state != file_entry::READY)
+            continue;
+
+        //先记录后继位置，detach会使当前迭代器失效
+        list<file_entry *>::iterator next = it;
+        ++next;
+        detach(entry);
+        destroy(entry);
+        it = next;
+    }
+}
+
+file_cache::LOOKUP_STATUS file_cache::acquire(const char *path, const struct stat &st, http_conn *conn, file_entry **entry)
+{
+    m_lock.lock();
+
+    map<string, file_entry *>::iterator it = m_entries.find(path);
+    if (it != m_entries.end())
+    {
+        file_entry *cached = it->second;
+        //文件未被修改：加载完成则直接命中，加载中则挂入等待队列
+        if (same_file(cached->file_stat, st))
+        {
+            cached->refcount++;
+            m_lru.splice(m_lru.begin(), m_lru, cached->lru_pos);
+            *entry = cached;
+
+            if (cached->state == file_entry::LOADING)
+            {
+                wait_on(cached, conn);
+                m_lock.unlock();
+                return CACHE_WAIT;
+            }
+
+            //已加载的映射可能在内存紧张时被内核换出，每个缓存项每秒最多探测一次
+            time_t now = coarse_clock::get_instance()->mono_sec();
+            if (!cached->address || cached->probed == now)
+            {
+                m_lock.unlock();
+                return CACHE_HIT;
+            }
+            cached->probed = now;
+            m_lock.unlock();
+
+            if (resident(cached->address, cached->file_stat.st_size))
+                return CACHE_HIT;
+            if (0 == m_io_thread_number)
+            {
+                fault_in(cached->address, cached->file_stat.st_size);
+                return CACHE_HIT;
+            }
+
+            //重新进入加载状态，交给I/O线程预读；已在发送的连接继续使用原映射
+            m_lock.lock();
+            if (cached->state == file_entry::READY)
+            {
+                cached->state = file_entry::LOADING;
+                wait_on(cached, conn);
+                m_lock.unlock();
+
+                io_job job = {cached, NULL, 0, cached->address, cached->file_stat.st_size};
+                submit(job);
+                return CACHE_WAIT;
+            }
+            wait_on(cached, conn);
+            m_lock.unlock();
+            return CACHE_WAIT;
+        }
+
+        //文件已被修改，旧映射移出索引，重新加载
+        detach(cached);
+        if (0 == cached->refcount && cached->state != file_entry::LOADING)
+            destroy(cached);
+    }
+
+    evict(st.st_size);
+
+    file_entry *created = new file_entry;
+    created->path = path;
+    created->address = NULL;
+    created->file_stat = st;
+    created->state = file_entry::LOADING;
+    created->refcount = 1;
+    created->detached = false;
+    created->probed = 0;
+    m_lru.push_front(created);
+    created->lru_pos = m_lru.begin();
+    m_entries[created->path] = created;
+    m_bytes += st.st_size;
+    *entry = created;
+
+    m_lock.unlock();
+    return CACHE_LOAD;
+}
+
+file_entry *file_cache::peek(const char *path, const struct stat &st)
+{
+    m_lock.lock();
+    map<string, file_entry *>::iterator it = m_entries.find(path);
+    if (it == m_entries.end() || it->second->state != file_entry::READY ||
+        !same_file(it->second->file_stat, st))
+    {
+        m_lock.unlock();
+        return NULL;
+    }
+
+    file_entry *cached = it->second;
+    cached->refcount++;
+    m_lru.splice(m_lru.begin(), m_lru, cached->lru_pos);
+    time_t now = coarse_clock::get_instance()->mono_sec();
+    bool probe = cached->address && cached->probed != now;
+    m_lock.unlock();
+
+    //不在页缓存中的交给工作线程走完整的加载流程，这里不更新探测时间
+    if (probe)
+    {
+        if (!resident(cached->address, cached->file_stat.st_size))
+        {
+            release(cached);
+            return NULL;
+        }
+        m_lock.lock();
+        cached->probed = now;
+        m_lock.unlock();
+    }
+    return cached;
+}
+
+file_cache::LOOKUP_STATUS file_cache::load(file_entry *entry, http_conn *conn)
+{
+    char *address = NULL;
+    long size = entry->file_stat.st_size;
+
+    //空文件不需要映射
+    if (size > 0)
+    {
+        int fd = open(entry->path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            finish(entry, false);
+            return CACHE_FAIL;
+        }
+        address = (char *)mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (MAP_FAILED == address)
+        {
+            finish(entry, false);
+            return CACHE_FAIL;
+        }
+    }
+
+    m_lock.lock();
+    entry->address = address;
+    m_lock.unlock();
+
+    //数据已在页缓存中，直接完成加载
+    if (resident(address, size))
+    {
+        finish(entry, true);
+        return CACHE_HIT;
+    }
+    if (0 == m_io_thread_number)
+    {
+        fault_in(address, size);
+        finish(entry, true);
+        return CACHE_HIT;
+    }
+
+    //冷文件：加载者自身也挂入等待队列，由I/O线程预读完成后统一恢复
+    m_lock.lock();
+    wait_on(entry, conn);
+    m_lock.unlock();
+
+    io_job job = {entry, NULL, 0, address, size};
+    submit(job);
+    return CACHE_WAIT;
+}
+
+//连接挂入等待队列，调用者持有m_lock
+void file_cache::wait_on(file_entry *entry, http_conn *conn)
+{
+    file_waiter waiter = {conn, conn->generation()};
+    entry->waiters.push_back(waiter);
+    m_waiting[conn] = entry;
+}
+
+//加载或预读结束，更新状态并把挂起的等待者交回主线程恢复，每个等待者持有一次引用
+void file_cache::finish(file_entry *entry, bool ok)
+{
+    list<file_waiter> waiters;
+    m_lock.lock();
+    entry->state = ok ? file_entry::READY : file_entry::FAILED;
+    entry->probed = coarse_clock::get_instance()->mono_sec();
+    waiters.swap(entry->waiters);
+    list<file_waiter>::iterator it;
+    for (it = waiters.begin(); it != waiters.end(); ++it)
+    {
+        map<http_conn *, file_entry *>::iterator waiting = m_waiting.find(it->conn);
+        if (waiting != m_waiting.end() && waiting->second == entry)
+            m_waiting.erase(waiting);
+    }
+    //加载失败的缓存项移出索引，下一次请求重新尝试
+    if (!ok && !entry->detached)
+        detach(entry);
+    //等待者全部撤销后，已移出索引的缓存项在这里释放
+    bool dead = waiters.empty() && entry->detached && 0 == entry->refcount;
+    m_lock.unlock();
+
+    if (dead)
+    {
+        destroy(entry);
+        return;
+    }
+    list<file_done> done;
+    for (it = waiters.begin(); it != waiters.end(); ++it)
+    {
+        file_done item = {it->conn, it->tag, entry};
+        done.push_back(item);
+    }
+    post(done);
+}
+
+//完成通知排入队列并唤醒主线程；eventfd不可用时只能就地回调
+void file_cache::post(list<file_done> &done)
+{
+    if (m_eventfd < 0)
+    {
+        for (list<file_done>::iterator it = done.begin(); it != done.end(); ++it)
+            deliver(*it);
+        return;
+    }
+    m_done_lock.lock();
+    m_done.splice(m_done.end(), done);
+    m_done_lock.unlock();
+
+    uint64_t one = 1;
+    if (write(m_eventfd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        LOG_ERROR("file cache wakeup failure:%d", errno);
+}
+
+void file_cache::on_event(int fd)
+{
+    uint64_t count;
+    if (read(fd, &count, sizeof(count)) <= 0)
+        return;
+
+    list<file_done> done;
+    m_done_lock.lock();
+    done.swap(m_done);
+    m_done_lock.unlock();
+    for (list<file_done>::iterator it = done.begin(); it != done.end(); ++it)
+        deliver(*it);
+}
+
+//在主线程核对请求代数：连接挂起后被定时器关闭或描述符已被新连接复用时代数已变，不再回调
+//关闭和accept都在主线程，核对通过后直到回调返回，描述符都仍属于挂起的那个连接
+void file_cache::deliver(const file_done &done)
+{
+    if (done.entry)
+    {
+        if (done.conn->generation() != done.tag)
+            release(done.entry);
+        else
+            done.conn->file_loaded(done.entry);
+    }
+    else if (claim(done.conn, done.tag) && done.conn->generation() == done.tag)
+    {
+        done.conn->file_prefetched();
+    }
+}
+
+void file_cache::release(file_entry *entry)
+{
+    if (!entry)
+        return;
+
+    m_lock.lock();
+    entry->refcount--;
+    bool dead = entry->detached && 0 == entry->refcount && entry->state != file_entry::LOADING;
+    m_lock.unlock();
+
+    if (dead)
+        destroy(entry);
+}
+
+bool file_cache::prefetch(http_conn *conn, file_entry *entry, char *address, long length)
+{
+    if (0 == m_io_thread_number || !entry)
+        return false;
+
+    m_lock.lock();
+    entry->refcount++;
+    m_lock.unlock();
+
+    io_job job = {entry, conn, conn->generation(), address, length};
+    m_io_lock.lock();
+    m_prefetching[conn] = job.tag;
+    m_io_lock.unlock();
+    submit(job);
+    return true;
+}
+
+//撤销连接挂起的等待和预读：等待者从缓存项的等待队列中摘除并释放引用，
+//预读任务留在队列中由I/O线程照常执行，完成后不再回调
+void file_cache::cancel(http_conn *conn)
+{
+    bool dead = false;
+    file_entry *entry = NULL;
+    m_lock.lock();
+    map<http_conn *, file_entry *>::iterator waiting = m_waiting.find(conn);
+    if (waiting != m_waiting.end())
+    {
+        entry = waiting->second;
+        m_waiting.erase(waiting);
+        list<file_waiter>::iterator it;
+        for (it = entry->waiters.begin(); it != entry->waiters.end(); ++it)
+        {
+            if (it->conn == conn)
+            {
+                entry->waiters.erase(it);
+                entry->refcount--;
+                break;
+            }
+        }
+        //仍在加载的缓存项被I/O线程引用，由finish释放
+        dead = entry->detached && 0 == entry->refcount && entry->state != file_entry::LOADING;
+    }
+    m_lock.unlock();
+    if (dead)
+        destroy(entry);
+
+    m_io_lock.lock();
+    m_prefetching.erase(conn);
+    m_io_lock.unlock();
+}
+
+//预读完成后认领任务，连接在此期间被撤销或已提交了新的预读时返回false
+bool file_cache::claim(http_conn *conn, unsigned int tag)
+{
+    m_io_lock.lock();
+    map<http_conn *, unsigned int>::iterator it = m_prefetching.find(conn);
+    bool live = it != m_prefetching.end() && it->second == tag;
+    if (live)
+        m_prefetching.erase(it);
+    m_io_lock.unlock();
+    return live;
+}
+
+void file_cache::submit(const io_job &job)
+{
+    m_io_lock.lock();
+    m_io_queue.push_back(job);
+    m_io_lock.unlock();
+    m_io_stat.post();
+}
+
+void *file_cache::worker(void *arg)
+{
+    file_cache *cache = (file_cache *)arg;
+    cache->run();
+    return cache;
+}
+
+void file_cache::run()
+{
+    while (true)
+    {
+        m_io_stat.wait();
+        m_io_lock.lock();
+        if (m_io_queue.empty())
+        {
+            m_io_lock.unlock();
+            continue;
+        }
+        io_job job = m_io_queue.front();
+        m_io_queue.pop_front();
+        m_io_lock.unlock();
+
+        //在I/O线程内承受缺页造成的磁盘等待
+        fault_in(job.address, job.length);
+
+        if (!job.conn)
+        {
+            finish(job.entry, true);
+        }
+        else
+        {
+            //重新注册写事件交给主线程，在那里核对连接是否仍是提交预读的那一个
+            release(job.entry);
+            list<file_done> done;
+            file_done item = {job.conn, job.tag, NULL};
+            done.push_back(item);
+            post(done);
+        }
+    }
+}
@@ -0,0 +1,160 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <sys/stat.h>
+#include <pthread.h>
+#include <time.h>
+#include <string>
+#include <map>
+#include <list>
+#include "../lock/locker.h"
+
+using namespace std;
+
+class http_conn;
+
+/*
+* 静态文件缓存
+* 以文件路径为键缓存mmap映射，多个连接共享同一份映射，通过引用计数管理映射的生命周期
+* 冷文件加载采用single-flight合并：同一路径并发未命中时，只有第一个请求负责open/mmap(加载者)，
+* 其余请求挂到缓存项的等待队列上后直接返回，不阻塞工作线程；加载完成后依次恢复等待的连接
+*
+* 磁盘I/O卸载
+* 对mmap映射首次访问时的缺页会阻塞在磁盘I/O上，proactor模式下writev由主线程执行，会卡住整个事件循环
+* 因此通过mincore探测映射是否已在页缓存中，不在时交给专门的I/O线程预读，预读完成后再恢复连接
+*
+* 挂起的连接可能在加载或预读期间被定时器关闭，描述符随后被新连接复用
+* 等待者和预读任务都记录挂起时连接的请求代数；完成后不在加载者或I/O线程里直接回调，
+* 而是经eventfd交回主线程，在关闭连接和accept所在的线程里核对代数后再恢复连接，核对和恢复之间描述符不会被复用
+*/
+
+//等待加载完成的连接，tag为挂起时的请求代数
+struct file_waiter
+{
+    http_conn *conn;
+    unsigned int tag;
+};
+
+struct file_entry
+{
+    enum STATE
+    {
+        LOADING = 0,
+        READY,
+        FAILED
+    };
+
+    string path;
+    char *address;          //mmap映射地址，空文件为NULL
+    struct stat file_stat;  //加载时的文件信息，用于判断文件是否被修改
+    int state;
+    int refcount;           //持有该映射的连接数，包括等待者
+    bool detached;          //已被淘汰或替换出索引，引用归零时释放
+    time_t probed;          //上一次探测页缓存驻留的时间，单调时钟的秒数
+    list<file_waiter> waiters;              //等待加载完成的连接
+    list<file_entry *>::iterator lru_pos;   //在LRU链表中的位置
+};
+
+//I/O线程的任务：conn为空时预读整个缓存项，否则为正在发送的连接预读下一段数据
+struct io_job
+{
+    file_entry *entry; //预读期间持有一次引用
+    http_conn *conn;
+    unsigned int tag;  //提交时连接的请求代数
+    char *address;
+    long length;
+};
+
+//交回主线程的完成通知：entry非空为加载完成的等待者，为空为预读完成的发送中连接
+struct file_done
+{
+    http_conn *conn;
+    unsigned int tag;
+    file_entry *entry;
+};
+
+class file_cache
+{
+public:
+    enum LOOKUP_STATUS
+    {
+        CACHE_HIT = 0, //命中，可直接使用映射
+        CACHE_LOAD,    //未命中，调用者作为加载者负责调用load
+        CACHE_WAIT,    //正在加载或预读，调用者已挂入等待队列
+        CACHE_FAIL     //加载失败
+    };
+
+    //C++11以后,使用局部变量懒汉不用加锁
+    static file_cache *get_instance()
+    {
+        static file_cache instance;
+        return &instance;
+    }
+
+    //创建I/O线程，未调用时在调用线程内同步预读
+    void init(int io_thread_number);
+
+    //查找文件，st为调用者stat得到的文件信息，返回的entry已增加引用
+    LOOKUP_STATUS acquire(const char *path, const struct stat &st, http_conn *conn, file_entry **entry);
+    //只查不加载：已加载且数据在页缓存中时返回增加了引用的缓存项，否则返回NULL，供主线程快速路径使用
+    file_entry *peek(const char *path, const struct stat &st);
+    //加载者调用：open/mmap，数据已驻留返回CACHE_HIT，需预读时conn挂起并返回CACHE_WAIT
+    LOOKUP_STATUS load(file_entry *entry, http_conn *conn);
+    //释放一次引用
+    void release(file_entry *entry);
+
+    //探测映射区间是否全部在页缓存中
+    static bool resident(const char *address, long length);
+    //发送途中数据不在页缓存时，交给I/O线程预读，完成后由主线程调用conn->file_prefetched()
+    bool prefetch(http_conn *conn, file_entry *entry, char *address, long length);
+    //连接关闭时调用，撤销其挂起的等待和预读，等待者持有的引用在这里释放
+    void cancel(http_conn *conn);
+
+    //注册完成通知的eventfd，之后的完成都由调用者的epoll送回on_event，在主线程恢复连接
+    void start(int epollfd, int close_log);
+    //以下只在主线程调用
+    bool owns(int fd) { return m_eventfd >= 0 && fd == m_eventfd; }
+    void on_event(int fd);
+
+private:
+    file_cache();
+    ~file_cache();
+
+    void detach(file_entry *entry);
+    void evict(long need);
+    void submit(const io_job &job);
+    void finish(file_entry *entry, bool ok);
+    void wait_on(file_entry *entry, http_conn *conn);
+    bool claim(http_conn *conn, unsigned int tag);
+    void post(list<file_done> &done);
+    void deliver(const file_done &done);
+    static bool same_file(const struct stat &a, const struct stat &b);
+    static void destroy(file_entry *entry);
+    static void fault_in(const char *address, long length);
+
+    //I/O线程运行的函数
+    static void *worker(void *arg);
+    void run();
+
+private:
+    map<string, file_entry *> m_entries; //路径到缓存项的索引
+    list<file_entry *> m_lru;            //表头为最近使用
+    long m_bytes;                        //索引中映射的总字节数
+    long m_max_bytes;                    //缓存容量，超出后淘汰无人引用的缓存项
+    map<http_conn *, file_entry *> m_waiting; //正在等待加载的连接及其缓存项
+    locker m_lock;
+
+    int m_io_thread_number;              //I/O线程数
+    pthread_t *m_io_threads;
+    list<io_job> m_io_queue;             //预读任务队列
+    map<http_conn *, unsigned int> m_prefetching; //有预读任务未完成的连接及任务的请求代数
+    locker m_io_lock;                    //保护预读任务队列
+    sem m_io_stat;                       //是否有预读任务
+
+    int m_eventfd;                       //唤醒主线程处理完成通知
+    list<file_done> m_done;              //等待主线程处理的完成通知
+    locker m_done_lock;                  //保护m_done
+    int m_close_log;
+};
+
+#endif
@@ -2,6 +2,7 @@
 
 #include <mysql/mysql.h>
 #include <fstream>
+#include "../threadpool/threadpool.h"
 
 //定义http响应的一些状态信息
 const char *ok_200_title = "OK";
@@ -13,39 +14,8 @@ const char *error_404_title = "Not Found";
 const char *error_404_form = "The requested file was not found on this server.\n";
 const char *error_500_title = "Internal Error";
 const char *error_500_form = "There was an unusual problem serving the request file.\n";
-
-locker m_lock;
-map<string, string> users;
-
-void http_conn::initmysql_result(connection_pool *connPool)
-{
-    //先从连接池中取一个连接，调用connectionRAII封装的接口
-    MYSQL *mysql = NULL;
-    connectionRAII mysqlcon(&mysql, connPool);
-
-    //在user表中检索username，passwd数据，包含main写入的默认值和浏览器端注册的
-    if (mysql_query(mysql, "SELECT username,passwd FROM user"))
-    {
-        LOG_ERROR("SELECT error:%s\n", mysql_error(mysql));
-    }
-
-    //从表中检索完整的结果集
-    MYSQL_RES *result = mysql_store_result(mysql);
-
-    //返回结果集中的列数
-    int num_fields = mysql_num_fields(result);
-
-    //返回所有字段结构的数组
-    MYSQL_FIELD *fields = mysql_fetch_fields(result);
-
-    //从结果集中获取下一行，将对应的用户名和密码，存入map中，直到所有行读完
-    while (MYSQL_ROW row = mysql_fetch_row(result))
-    {
-        string temp1(row[0]);
-        string temp2(row[1]);
-        users[temp1] = temp2;
-    }
-}
+const char *error_503_title = "Service Unavailable";
+const char *error_503_form = "The database is busy or unavailable, please try again later.\n";
 
 //对文件描述符设置非阻塞
 int setnonblocking(int fd)
@@ -96,6 +66,7 @@ void modfd(int epollfd, int fd, int ev, int TRIGMode)
 
 int http_conn::m_user_count = 0;
 int http_conn::m_epollfd = -1;
+threadpool<http_conn> *http_conn::m_threadpool = NULL;
 
 //关闭连接，关闭一个连接，客户总量减一
 void http_conn::close_conn(bool real_close)
@@ -103,6 +74,7 @@ void http_conn::close_conn(bool real_close)
     if (real_close && (m_sockfd != -1))
     {
         printf("close %d\n", m_sockfd);
+        cancel_pending();
         removefd(m_epollfd, m_sockfd);
         m_sockfd = -1;
         m_user_count--;
@@ -116,6 +88,9 @@ void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int TRIGMo
     m_sockfd = sockfd;
     m_address = addr;
 
+    //上一个使用该描述符的连接被定时器关闭时可能仍持有文件映射
+    unmap();
+
     addfd(m_epollfd, sockfd, true, m_TRIGMode);
     m_user_count++;
 
@@ -128,6 +103,11 @@ void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int TRIGMo
     strcpy(sql_passwd, passwd.c_str());
     strcpy(sql_name, sqlname.c_str());
 
+    //reactor模式下主线程与工作线程的同步标志，只在新连接时重置
+    //长连接复用时init()可能由工作线程在发送完成后调用，此时主线程可能仍在等待improv
+    timer_flag = 0;
+    improv = 0;
+
     init();
 }
 
@@ -135,24 +115,37 @@ void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int TRIGMo
 //check_state默认为分析请求行状态
 void http_conn::init()
 {
-    mysql = NULL;
     bytes_to_send = 0;
     bytes_have_send = 0;
     m_check_state = CHECK_STATE_REQUESTLINE;
     m_linger = false;
+    m_gzip = false;
+    m_bundle_vary = false;
+    m_fast = false;
+    m_request_ready = false;
+    m_probed_end = NULL;
+    m_generation++;
+    m_db_done = false;
+    m_db_op = DB_LOGIN;
+    m_queued_at = 0;
+    m_request_start = 0;
+    m_target[0] = '\0';
+    m_queue_us = 0;
+    m_process_us = 0;
+    m_status = 0;
     m_method = GET;
     m_url = 0;
     m_version = 0;
     m_content_length = 0;
     m_host = 0;
+    m_session = 0;
+    m_new_session[0] = '\0';
     m_start_line = 0;
     m_checked_idx = 0;
     m_read_idx = 0;
     m_write_idx = 0;
     cgi = 0;
     m_state = 0;
-    timer_flag = 0;
-    improv = 0;
 
     memset(m_read_buf, '\0', READ_BUFFER_SIZE);
     memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
@@ -212,6 +205,10 @@ bool http_conn::read_once()
     }
     int bytes_read = 0;
 
+    //新请求的起点，访问日志据此计算总耗时；reactor模式下先排队再读，起点为放入队列的时间
+    if (0 == m_read_idx && access_log::get_instance()->enabled())
+        m_request_start = m_queued_at ? m_queued_at : access_log::now_us();
+
     //LT读取数据
     if (0 == m_TRIGMode)
     {
@@ -301,6 +298,9 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
     //一般的 情况不会带有上述两种符号，直接是单独的/或/后面带访问资源
     if (!m_url || m_url[0] != '/')
         return BAD_REQUEST;
+    //访问日志记录客户端请求的路径，之后对m_url的改写(/→judge.html、登录注册的跳转页)不影响它
+    if (m_request_start)
+        snprintf(m_target, FILENAME_LEN, "%s", m_url);
     //当url为/时，显示判断界面
     if (strlen(m_url) == 1)
         strcat(m_url, "judge.html");
@@ -349,6 +349,25 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
         text += strspn(text, " \t");
         m_host = text;
     }
+    //解析请求头部Accept-Encoding字段，站点包中有gzip版本时优先发送
+    else if (strncasecmp(text, "Accept-Encoding:", 16) == 0)
+    {
+        m_gzip = accepts_gzip(text + 16);
+    }
+    //解析请求头部Cookie字段，只关心会话令牌sid
+    else if (strncasecmp(text, "Cookie:", 7) == 0)
+    {
+        for (char *sid = strstr(text + 7, "sid="); sid; sid = strstr(sid + 4, "sid="))
+        {
+            //跳过名字以sid结尾的其他Cookie
+            if (sid == text + 7 || sid[-1] == ' ' || sid[-1] == ';')
+            {
+                if (strlen(sid + 4) >= (size_t)SESSION_TOKEN_LEN)
+                    m_session = sid + 4;
+                break;
+            }
+        }
+    }
     else
     {
         LOG_INFO("oop!unknow header: %s", text);
@@ -450,7 +469,6 @@ http_conn::HTTP_CODE http_conn::do_request()
     //3CGISQL.cgi: POST请求，进行注册校验, 注册成功跳转到log.html，即登录页面, 注册失败跳转到registerError.html，即注册失败页面
     if (cgi == 1 && (*(p + 1) == '2' || *(p + 1) == '3'))
     {
-
         //根据标志判断是登录检测还是注册检测
         char flag = m_url[1];
 
@@ -473,42 +491,97 @@ http_conn::HTTP_CODE http_conn::do_request()
             password[j] = m_string[i];
         password[j] = '\0';
 
-        if (*(p + 1) == '3')
+        //依次查用户缓存和布隆过滤器，能给出结论时不访问数据库，快速路径上也可直接完成
+        //found为用户存在，stored为其密码
+        //查数据库出错时不知道用户是否存在，一律返回503：当作不存在会让注册插入重名用户(user表的username没有唯一索引)
+        user_store *store = user_store::get_instance();
+        char stored[100];
+        bool found = false;
+        if (m_db_done && DB_LOGIN == m_db_op)
+        {
+            //非阻塞数据库的查询结果，回调中已填入用户缓存
+            found = m_db_found;
+            strcpy(stored, m_db_password);
+            m_db_done = false;
+            if (m_db_err)
+            {
+                LOG_ERROR("SELECT error:%u", m_db_err);
+                return SERVICE_UNAVAILABLE;
+            }
+        }
+        else if (!m_db_done)
         {
-            //如果是注册，先检测数据库中是否有重名的
-            //没有重名的，进行增加数据
-            char *sql_insert = (char *)malloc(sizeof(char) * 200);
-            strcpy(sql_insert, "INSERT INTO user(username, passwd) VALUES(");
-            strcat(sql_insert, "'");
-            strcat(sql_insert, name);
-            strcat(sql_insert, "', '");
-            strcat(sql_insert, password);
-            strcat(sql_insert, "')");
-
-            if (users.find(name) == users.end())
+            found = store->find(name, stored);
+            bool maybe = !found && user_filter::get_instance()->may_contain(name);
+            //缓存未命中且过滤器不能排除时先查快照，映射的页可能不在内存中，不在主线程上查
+            user_snapshot *snapshot = user_snapshot::get_instance();
+            if (maybe && snapshot->enabled())
             {
-                m_lock.lock();
-                int res = mysql_query(mysql, sql_insert);
-                users.insert(pair<string, string>(name, password));
-                m_lock.unlock();
+                if (m_fast)
+                    return DEFERRED_REQUEST;
+                found = snapshot->find(name, stored, sizeof(stored));
+                if (found)
+                    store->insert(name, stored);
+            }
+            //仍未找到时查一次数据库，查到后填入缓存
+            if (maybe && !found)
+            {
+                //非阻塞数据库：提交后挂起连接，完成后由主线程放回线程池，从这里继续
+                if (async_db::get_instance()->enabled())
+                    return submit_db(DB_LOGIN, name, password);
+                //阻塞访问数据库，交给线程池处理
+                if (m_fast)
+                    return DEFERRED_REQUEST;
+
+                //后端暂时不可用(如等不到数据库连接)或查询出错时返回503
+                if (user_backend::get_instance()->lookup(name, stored, sizeof(stored), found))
+                    return SERVICE_UNAVAILABLE;
+                if (found)
+                    store->insert(name, stored);
+            }
+        }
 
-                if (!res)
-                    strcpy(m_url, "/log.html");
-                else
-                    strcpy(m_url, "/registerError.html");
+        if (*(p + 1) == '3')
+        {
+            //如果是注册，已存在的用户名即重名
+            //不存在的交给注册写入线程，与同时到达的注册合并成一次写入；启用非阻塞数据库时提交后挂起
+            //写入成功的用户由写入线程或非阻塞数据库的回调登记进用户缓存和过滤器
+            unsigned int err = found ? 1062 : 0;
+            if (m_db_done)
+                err = m_db_err;
+            else if (!err)
+            {
+                if (async_db::get_instance()->enabled())
+                    return submit_db(DB_REGISTER, name, password);
+                if (m_fast)
+                    return DEFERRED_REQUEST;
+                err = reg_writer::get_instance()->insert(name, password);
             }
+
+            if (!err)
+                strcpy(m_url, "/log.html");
             else
+            {
+                //1062为重名，不算错误
+                if (1062 != err)
+                    LOG_ERROR("INSERT error:%u", err);
                 strcpy(m_url, "/registerError.html");
+            }
         }
         //如果是登录，直接判断
         //若浏览器端输入的用户名和密码在表中可以查找到，返回1，否则返回0
         else if (*(p + 1) == '2')
         {
-            if (users.find(name) != users.end() && users[name] == password)
+            //显式的登录总是校验密码，带着会话令牌也一样；登录成功签发新会话
+            if (found && 0 == strcmp(stored, password))
+            {
+                session_store::get_instance()->create(name, m_new_session);
                 strcpy(m_url, "/welcome.html");
+            }
             else
                 strcpy(m_url, "/logError.html");
         }
+        m_db_done = false;
     }
 
     //如果请求资源为/0，表示POST请求，跳转到register.html，即注册页面
@@ -560,6 +633,14 @@ http_conn::HTTP_CODE http_conn::do_request()
     else
         strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
 
+    //登录后才能访问的页面凭会话令牌查一次会话表，没有有效会话时返回登录页；本次请求刚登录成功的直接放行
+    if (!m_new_session[0] && protected_page(m_real_file + len) && !signed_in())
+        strncpy(m_real_file + len, "/log.html", FILENAME_LEN - len - 1);
+
+    //站点包模式：在已映射的包中查找，不访问文件系统
+    if (bundle_root::get_instance()->enabled())
+        return bundle_request(m_real_file + len);
+
     //通过stat获取请求资源文件信息，成功则将信息更新到m_file_stat结构体
     //失败返回NO_RESOURCE状态，表示资源不存在
     if (stat(m_real_file, &m_file_stat) < 0)
@@ -570,22 +651,224 @@ http_conn::HTTP_CODE http_conn::do_request()
     //判断文件类型，如果是目录，则返回BAD_REQUEST，表示请求报文有误
     if (S_ISDIR(m_file_stat.st_mode))
         return BAD_REQUEST;
-    //以只读方式获取文件描述符，通过mmap将该文件映射到内存中
-    int fd = open(m_real_file, O_RDONLY);
-    m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    close(fd);
+    //主线程只处理缓存命中，未命中的冷文件交给线程池加载
+    if (m_fast)
+    {
+        file_entry *cached = file_cache::get_instance()->peek(m_real_file, m_file_stat);
+        if (!cached)
+            return DEFERRED_REQUEST;
+        m_file_entry = cached;
+        m_file_address = cached->address;
+        return FILE_REQUEST;
+    }
+
+    //从文件缓存中获取该文件的mmap映射，未命中时由本请求加载
+    //同一文件正在被其他请求加载，或数据不在页缓存中需要I/O线程预读时，挂起本连接，完成后由file_loaded恢复
+    file_entry *entry = NULL;
+    file_cache::LOOKUP_STATUS status = file_cache::get_instance()->acquire(m_real_file, m_file_stat, this, &entry);
+    if (file_cache::CACHE_LOAD == status)
+        status = file_cache::get_instance()->load(entry, this);
+    if (file_cache::CACHE_WAIT == status)
+        return FILE_PENDING;
+    if (file_cache::CACHE_FAIL == status)
+    {
+        file_cache::get_instance()->release(entry);
+        return NO_RESOURCE;
+    }
+    m_file_entry = entry;
+    m_file_address = entry->address;
     return FILE_REQUEST; //表示请求文件存在，且可以访问
 }
 
+//登录后的页面，包括/5、/6、/7跳转到的页面和直接按路径请求
+bool http_conn::protected_page(const char *path)
+{
+    static const char *pages[] = {"/welcome.html", "/picture.html", "/video.html", "/fans.html"};
+    for (size_t i = 0; i < sizeof(pages) / sizeof(pages[0]); ++i)
+    {
+        if (0 == strcmp(path, pages[i]))
+            return true;
+    }
+    return false;
+}
+
+//按逗号拆分Accept-Encoding中的编码，q=0表示拒绝该编码
+//显式列出gzip(或x-gzip)时以它的q值为准，否则看通配符*
+bool http_conn::accepts_gzip(const char *value)
+{
+    int gzip = -1, any = -1;
+    while (*value)
+    {
+        value += strspn(value, " \t,");
+        size_t len = strcspn(value, " \t;,");
+        if (0 == len)
+            break;
+        const char *coding = value;
+        value += len;
+
+        double q = 1;
+        value += strspn(value, " \t");
+        while (';' == *value)
+        {
+            ++value;
+            value += strspn(value, " \t");
+            if (('q' == *value || 'Q' == *value) && '=' == value[1])
+                q = strtod(value + 2, NULL);
+            value += strcspn(value, ";,");
+        }
+
+        if ((4 == len && 0 == strncasecmp(coding, "gzip", 4)) || (6 == len && 0 == strncasecmp(coding, "x-gzip", 6)))
+            gzip = q > 0;
+        else if (1 == len && '*' == *coding)
+            any = q > 0;
+    }
+    return gzip >= 0 ? gzip : any > 0;
+}
+
+//请求带有有效的会话令牌：校验签名后查一次会话表，不比对密码
+bool http_conn::signed_in()
+{
+    char name[SESSION_NAME_LEN];
+    return m_session && session_store::get_instance()->lookup(m_session, name);
+}
+
+//从站点包中取出path对应的正文和预生成的响应头，正文直接指向包的映射
+http_conn::HTTP_CODE http_conn::bundle_request(const char *path)
+{
+    site_bundle *bundle = bundle_root::get_instance()->acquire();
+    const bundle_entry *entry = bundle->find(path);
+    if (!entry)
+    {
+        bundle_root::get_instance()->release(bundle);
+        return NO_RESOURCE;
+    }
+
+    bool gz = m_gzip && entry->gz_body_len > 0;
+    //主线程不能在缺页上阻塞，正文不在页缓存中时交给线程池
+    if (m_fast && !file_cache::resident(bundle->at(gz ? entry->gz_body_offset : entry->body_offset),
+                                        gz ? entry->gz_body_len : entry->body_len))
+    {
+        bundle_root::get_instance()->release(bundle);
+        return DEFERRED_REQUEST;
+    }
+    m_bundle = bundle;
+    m_file_address = (char *)bundle->at(gz ? entry->gz_body_offset : entry->body_offset);
+    m_bundle_header = bundle->at(gz ? entry->gz_header_offset : entry->header_offset);
+    m_bundle_header_len = gz ? entry->gz_header_len : entry->header_len;
+    //响应随Accept-Encoding变化，共享缓存需按该字段区分两个版本
+    m_bundle_vary = entry->gz_body_len > 0;
+    //发送流程统一以m_file_stat.st_size作为正文长度
+    m_file_stat.st_size = gz ? entry->gz_body_len : entry->body_len;
+    return FILE_REQUEST;
+}
+
+//释放对缓存映射或站点包的引用，映射本身由文件缓存和站点包统一管理
 void http_conn::unmap()
 {
-    if (m_file_address)
+    if (m_file_entry)
+    {
+        file_cache::get_instance()->release(m_file_entry);
+        m_file_entry = NULL;
+        m_file_address = 0;
+    }
+    if (m_bundle)
     {
-        munmap(m_file_address, m_file_stat.st_size);
+        bundle_root::get_instance()->release(m_bundle);
+        m_bundle = NULL;
         m_file_address = 0;
     }
 }
 
+//文件加载完成后由主线程调用，继续完成被挂起连接的响应
+void http_conn::file_loaded(file_entry *entry)
+{
+    HTTP_CODE ret = NO_RESOURCE;
+    if (file_entry::READY == entry->state)
+    {
+        m_file_entry = entry;
+        m_file_address = entry->address;
+        ret = FILE_REQUEST;
+    }
+    else
+    {
+        file_cache::get_instance()->release(entry);
+    }
+
+    if (!process_write(ret))
+    {
+        close_conn();
+        return;
+    }
+    send_response();
+}
+
+//提交非阻塞数据库请求并挂起连接
+http_conn::HTTP_CODE http_conn::submit_db(DB_OP op, const char *name, const char *password)
+{
+    db_request *req = new db_request;
+    req->op = op;
+    strcpy(req->name, name);
+    strcpy(req->password, password);
+    req->done = db_finished;
+    req->arg = this;
+    req->tag = m_generation;
+    m_db_op = op;
+    async_db::get_instance()->submit(req);
+    return DB_PENDING;
+}
+
+//非阻塞数据库的请求完成，在主线程调用
+//用户缓存和过滤器在这里登记，同名用户随后的注册立即能看到；连接随后回到线程池，从do_request继续
+void http_conn::db_finished(db_request *req)
+{
+    http_conn *conn = (http_conn *)req->arg;
+    if (!req->err && (DB_REGISTER == req->op || req->found))
+        user_store::get_instance()->insert(req->name, DB_REGISTER == req->op ? req->password : req->stored);
+    if (!req->err && DB_REGISTER == req->op)
+    {
+        user_filter::get_instance()->add(req->name);
+        user_snapshot::get_instance()->add(req->name, req->password);
+    }
+    //连接已开始处理别的请求
+    if (conn->m_generation != req->tag)
+        return;
+
+    conn->m_db_done = true;
+    conn->m_db_err = req->err;
+    conn->m_db_found = req->found;
+    strcpy(conn->m_db_password, req->stored);
+    conn->m_request_ready = true;
+    if (!m_threadpool->resume(conn))
+        conn->resume_failed();
+}
+
+//请求队列已满，放不回线程池：连接没有注册任何事件，不能等定时器超时，直接在主线程返回503
+void http_conn::resume_failed()
+{
+    LOG_WARN("%s", "request queue full, answer the db request with 503");
+    m_request_ready = false;
+    m_db_done = false;
+    if (!process_write(SERVICE_UNAVAILABLE))
+    {
+        close_conn();
+        return;
+    }
+    send_response();
+}
+
+//I/O线程预读完下一段文件数据，主线程核对连接后调用，重新注册写事件继续发送
+void http_conn::file_prefetched()
+{
+    modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+}
+
+//请求代数加一，已挂起的文件加载、预读和数据库回调随后都会被丢弃
+void http_conn::cancel_pending()
+{
+    m_generation++;
+    file_cache::get_instance()->cancel(this);
+}
+
 /*发送响应数据到浏览器客户端*/
 /*在生成响应报文时初始化byte_to_send，包括头部信息和文件数据大小*/
 /*通过writev函数循环发送响应报文数据，根据返回值更新byte_have_send和iovec结构体的指针和长度，并判断响应报文整体是否发送成功。*/
@@ -600,15 +883,28 @@ bool http_conn::write()
 {
     int temp = 0;
 
+    //write可能在工作线程中执行，重新注册事件后连接可能立即被主线程处理，因此注册事件必须是最后一步
     if (bytes_to_send == 0)
     {
-        modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
         init();
+        modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
         return true;
     }
 
     while (1)
     {
+        //待发送的文件数据不在页缓存中时，交给I/O线程预读后再发送，避免writev在缺页上阻塞发送线程
+        //每个窗口只探测一次，窗口内的数据已驻留或已预读，发送越过窗口末尾时再探测下一个窗口
+        char *base = (char *)m_iv[1].iov_base;
+        if (m_file_entry && m_iv_count == 2 && m_iv[1].iov_len > 0 && (!m_probed_end || base >= m_probed_end))
+        {
+            long window = m_iv[1].iov_len < PREFETCH_WINDOW ? m_iv[1].iov_len : PREFETCH_WINDOW;
+            m_probed_end = base + window;
+            if (!file_cache::resident(base, window) &&
+                file_cache::get_instance()->prefetch(this, m_file_entry, base, window))
+                return true;
+        }
+
         //将响应报文的状态行、消息头、空行和响应正文发送给浏览器端
         temp = writev(m_sockfd, m_iv, m_iv_count);
 
@@ -619,6 +915,7 @@ bool http_conn::write()
                 modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode); //重新注册写事件
                 return true;
             }
+            log_access();
             unmap(); //如果不是缓冲区问题，取消映射
             return false;
         }
@@ -643,24 +940,25 @@ bool http_conn::write()
         //判断条件，数据已全部发送完
         if (bytes_to_send <= 0)
         {
+            log_access();
             unmap();
-            modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode); //在epoll树上重置EPOLLONESHOT事件
 
             if (m_linger) //浏览器的请求为长连接
             {
                 init(); //重新初始化HTTP对象
+                modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode); //在epoll树上重置EPOLLONESHOT事件
                 return true;
             }
             else
             {
-                return false;
+                return false; //短连接由调用者关闭，不再注册事件
             }
         }
     }
 }
 /*将响应内容写入buffer，调用者： */
 /*add_status_line(): 添加状态行：http/1.1 状态码 状态消息*/
-/*add_headers(): 添加消息报头，内部调用add_content_length和add_linger函数 */
+/*add_headers(): 添加消息报头，内部调用add_date、add_content_length和add_linger函数 */
 /*content-length记录响应报文长度，用于浏览器端判断服务器是否发送完数据*/
 /*connection记录连接状态，用于告诉浏览器端保持长连接*/
 /*add_blank_line(): 添加空行*/
@@ -692,13 +990,27 @@ bool http_conn::add_response(const char *format, ...)
 }
 bool http_conn::add_status_line(int status, const char *title)
 {
+    m_status = status;
     return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
 }
 bool http_conn::add_headers(int content_len)
 {
-    return add_content_length(content_len) && add_linger() &&
+    return add_date() && add_content_length(content_len) && add_linger() && add_session_cookie() &&
+           add_blank_line();
+}
+bool http_conn::add_bundle_headers()
+{
+    return add_date() && add_response("%.*s", m_bundle_header_len, m_bundle_header) &&
+           (!m_bundle_vary || add_response("Vary:Accept-Encoding\r\n")) && add_linger() && add_session_cookie() &&
            add_blank_line();
 }
+//Date取自粗粒度时钟每秒格式化一次的字符串
+bool http_conn::add_date()
+{
+    clock_slot now;
+    coarse_clock::get_instance()->now(now);
+    return add_response("Date:%.*s\r\n", now.http_date_len, now.http_date);
+}
 bool http_conn::add_content_length(int content_len)
 {
     return add_response("Content-Length:%d\r\n", content_len);
@@ -711,6 +1023,13 @@ bool http_conn::add_linger()
 {
     return add_response("Connection:%s\r\n", (m_linger == true) ? "keep-alive" : "close");
 }
+//登录成功后下发会话令牌，有效期与服务端会话一致
+bool http_conn::add_session_cookie()
+{
+    if (!m_new_session[0])
+        return true;
+    return add_response("Set-Cookie:sid=%s; Path=/; Max-Age=%d; HttpOnly; SameSite=Lax\r\n", m_new_session, SESSION_TTL);
+}
 bool http_conn::add_blank_line()
 {
     return add_response("%s", "\r\n");
@@ -737,6 +1056,14 @@ bool http_conn::process_write(HTTP_CODE ret)
                 return false;
             break;
         }
+        case SERVICE_UNAVAILABLE: //数据库不可用，503
+        {
+            add_status_line(503, error_503_title);
+            add_headers(strlen(error_503_form));
+            if (!add_content(error_503_form))
+                return false;
+            break;
+        }
         case BAD_REQUEST: //报文语法有误，404
         {
             add_status_line(404, error_404_title);
@@ -758,7 +1085,11 @@ bool http_conn::process_write(HTTP_CODE ret)
             add_status_line(200, ok_200_title);
             if (m_file_stat.st_size != 0) //如果请求的资源存在
             {
-                add_headers(m_file_stat.st_size);
+                //站点包的Content-Length、Content-Type等响应头已预先生成
+                if (m_bundle)
+                    add_bundle_headers();
+                else
+                    add_headers(m_file_stat.st_size);
                 m_iv[0].iov_base = m_write_buf; //第一个iovec指针指向响应报文缓冲区，长度指向m_write_idx
                 m_iv[0].iov_len = m_write_idx;
                 m_iv[1].iov_base = m_file_address; //第二个iovec指针指向mmap返回的文件指针，长度指向文件大小
@@ -787,21 +1118,110 @@ bool http_conn::process_write(HTTP_CODE ret)
 }
 void http_conn::process()
 {
-    //报文解析
-    HTTP_CODE read_ret = process_read();
+    long long start = m_request_start ? access_log::now_us() : 0;
+    if (m_queued_at && start)
+        m_queue_us = start - m_queued_at;
+
+    //报文解析，已在主线程解析完毕的请求直接生成响应
+    HTTP_CODE read_ret;
+    if (m_request_ready)
+    {
+        m_request_ready = false;
+        read_ret = do_request();
+    }
+    else
+    {
+        read_ret = process_read();
+    }
     if (read_ret == NO_REQUEST)
     {
         modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
         return;
     }
+    //请求的文件正由其他连接加载，或正在等待数据库，本连接已挂起，不注册任何事件
+    if (read_ret == FILE_PENDING || read_ret == DB_PENDING)
+        return;
 
     //报文响应(response)
     bool write_ret = process_write(read_ret);
     if (!write_ret)
     {
         close_conn();
+        return;
+    }
+    if (start)
+        m_process_us += access_log::now_us() - start;
+    //process_write完成响应报文后，直接在当前线程发送
+    send_response();
+}
+
+void http_conn::mark_queued()
+{
+    if (access_log::get_instance()->enabled())
+        m_queued_at = access_log::now_us();
+}
+
+//响应发送完毕(或发送失败)时记录一条访问日志
+void http_conn::log_access()
+{
+    if (!m_request_start || !access_log::get_instance()->sampled())
+        return;
+
+    static const char *methods[] = {"GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT", "PATH"};
+    access_record record;
+    record.address = &m_address;
+    record.method = methods[m_method];
+    record.path = m_target[0] ? m_target : NULL;
+    record.status = m_status;
+    record.bytes = bytes_have_send;
+    record.keep_alive = m_linger;
+    record.queue_us = m_queue_us;
+    record.process_us = m_process_us;
+    record.total_us = access_log::now_us() - m_request_start;
+    access_log::get_instance()->write(record);
+}
+
+//主线程快速路径(proactor)：在事件循环中直接解析请求，缓存命中的静态资源当场响应，省去进出线程池的开销
+//需要访问数据库或加载冷文件的请求返回false，由调用者交给线程池，工作线程从do_request继续
+bool http_conn::process_fast()
+{
+    long long start = m_request_start ? access_log::now_us() : 0;
+    m_fast = true;
+    HTTP_CODE read_ret = process_read();
+    m_fast = false;
+    if (start)
+        m_process_us += access_log::now_us() - start;
+
+    if (read_ret == DEFERRED_REQUEST)
+    {
+        m_request_ready = true;
+        return false;
+    }
+    if (read_ret == NO_REQUEST)
+    {
+        modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
+        return true;
+    }
+    if (read_ret == DB_PENDING)
+        return true;
+    if (!process_write(read_ret))
+    {
+        close_conn();
+        return true;
+    }
+    send_response();
+    return true;
+}
+
+//大多数响应能一次写入socket发送缓冲区，直接writev可以省去注册epollout、主线程被唤醒再调用write的一轮事件循环
+//只有写缓冲区满(EAGAIN)时write内部才注册epollout事件，由主线程WebServer::eventLoop继续发送
+void http_conn::send_response()
+{
+    if (!write())
+    {
+        //短连接已发送完或发送出错，连接的关闭和定时器的删除只能在主线程中进行
+        //这里只shutdown并重新注册事件，主线程收到EPOLLRDHUP/EPOLLHUP后通过deal_timer关闭连接
+        shutdown(m_sockfd, SHUT_RDWR);
+        modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
     }
-    //process_write完成响应报文，随后注册epollout事件
-    //服务器主线程WebServer::eventLoop检测到写事件，调用http_conn::write函数将响应报文发送给浏览器端，完成整个流程
-    modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
 }
@@ -20,11 +20,25 @@
 #include <sys/wait.h>
 #include <sys/uio.h>
 #include <map>
+#include <atomic>
 
 #include "../lock/locker.h"
 #include "../CGImysql/sql_connection_pool.h"
+#include "../CGImysql/user_store.h"
+#include "../CGImysql/user_filter.h"
+#include "../CGImysql/user_backend.h"
+#include "../CGImysql/user_snapshot.h"
+#include "../CGImysql/async_db.h"
+#include "../CGImysql/reg_writer.h"
 #include "../timer/lst_timer.h"
 #include "../log/log.h"
+#include "../log/access_log.h"
+#include "file_cache.h"
+#include "session.h"
+#include "../bundle/site_bundle.h"
+
+template <typename T>
+class threadpool;
 
 class http_conn
 {
@@ -32,6 +46,7 @@ public:
     static const int FILENAME_LEN = 200;
     static const int READ_BUFFER_SIZE = 2048;
     static const int WRITE_BUFFER_SIZE = 1024;
+    static const long PREFETCH_WINDOW = 4 * 1024 * 1024; //每次writev前探测页缓存驻留的文件区间，不小于socket发送缓冲区
     enum METHOD
     {
         GET = 0,
@@ -59,7 +74,11 @@ public:
         FORBIDDEN_REQUEST,
         FILE_REQUEST,
         INTERNAL_ERROR,
-        CLOSED_CONNECTION
+        CLOSED_CONNECTION,
+        FILE_PENDING,
+        DEFERRED_REQUEST,
+        DB_PENDING,
+        SERVICE_UNAVAILABLE
     };
     enum LINE_STATUS
     {
@@ -69,20 +88,29 @@ public:
     };
 
 public:
-    http_conn() {}
+    http_conn() : m_file_address(NULL), m_file_entry(NULL), m_bundle(NULL), m_generation(0) {}
     ~http_conn() {}
 
 public:
     void init(int sockfd, const sockaddr_in &addr, char *, int, int, string user, string passwd, string sqlname);
     void close_conn(bool real_close = true);
     void process();
+    bool process_fast();
+    //放入请求队列时调用，记录排队的起点
+    void mark_queued();
+    void send_response();
     bool read_once();
     bool write();
     sockaddr_in *get_address()
     {
         return &m_address;
     }
-    void initmysql_result(connection_pool *connPool);
+    void file_loaded(file_entry *entry);
+    void file_prefetched();
+    //连接被关闭时调用，撤销挂起的文件加载和预读
+    void cancel_pending();
+    unsigned int generation() const { return m_generation; }
+    static void db_finished(db_request *req);
     int timer_flag;
     int improv;
 
@@ -95,23 +123,34 @@ private:
     HTTP_CODE parse_headers(char *text);
     HTTP_CODE parse_content(char *text);
     HTTP_CODE do_request();
+    HTTP_CODE bundle_request(const char *path);
+    static bool protected_page(const char *path);
+    static bool accepts_gzip(const char *value);
+    bool signed_in();
+    HTTP_CODE submit_db(DB_OP op, const char *name, const char *password);
+    void resume_failed();
     char *get_line() { return m_read_buf + m_start_line; };
     LINE_STATUS parse_line();
     void unmap();
+    void log_access();
     bool add_response(const char *format, ...);
     bool add_content(const char *content);
     bool add_status_line(int status, const char *title);
     bool add_headers(int content_length);
+    bool add_bundle_headers();
     bool add_content_type();
     bool add_content_length(int content_length);
+    bool add_date();
     bool add_linger();
+    bool add_session_cookie();
     bool add_blank_line();
 
 public:
     static int m_epollfd;
     static int m_user_count;
-    MYSQL *mysql;
-    int m_state;  //读为0, 写为1
+    static threadpool<http_conn> *m_threadpool; //数据库请求完成后把连接放回线程池继续处理
+    int m_state;  //读为0, 写为1, 数据库请求完成后恢复处理为2
+    long long m_queued_at; //放入请求队列的时间，微秒，未经线程池为0
 
 private:
     int m_sockfd;
@@ -126,11 +165,33 @@ private:
     METHOD m_method;
     char m_real_file[FILENAME_LEN];
     char *m_url;
+    char m_target[FILENAME_LEN]; //请求行中的原始路径，do_request改写m_url后访问日志仍记录它
     char *m_version;
     char *m_host;
+    char *m_session;          //请求Cookie中的会话令牌，没有时为0
     int m_content_length;
     bool m_linger;
     char *m_file_address;
+    file_entry *m_file_entry; //文件缓存项，持有一次引用
+    char *m_probed_end;       //已确认在页缓存中的文件数据的末尾，发送到这里之前不再探测
+    site_bundle *m_bundle;    //站点包模式下正在发送的包，持有一次引用
+    const char *m_bundle_header; //包内预生成的响应头
+    int m_bundle_header_len;
+    bool m_bundle_vary;       //该项有gzip版本，响应需带Vary: Accept-Encoding
+    bool m_gzip;              //客户端接受gzip编码
+    bool m_fast;              //正在主线程快速路径中处理，不允许阻塞操作
+    bool m_request_ready;     //请求已在主线程解析完毕，工作线程直接从do_request继续
+    std::atomic<unsigned int> m_generation; //每个请求加一，丢弃上一个请求迟到的数据库、文件加载和预读回调
+    bool m_db_done;            //数据库请求已完成，结果在m_db_*中
+    DB_OP m_db_op;             //已提交的数据库请求
+    unsigned int m_db_err;
+    bool m_db_found;
+    char m_db_password[100];
+    char m_new_session[SESSION_TOKEN_LEN + 1]; //登录成功后签发的令牌，随响应下发，为空时不下发
+    long long m_request_start; //读到请求第一个字节的时间，微秒，访问日志关闭时为0
+    long long m_queue_us;      //排队耗时
+    long long m_process_us;    //解析请求和生成响应的耗时
+    int m_status;              //响应状态码
     struct stat m_file_stat;
     struct iovec m_iv[2];
     int m_iv_count;
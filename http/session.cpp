@@ -0,0 +1,147 @@
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "session.h"
+#include "../timer/coarse_clock.h"
+
+#define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+#define SIPROUND                                                   \
+    do                                                             \
+    {                                                              \
+        v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32);  \
+        v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2;                     \
+        v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0;                     \
+        v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32);  \
+    } while (0)
+
+session_store::session_store()
+{
+    //读不到随机数时退化为时间和进程号，令牌仍可用，只是更容易被猜测
+    uint64_t keys[4] = {(uint64_t)time(NULL), (uint64_t)getpid(), (uint64_t)(uintptr_t)this, 0};
+    int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd >= 0)
+    {
+        if (read(fd, keys, sizeof(keys)) != (ssize_t)sizeof(keys))
+            keys[3] ^= (uint64_t)clock();
+        close(fd);
+    }
+    m_sign_key[0] = keys[0];
+    m_sign_key[1] = keys[1];
+    m_id_key[0] = keys[2];
+    m_id_key[1] = keys[3];
+    m_counter.store(0);
+}
+
+//SipHash-2-4，消息固定为一个64位字
+uint64_t session_store::siphash(const uint64_t key[2], uint64_t message)
+{
+    uint64_t v0 = key[0] ^ 0x736f6d6570736575ULL;
+    uint64_t v1 = key[1] ^ 0x646f72616e646f6dULL;
+    uint64_t v2 = key[0] ^ 0x6c7967656e657261ULL;
+    uint64_t v3 = key[1] ^ 0x7465646279746573ULL;
+
+    v3 ^= message;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= message;
+
+    //最后一块只有长度字节
+    uint64_t last = (uint64_t)8 << 56;
+    v3 ^= last;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= last;
+
+    v2 ^= 0xff;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+//16个十六进制字符转64位整数
+static bool parse_hex(const char *text, uint64_t *value)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < 16; ++i)
+    {
+        char c = text[i];
+        int digit;
+        if (c >= '0' && c <= '9')
+            digit = c - '0';
+        else if (c >= 'a' && c <= 'f')
+            digit = c - 'a' + 10;
+        else
+            return false;
+        v = v << 4 | digit;
+    }
+    *value = v;
+    return true;
+}
+
+void session_store::create(const char *name, char *token)
+{
+    uint64_t id = siphash(m_id_key, m_counter.fetch_add(1, memory_order_relaxed));
+    time_t expires = coarse_clock::get_instance()->mono_sec() + SESSION_TTL;
+
+    session_shard &shard = shard_of(id);
+    shard.lock.lock();
+    session_entry &entry = shard.table[id];
+    snprintf(entry.name, sizeof(entry.name), "%s", name);
+    entry.expires = expires;
+    shard.expiry.push_back(make_pair(expires, id));
+    shard.lock.unlock();
+
+    snprintf(token, SESSION_TOKEN_LEN + 1, "%016llx%016llx", (unsigned long long)id, (unsigned long long)sign(id));
+}
+
+bool session_store::lookup(const char *token, char *name)
+{
+    uint64_t id, mac;
+    if (!parse_hex(token, &id) || !parse_hex(token + 16, &mac) || mac != sign(id))
+        return false;
+
+    bool found = false;
+    time_t now = coarse_clock::get_instance()->mono_sec();
+    session_shard &shard = shard_of(id);
+    shard.lock.lock();
+    unordered_map<uint64_t, session_entry>::iterator it = shard.table.find(id);
+    //两次清理之间已过期的会话同样无效
+    if (it != shard.table.end() && it->second.expires > now)
+    {
+        memcpy(name, it->second.name, SESSION_NAME_LEN);
+        found = true;
+    }
+    shard.lock.unlock();
+    return found;
+}
+
+void session_store::expire()
+{
+    time_t now = coarse_clock::get_instance()->mono_sec();
+    for (int i = 0; i < SESSION_SHARDS; ++i)
+    {
+        session_shard &shard = m_shards[i];
+        shard.lock.lock();
+        while (!shard.expiry.empty() && shard.expiry.front().first <= now)
+        {
+            shard.table.erase(shard.expiry.front().second);
+            shard.expiry.pop_front();
+        }
+        shard.lock.unlock();
+    }
+}
+
+size_t session_store::size()
+{
+    size_t total = 0;
+    for (int i = 0; i < SESSION_SHARDS; ++i)
+    {
+        m_shards[i].lock.lock();
+        total += m_shards[i].table.size();
+        m_shards[i].lock.unlock();
+    }
+    return total;
+}
@@ -0,0 +1,73 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <atomic>
+#include <deque>
+#include <unordered_map>
+#include "../lock/locker.h"
+
+using namespace std;
+
+/*
+* 登录会话
+* 登录成功后签发会话令牌，以Cookie(sid)下发；令牌为64位会话号加上以服务器密钥计算的SipHash-2-4签名，各16个十六进制字符
+* 访问登录后的页面时先校验令牌签名，伪造或篡改的令牌不查表直接丢弃，签名正确时按会话号查一次分片哈希表，不再比对密码
+* 登录请求本身总是校验密码，不因带着有效令牌而放行
+* 会话号由SipHash作用于递增计数器生成，不可预测也不会重复；密钥在启动时从/dev/urandom读取，重启后旧令牌全部失效
+* 会话有效期固定，每个分片的过期队列按创建顺序即过期顺序排列，由定时器周期性地从队首清理
+*/
+const int SESSION_SHARDS = 16;         //分片数，必须是2的幂
+const int SESSION_TTL = 1800;          //会话有效期，秒
+const int SESSION_TOKEN_LEN = 32;      //令牌长度，不含结尾的'\0'
+const int SESSION_NAME_LEN = 100;      //与登录表单中用户名的缓冲区一致
+
+struct session_entry
+{
+    char name[SESSION_NAME_LEN];
+    time_t expires; //单调时钟，秒
+};
+
+struct alignas(64) session_shard
+{
+    locker lock;
+    unordered_map<uint64_t, session_entry> table;
+    deque<pair<time_t, uint64_t> > expiry; //(过期时间, 会话号)，按过期时间递增
+};
+
+class session_store
+{
+public:
+    //C++11以后,使用局部变量懒汉不用加锁
+    static session_store *get_instance()
+    {
+        static session_store instance;
+        return &instance;
+    }
+
+    //为用户新建会话，令牌写入token，缓冲区至少SESSION_TOKEN_LEN + 1字节
+    void create(const char *name, char *token);
+    //令牌有效时把会话的用户名写入name，缓冲区至少SESSION_NAME_LEN字节
+    bool lookup(const char *token, char *name);
+    //定时器调用：清理过期的会话
+    void expire();
+    size_t size();
+
+private:
+    session_store();
+    ~session_store() {}
+
+    static uint64_t siphash(const uint64_t key[2], uint64_t message);
+    uint64_t sign(uint64_t id) { return siphash(m_sign_key, id); }
+    session_shard &shard_of(uint64_t id) { return m_shards[id & (SESSION_SHARDS - 1)]; }
+
+private:
+    uint64_t m_sign_key[2]; //令牌签名密钥
+    uint64_t m_id_key[2];   //生成会话号的密钥
+    atomic<uint64_t> m_counter;
+    session_shard m_shards[SESSION_SHARDS];
+};
+
+#endif
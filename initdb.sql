@@ -2,6 +2,7 @@ create database cppwebserver;
 
 USE cppwebserver;
 CREATE TABLE user(
+    id BIGINT UNSIGNED NOT NULL AUTO_INCREMENT PRIMARY KEY,
     username char(50) NULL,
     passwd char(50) NULL
 )ENGINE=InnoDB;
@@ -34,6 +34,11 @@ public:
     {
         return sem_post(&m_sem) == 0;
     }
+    //等待到绝对时间t(CLOCK_REALTIME)为止，超时返回false
+    bool timewait(struct timespec t)
+    {
+        return sem_timedwait(&m_sem, &t) == 0;
+    }
 
 private:
     sem_t m_sem;
@@ -0,0 +1,237 @@
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include "access_log.h"
+
+static const int ACCESS_RECORD_SIZE = 1024;       //单条记录的最大长度，超长的路径被截断
+static const size_t ACCESS_RING_SIZE = 256 * 1024; //每个线程环形缓冲区的字节数
+
+//每个线程私有的格式化缓冲区、环形缓冲区和采样计数
+struct access_buffer
+{
+    char buf[ACCESS_RECORD_SIZE];
+    log_ring *ring;
+    unsigned int count;
+};
+
+static __thread access_buffer *t_access_buffer = NULL;
+
+access_log::access_log()
+{
+    m_enabled = false;
+    m_sample = 1;
+    m_flush_interval = 1000;
+    m_fd = -1;
+    m_today = 0;
+    m_file_name[0] = '\0';
+    m_dropped.store(0);
+}
+
+access_log::~access_log()
+{
+    if (m_enabled)
+        drain();
+    if (m_fd >= 0)
+        close(m_fd);
+}
+
+long long access_log::now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+//文件名与运行日志一致，加日期前缀
+bool access_log::open_file(const struct tm &my_tm)
+{
+    char full_name[256] = {0};
+    const char *p = strrchr(m_file_name, '/');
+    if (p == NULL)
+        snprintf(full_name, 255, "%d_%02d_%02d_%s", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, m_file_name);
+    else
+        snprintf(full_name, 255, "%.*s%d_%02d_%02d_%s", (int)(p - m_file_name + 1), m_file_name,
+                 my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, p + 1);
+
+    int fd = open(full_name, O_WRONLY | O_CREAT | O_APPEND, 0666);
+    if (fd < 0)
+        return false;
+    if (m_fd >= 0)
+        close(m_fd);
+    m_fd = fd;
+    m_today = my_tm.tm_mday;
+
+    //新文件写入字段说明
+    if (0 == lseek(m_fd, 0, SEEK_END))
+    {
+        const char *fields = "#fields: time\tclient\tmethod\tpath\tstatus\tbytes\tkeep_alive\tqueue_us\tprocess_us\ttotal_us\n";
+        ::write(m_fd, fields, strlen(fields));
+    }
+    return true;
+}
+
+bool access_log::init(const char *file_name, int sample, int flush_interval)
+{
+    if (sample <= 0)
+        return true;
+
+    m_sample = sample;
+    m_flush_interval = flush_interval > 0 ? flush_interval : 1;
+    snprintf(m_file_name, sizeof(m_file_name), "%s", file_name);
+
+    time_t t = time(NULL);
+    struct tm my_tm;
+    localtime_r(&t, &my_tm);
+    if (!open_file(my_tm))
+        return false;
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, flush_thread, NULL) != 0)
+        return false;
+    pthread_detach(tid);
+    m_enabled = true;
+    return true;
+}
+
+access_buffer *access_log::thread_buffer()
+{
+    if (t_access_buffer)
+        return t_access_buffer;
+
+    access_buffer *ab = new access_buffer;
+    ab->ring = new log_ring(ACCESS_RING_SIZE);
+    ab->count = 0;
+    m_mutex.lock();
+    m_rings.push_back(ab->ring);
+    m_mutex.unlock();
+    t_access_buffer = ab;
+    return ab;
+}
+
+//每个线程独立计数，不共享计数器
+bool access_log::sampled()
+{
+    if (!m_enabled)
+        return false;
+    if (1 == m_sample)
+        return true;
+    return 0 == thread_buffer()->count++ % m_sample;
+}
+
+void access_log::write(const access_record &record)
+{
+    access_buffer *ab = thread_buffer();
+    clock_slot now;
+    coarse_clock::get_instance()->now(now);
+
+    char ip[INET_ADDRSTRLEN] = "-";
+    int port = 0;
+    if (record.address)
+    {
+        inet_ntop(AF_INET, &record.address->sin_addr, ip, sizeof(ip));
+        port = ntohs(record.address->sin_port);
+    }
+
+    //时间前缀已带小数点
+    int n = snprintf(ab->buf, ACCESS_RECORD_SIZE, "%.*s%06ld\t%s:%d\t%s\t%s\t%d\t%ld\t%d\t%lld\t%lld\t%lld",
+                     now.log_prefix_len, now.log_prefix, now.real_usec, ip, port,
+                     record.method ? record.method : "-", record.path ? record.path : "-",
+                     record.status, record.bytes, record.keep_alive ? 1 : 0,
+                     record.queue_us, record.process_us, record.total_us);
+    if (n < 0)
+        return;
+    if (n > ACCESS_RECORD_SIZE - 2)
+        n = ACCESS_RECORD_SIZE - 2;
+    ab->buf[n++] = '\n';
+
+    //访问日志不值得阻塞请求线程，缓冲区满时丢弃
+    if (!ab->ring->push(ab->buf, n))
+        m_dropped++;
+}
+
+void *access_log::flush_thread(void *args)
+{
+    access_log::get_instance()->run();
+    return NULL;
+}
+
+void access_log::run()
+{
+    while (true)
+    {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        long long deadline = (long long)now.tv_sec * 1000 + now.tv_usec / 1000 + m_flush_interval;
+        struct timespec ts;
+        ts.tv_sec = deadline / 1000;
+        ts.tv_nsec = (deadline % 1000) * 1000000;
+        m_wake.timewait(ts);
+        drain();
+    }
+}
+
+//取出所有线程的记录，一次writev写入文件
+void access_log::drain()
+{
+    m_mutex.lock();
+
+    clock_slot now;
+    coarse_clock::get_instance()->now(now);
+    struct tm my_tm = now.local;
+    if (my_tm.tm_mday != m_today)
+        open_file(my_tm);
+
+    m_iov.resize(m_rings.size() * 2 + 1);
+    m_drained.resize(m_rings.size());
+    int cnt = 0;
+    for (size_t i = 0; i < m_rings.size(); ++i)
+    {
+        cnt += m_rings[i]->peek(&m_iov[cnt], m_drained[i]);
+    }
+
+    char dropped[64];
+    long lost = m_dropped.exchange(0);
+    if (lost > 0)
+    {
+        m_iov[cnt].iov_base = dropped;
+        m_iov[cnt].iov_len = snprintf(dropped, sizeof(dropped), "#dropped: %ld\n", lost);
+        ++cnt;
+    }
+
+    struct iovec *iov = cnt > 0 ? &m_iov[0] : NULL;
+    while (cnt > 0)
+    {
+        ssize_t n = writev(m_fd, iov, cnt < IOV_MAX ? cnt : IOV_MAX);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        while (cnt > 0 && (size_t)n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            ++iov;
+            --cnt;
+        }
+        if (cnt > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    for (size_t i = 0; i < m_rings.size(); ++i)
+    {
+        m_rings[i]->consume(m_drained[i]);
+    }
+    m_mutex.unlock();
+}
@@ -0,0 +1,86 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <netinet/in.h>
+#include <atomic>
+#include <vector>
+#include "../lock/locker.h"
+#include "log_ring.h"
+#include "../timer/coarse_clock.h"
+
+using namespace std;
+
+/*
+* 访问日志
+* 每个响应发送完毕后写一条记录，字段以制表符分隔，便于批量导入分析：
+* 时间 客户端地址 方法 路径 状态码 发送字节数 是否长连接 排队耗时 处理耗时 总耗时(单位微秒)
+* 与运行日志一样，记录先写入线程私有的无锁环形缓冲区，由写线程定期成批writev到文件，按天切分
+* 负载高时可以只记录每N个响应中的一个，环形缓冲区满时丢弃记录并计数
+*/
+struct access_record
+{
+    const sockaddr_in *address;
+    const char *method;
+    const char *path;
+    int status;
+    long bytes;
+    bool keep_alive;
+    long long queue_us;   //从放入请求队列到工作线程开始处理
+    long long process_us; //解析请求和生成响应
+    long long total_us;   //从读到请求的第一个字节到响应发送完毕
+};
+
+struct access_buffer;
+
+class access_log
+{
+public:
+    //C++11以后,使用局部变量懒汉不用加锁
+    static access_log *get_instance()
+    {
+        static access_log instance;
+        return &instance;
+    }
+
+    //sample为采样间隔，每sample个响应记录一个，flush_interval为刷盘间隔(毫秒)
+    bool init(const char *file_name, int sample, int flush_interval = 1000);
+
+    bool enabled()
+    {
+        return m_enabled;
+    }
+
+    //本线程是否应记录当前响应
+    bool sampled();
+
+    void write(const access_record &record);
+
+    //单调时钟，微秒
+    static long long now_us();
+
+private:
+    access_log();
+    ~access_log();
+
+    static void *flush_thread(void *args);
+    void run();
+    void drain();
+    access_buffer *thread_buffer();
+    bool open_file(const struct tm &my_tm);
+
+private:
+    bool m_enabled;
+    int m_sample;
+    int m_flush_interval;
+    int m_fd;
+    int m_today;
+    char m_file_name[128];
+    vector<log_ring *> m_rings;  //各线程的环形缓冲区，由m_mutex保护
+    vector<struct iovec> m_iov;
+    vector<size_t> m_drained;
+    atomic<long> m_dropped;      //环形缓冲区满丢弃的记录数
+    locker m_mutex;
+    sem m_wake;
+};
+
+#endif
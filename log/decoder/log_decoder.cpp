@@ -0,0 +1,298 @@
+/*
+* 二进制日志解码工具
+* 用法：./log_decoder <日志文件>...
+* 把-B 1生成的二进制日志渲染成与文本日志相同的"YYYY-MM-DD hh:mm:ss.usec [info]: "格式输出到标准输出
+* 异步模式下各线程的日志成批写入，文件内记录不严格按时间排列，解码时每段内按时间戳稳定排序
+* 文件末尾因崩溃等原因不完整的记录被忽略
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include "../log_format.h"
+
+using namespace std;
+
+struct format_def
+{
+    int level;
+    string format;
+    vector<log_arg_spec> specs;
+};
+
+struct record_ref
+{
+    int64_t timestamp;
+    size_t offset;
+};
+
+static bool by_time(const record_ref &a, const record_ref &b)
+{
+    return a.timestamp < b.timestamp;
+}
+
+static bool read_file(const char *name, string &out)
+{
+    FILE *fp = fopen(name, "rb");
+    if (!fp)
+        return false;
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        out.append(buf, n);
+    fclose(fp);
+    return true;
+}
+
+//按单个转换说明渲染一个参数，stars为'*'对应的宽度、精度
+template <class T>
+static void render(string &out, const string &spec, int stars, const int *star_args, T value)
+{
+    char buf[4096];
+    int n;
+    if (0 == stars)
+        n = snprintf(buf, sizeof(buf), spec.c_str(), value);
+    else if (1 == stars)
+        n = snprintf(buf, sizeof(buf), spec.c_str(), star_args[0], value);
+    else
+        n = snprintf(buf, sizeof(buf), spec.c_str(), star_args[0], star_args[1], value);
+    if (n > 0)
+        out.append(buf, n < (int)sizeof(buf) ? n : sizeof(buf) - 1);
+}
+
+//格式串中两个转换说明之间的文字，"%%"还原为'%'
+static void append_literal(string &out, const string &format, int begin, int end)
+{
+    for (int i = begin; i < end; ++i)
+    {
+        out += format[i];
+        if ('%' == format[i] && i + 1 < end && '%' == format[i + 1])
+            ++i;
+    }
+}
+
+//按格式串定义解出参数并渲染，数据不足返回false
+static bool render_record(const format_def &def, const char *p, const char *end, string &out)
+{
+    int last = 0;
+    for (size_t i = 0; i < def.specs.size(); ++i)
+    {
+        const log_arg_spec &spec = def.specs[i];
+        append_literal(out, def.format, last, spec.begin);
+        last = spec.end;
+
+        int star_args[2] = {0, 0};
+        for (int k = 0; k < spec.stars; ++k)
+        {
+            if (end - p < 4)
+                return false;
+            if (k < 2)
+                memcpy(&star_args[k], p, 4);
+            p += 4;
+        }
+
+        string text = def.format.substr(spec.begin, spec.end - spec.begin);
+        int size = log_arg_size(spec.type);
+        if (end - p < size)
+            return false;
+        switch (spec.type)
+        {
+        case LOG_ARG_INT:
+        {
+            int v;
+            memcpy(&v, p, 4);
+            render(out, text, spec.stars, star_args, v);
+            break;
+        }
+        case LOG_ARG_LONG:
+        {
+            long v;
+            memcpy(&v, p, 8);
+            render(out, text, spec.stars, star_args, v);
+            break;
+        }
+        case LOG_ARG_LLONG:
+        case LOG_ARG_INTMAX:
+        {
+            long long v;
+            memcpy(&v, p, 8);
+            render(out, text, spec.stars, star_args, v);
+            break;
+        }
+        case LOG_ARG_SIZE:
+        {
+            size_t v;
+            memcpy(&v, p, 8);
+            render(out, text, spec.stars, star_args, v);
+            break;
+        }
+        case LOG_ARG_PTRDIFF:
+        {
+            ptrdiff_t v;
+            memcpy(&v, p, 8);
+            render(out, text, spec.stars, star_args, v);
+            break;
+        }
+        case LOG_ARG_DOUBLE:
+        {
+            double v;
+            memcpy(&v, p, 8);
+            render(out, text, spec.stars, star_args, v);
+            break;
+        }
+        case LOG_ARG_LDOUBLE:
+        {
+            long double v = 0;
+            memcpy(&v, p, sizeof(v) < 16 ? sizeof(v) : 16);
+            render(out, text, spec.stars, star_args, v);
+            break;
+        }
+        case LOG_ARG_STR:
+        {
+            uint16_t len;
+            memcpy(&len, p, 2);
+            if (end - p - 2 < len)
+                return false;
+            string s(p + 2, len);
+            render(out, text, spec.stars, star_args, s.c_str());
+            p += len;
+            break;
+        }
+        default:
+        {
+            void *v;
+            memcpy(&v, p, sizeof(v));
+            //%n不能交给snprintf执行，原样忽略
+            if ('n' != text[text.size() - 1])
+                render(out, text, spec.stars, star_args, v);
+            break;
+        }
+        }
+        p += size;
+    }
+    append_literal(out, def.format, last, def.format.size());
+    return true;
+}
+
+static const char *level_tag(int level)
+{
+    static const char *tags[] = {"[debug]:", "[info]:", "[warn]:", "[erro]:"};
+    return (level >= 0 && level <= 3) ? tags[level] : tags[1];
+}
+
+//解码一段：文件头之后到下一个文件头或文件末尾，返回段结束的位置
+static size_t decode_segment(const string &data, size_t pos)
+{
+    log_file_header fh;
+    memcpy(&fh, data.data() + pos, sizeof(fh));
+    pos += sizeof(fh);
+
+    //先收集定义和记录位置，定义可能晚于引用它的其他线程的记录
+    map<uint32_t, format_def> defs;
+    vector<record_ref> records;
+    while (pos + sizeof(log_record_header) <= data.size())
+    {
+        if (0 == memcmp(data.data() + pos, LOG_BINARY_MAGIC, 8))
+            break;
+        log_record_header header;
+        memcpy(&header, data.data() + pos, sizeof(header));
+        if (header.len < sizeof(header) || pos + header.len > data.size())
+        {
+            pos = data.size();
+            break;
+        }
+
+        const char *body = data.data() + pos + sizeof(header);
+        if (0 == header.id)
+        {
+            log_format_def def;
+            if (header.len >= sizeof(header) + sizeof(def))
+            {
+                memcpy(&def, body, sizeof(def));
+                format_def &fd = defs[def.format_id];
+                fd.level = def.level;
+                fd.format.assign(body + sizeof(def), header.len - sizeof(header) - sizeof(def));
+                parse_log_format(fd.format.c_str(), fd.specs);
+            }
+        }
+        else if (header.len >= sizeof(header) + sizeof(log_record_body))
+        {
+            log_record_body rb;
+            memcpy(&rb, body, sizeof(rb));
+            record_ref ref = {rb.timestamp, pos};
+            records.push_back(ref);
+        }
+        pos += header.len;
+    }
+
+    stable_sort(records.begin(), records.end(), by_time);
+
+    string line;
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        log_record_header header;
+        memcpy(&header, data.data() + records[i].offset, sizeof(header));
+        map<uint32_t, format_def>::iterator it = defs.find(header.id);
+        if (it == defs.end())
+            continue;
+
+        //单调时钟换算为墙上时间
+        int64_t real = fh.anchor_real + (records[i].timestamp - fh.anchor_mono);
+        time_t sec = real / 1000000000;
+        long usec = (real % 1000000000) / 1000;
+        struct tm my_tm;
+        localtime_r(&sec, &my_tm);
+
+        char prefix[64];
+        snprintf(prefix, sizeof(prefix), "%d-%02d-%02d %02d:%02d:%02d.%06ld %s ",
+                 my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
+                 my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, usec, level_tag(it->second.level));
+        line = prefix;
+
+        const char *p = data.data() + records[i].offset + sizeof(header) + sizeof(log_record_body);
+        const char *end = data.data() + records[i].offset + header.len;
+        if (!render_record(it->second, p, end, line))
+            line += "<truncated>";
+        line += '\n';
+        fwrite(line.data(), 1, line.size(), stdout);
+    }
+    return pos;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <binary_log>...\n", argv[0]);
+        return 1;
+    }
+
+    for (int i = 1; i < argc; ++i)
+    {
+        string data;
+        if (!read_file(argv[i], data))
+        {
+            fprintf(stderr, "open %s failed\n", argv[i]);
+            return 1;
+        }
+
+        //同一天重启后追加写入，文件中可能有多段
+        size_t pos = 0;
+        while (pos + sizeof(log_file_header) <= data.size())
+        {
+            if (0 != memcmp(data.data() + pos, LOG_BINARY_MAGIC, 8))
+            {
+                fprintf(stderr, "%s: bad header at offset %zu\n", argv[i], pos);
+                return 1;
+            }
+            pos = decode_segment(data, pos);
+        }
+    }
+    return 0;
+}
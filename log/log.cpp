@@ -2,163 +2,825 @@
 #include <time.h>
 #include <sys/time.h>
 #include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <signal.h>
 #include "log.h"
 #include <pthread.h>
 using namespace std;
 
+//每个写日志线程私有的格式化缓冲区和环形缓冲区，格式化过程不需要加锁
+struct log_buffer
+{
+    char *buf;
+    log_ring *ring;   //异步模式下由写线程取走，同步模式为NULL
+};
+
+//二进制模式登记的调用点
+struct log_site
+{
+    int level;
+    const char *format;
+    vector<log_arg_spec> specs;
+    int fixed_bytes; //记录中除字符串内容外的字节数
+};
+
+static __thread log_buffer *t_log_buffer = NULL;
+
+static const char *level_tag[] = {"[debug]:", "[info]:", "[warn]:", "[erro]:"};
+
+static int64_t clock_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static long long now_ms(const struct timeval &tv)
+{
+    return (long long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+//时间前缀和切分日期取自粗粒度时钟，写日志时不再调用gettimeofday和localtime
+static coarse_clock *log_clock()
+{
+    return coarse_clock::get_instance();
+}
+
+//写满全部数据，普通文件上writev一般一次写完
+static void writev_all(int fd, struct iovec *iov, int cnt)
+{
+    while (cnt > 0)
+    {
+        ssize_t n = writev(fd, iov, cnt < IOV_MAX ? cnt : IOV_MAX);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        while (cnt > 0 && (size_t)n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            ++iov;
+            --cnt;
+        }
+        if (cnt > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
 Log::Log()
 {
     m_count = 0;
     m_is_async = false;
+    m_fd = -1;
+    m_ring_size = 0;
+    m_pending = NULL;
+    m_pending_len = 0;
+    m_pending_cap = 0;
+    m_binary = false;
+    m_use_mmap = false;
+    m_next_index = 0;
+    m_format_count = 0;
+    m_flush_interval = 1000;
+    m_flush_size = 65536;
+    m_last_flush = 0;
+    m_poked.store(false);
+    m_level.store(LOG_MIN_LEVEL);
 }
 
 Log::~Log()
 {
-    if (m_fp != NULL)
+    if (m_use_mmap)
     {
-        fclose(m_fp);
+        m_mutex.lock();
+        m_writer.close();
+        m_mutex.unlock();
+        return;
+    }
+    drain();
+    if (m_fd >= 0)
+    {
+        close(m_fd);
     }
 }
 //异步需要设置阻塞队列的长度，同步不需要设置
-bool Log::init(const char *file_name, int close_log, int log_buf_size, int split_lines, int max_queue_size)
+bool Log::init(const char *file_name, int close_log, int log_buf_size, int split_lines, int max_queue_size,
+               int flush_interval, int flush_size, bool binary, bool use_mmap)
 {
-    //如果设置了max_queue_size,则设置为异步
-    if (max_queue_size >= 1)
+    m_close_log = close_log;
+    m_log_buf_size = log_buf_size;
+    m_split_lines = split_lines;
+    m_flush_interval = flush_interval > 0 ? flush_interval : 1;
+    m_flush_size = flush_size > 0 ? flush_size : 1;
+    //积压区能放下刷盘阈值加一条最长的日志
+    m_pending_cap = m_flush_size + m_log_buf_size;
+    m_pending = new char[m_pending_cap];
+
+    //二进制模式预先登记各级别的"%s"，未登记的调用点格式化后以它保存，编号为级别加一
+    m_binary = binary;
+    if (m_binary)
+    {
+        for (int level = 0; level <= 3; ++level)
+            add_site(level, "%s");
+    }
+
+    //如果设置了max_queue_size,则设置为异步，mmap模式不需要环形缓冲区
+    m_use_mmap = use_mmap;
+    if (max_queue_size >= 1 && !m_use_mmap)
     {
         m_is_async = true;
-        m_log_queue = new block_queue<string>(max_queue_size);
+        m_ring_size = (size_t)max_queue_size * 256;
+        if (m_ring_size < (size_t)m_flush_size * 2)
+            m_ring_size = (size_t)m_flush_size * 2;
         pthread_t tid;
         //flush_log_thread为回调函数,这里表示创建线程异步写日志
         pthread_create(&tid, NULL, flush_log_thread, NULL);
     }
-    
-    m_close_log = close_log;
-    m_log_buf_size = log_buf_size;
-    m_buf = new char[m_log_buf_size];
-    memset(m_buf, '\0', m_log_buf_size);
-    m_split_lines = split_lines;
 
     time_t t = time(NULL);
     struct tm *sys_tm = localtime(&t);
     struct tm my_tm = *sys_tm;
 
- 
+
     const char *p = strrchr(file_name, '/');
-    char log_full_name[256] = {0};
+    char log_full_name[LOG_PATH_LEN] = {0};
 
     if (p == NULL)
     {
+        dir_name[0] = '\0';
+        strcpy(log_name, file_name);
         snprintf(log_full_name, 255, "%d_%02d_%02d_%s", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, file_name);
     }
     else
     {
         strcpy(log_name, p + 1);
         strncpy(dir_name, file_name, p - file_name + 1);
+        dir_name[p - file_name + 1] = '\0';
         snprintf(log_full_name, 255, "%s%d_%02d_%02d_%s", dir_name, my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, log_name);
     }
 
     m_today = my_tm.tm_mday;
-    
-    m_fp = fopen(log_full_name, "a");
-    if (m_fp == NULL)
+
+    //mmap模式接着当天最后一个文件写，同时准备好下一段，之后由后台线程维护
+    if (m_use_mmap)
+    {
+        m_writer.init(&m_wake, LOG_SEGMENT_SIZE, m_split_lines);
+        int index = last_segment(my_tm);
+        segment_path(log_full_name, my_tm, index);
+        if (!m_writer.install(log_full_name, file_header()))
+        {
+            return false;
+        }
+        m_next_index = index + 1;
+        segment_path(log_full_name, my_tm, m_next_index++);
+        m_writer.prepare(log_full_name, file_header());
+
+        pthread_t tid;
+        pthread_create(&tid, NULL, flush_log_thread, NULL);
+        return true;
+    }
+
+    m_fd = open(log_full_name, O_WRONLY | O_CREAT | O_APPEND, 0666);
+    if (m_fd < 0)
     {
         return false;
     }
+    write_header();
 
     return true;
 }
 
-void Log::write_log(int level, const char *format, ...)
+//登记调用点，调用者持有m_mutex，登记表满或记录放不下时返回0
+int Log::add_site(int level, const char *format)
 {
-    struct timeval now = {0, 0};
-    gettimeofday(&now, NULL);
-    time_t t = now.tv_sec;
-    struct tm *sys_tm = localtime(&t);
-    struct tm my_tm = *sys_tm;
-    char s[16] = {0};
-    switch (level)
-    {
-    case 0:
-        strcpy(s, "[debug]:");
-        break;
-    case 1:
-        strcpy(s, "[info]:");
-        break;
-    case 2:
-        strcpy(s, "[warn]:");
-        break;
-    case 3:
-        strcpy(s, "[erro]:");
-        break;
-    default:
-        strcpy(s, "[info]:");
-        break;
-    }
-    //写入一个log，对m_count++, m_split_lines最大行数
+    log_site *site = new log_site;
+    site->level = level;
+    site->format = format;
+    parse_log_format(format, site->specs);
+    site->fixed_bytes = sizeof(log_record_header) + sizeof(log_record_body);
+    for (size_t i = 0; i < site->specs.size(); ++i)
+    {
+        site->fixed_bytes += site->specs[i].stars * log_arg_size(LOG_ARG_INT) + log_arg_size(site->specs[i].type);
+    }
+
+    if (m_format_count >= MAX_LOG_FORMATS || site->fixed_bytes > m_log_buf_size)
+    {
+        delete site;
+        return 0;
+    }
+    m_formats[m_format_count] = site;
+    return ++m_format_count;
+}
+
+int Log::register_format(int level, const char *format)
+{
+    if (!m_binary)
+        return 0;
+
     m_mutex.lock();
-    m_count++;
-
-    if (m_today != my_tm.tm_mday || m_count % m_split_lines == 0) //everyday log
-    {
-        
-        char new_log[256] = {0};
-        fflush(m_fp);
-        fclose(m_fp);
-        char tail[16] = {0};
-       
-        snprintf(tail, 16, "%d_%02d_%02d_", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday);
-       
-        if (m_today != my_tm.tm_mday)
+    int id = add_site(level, format);
+    if (id > 0)
+    {
+        //定义先于引用它的记录进入积压区，积压区总在环形缓冲区之前写出
+        string def(sizeof(log_record_header) + sizeof(log_format_def) + strlen(format), '\0');
+        append_def(&def[0], id);
+        if (m_use_mmap)
         {
-            snprintf(new_log, 255, "%s%s%s", dir_name, tail, log_name);
-            m_today = my_tm.tm_mday;
-            m_count = 0;
+            //已准备好的下一段在定义登记前生成了文件头，也要补上
+            m_writer.append_next(def.data(), def.size());
+            m_writer.append(def.data(), def.size(), false);
         }
         else
         {
-            snprintf(new_log, 255, "%s%s%s.%lld", dir_name, tail, log_name, m_count / m_split_lines);
+            append_pending(def.data(), def.size());
         }
-        m_fp = fopen(new_log, "a");
     }
- 
     m_mutex.unlock();
+    return id;
+}
+
+//在buf中生成编号为id的格式串定义，buf需能容纳定义的全部字节
+void Log::append_def(char *buf, int id)
+{
+    log_site *site = m_formats[id - 1];
+    int format_len = strlen(site->format);
+    log_record_header header;
+    header.len = sizeof(log_record_header) + sizeof(log_format_def) + format_len;
+    header.id = 0;
+    log_format_def def;
+    def.format_id = id;
+    def.level = site->level;
+    memcpy(buf, &header, sizeof(header));
+    memcpy(buf + sizeof(header), &def, sizeof(def));
+    memcpy(buf + sizeof(header) + sizeof(def), site->format, format_len);
+}
+
+//二进制模式下每个新文件以文件头和全部格式串定义开始，文本模式为空，调用者持有m_mutex
+string Log::file_header()
+{
+    if (!m_binary)
+        return string();
+
+    log_file_header fh;
+    memcpy(fh.magic, LOG_BINARY_MAGIC, sizeof(fh.magic));
+    fh.version = 1;
+    fh.reserved = 0;
+    fh.anchor_real = clock_ns(CLOCK_REALTIME);
+    fh.anchor_mono = clock_ns(CLOCK_MONOTONIC);
+
+    string out((const char *)&fh, sizeof(fh));
+    for (int id = 1; id <= m_format_count; ++id)
+    {
+        string def(sizeof(log_record_header) + sizeof(log_format_def) + strlen(m_formats[id - 1]->format), '\0');
+        append_def(&def[0], id);
+        out += def;
+    }
+    return out;
+}
+
+void Log::write_header()
+{
+    if (!m_binary)
+        return;
+
+    string out = file_header();
+    struct iovec iov;
+    iov.iov_base = &out[0];
+    iov.iov_len = out.size();
+    writev_all(m_fd, &iov, 1);
+}
+
+//二进制记录：头部、单调时钟时间戳，然后依次是各参数的原始字节
+int Log::pack_record(char *buf, int level, int format_id, const char *format, va_list valst)
+{
+    int pos = sizeof(log_record_header) + sizeof(log_record_body);
+    log_site *site = format_id > 0 ? m_formats[format_id - 1] : NULL;
+
+    if (!site)
+    {
+        //未登记的格式串在本线程格式化，作为预登记的"%s"的参数保存
+        int room = m_log_buf_size - pos - 2;
+        int m = vsnprintf(buf + pos + 2, room, format, valst);
+        if (m < 0)
+            m = 0;
+        if (m > room - 1)
+            m = room - 1;
+        uint16_t n = m;
+        memcpy(buf + pos, &n, 2);
+        pos += 2 + m;
+        format_id = ((level >= 0 && level <= 3) ? level : 1) + 1;
+    }
+    else
+    {
+        //字符串内容可用的空间，超出时截断
+        int room = m_log_buf_size - site->fixed_bytes;
+        for (size_t i = 0; i < site->specs.size(); ++i)
+        {
+            for (int k = 0; k < site->specs[i].stars; ++k)
+            {
+                int v = va_arg(valst, int);
+                memcpy(buf + pos, &v, sizeof(v));
+                pos += sizeof(v);
+            }
+            switch (site->specs[i].type)
+            {
+            case LOG_ARG_INT:
+            {
+                int v = va_arg(valst, int);
+                memcpy(buf + pos, &v, 4);
+                break;
+            }
+            case LOG_ARG_LONG:
+            {
+                long long v = va_arg(valst, long);
+                memcpy(buf + pos, &v, 8);
+                break;
+            }
+            case LOG_ARG_LLONG:
+            {
+                long long v = va_arg(valst, long long);
+                memcpy(buf + pos, &v, 8);
+                break;
+            }
+            case LOG_ARG_SIZE:
+            {
+                long long v = va_arg(valst, size_t);
+                memcpy(buf + pos, &v, 8);
+                break;
+            }
+            case LOG_ARG_INTMAX:
+            {
+                long long v = va_arg(valst, intmax_t);
+                memcpy(buf + pos, &v, 8);
+                break;
+            }
+            case LOG_ARG_PTRDIFF:
+            {
+                long long v = va_arg(valst, ptrdiff_t);
+                memcpy(buf + pos, &v, 8);
+                break;
+            }
+            case LOG_ARG_DOUBLE:
+            {
+                double v = va_arg(valst, double);
+                memcpy(buf + pos, &v, 8);
+                break;
+            }
+            case LOG_ARG_LDOUBLE:
+            {
+                long double v = va_arg(valst, long double);
+                memset(buf + pos, 0, 16);
+                memcpy(buf + pos, &v, sizeof(v) < 16 ? sizeof(v) : 16);
+                break;
+            }
+            case LOG_ARG_STR:
+            {
+                const char *s = va_arg(valst, const char *);
+                if (!s)
+                    s = "(null)";
+                size_t n = strlen(s);
+                if (n > (size_t)room)
+                    n = room;
+                if (n > 65535)
+                    n = 65535;
+                room -= n;
+                uint16_t len = n;
+                memcpy(buf + pos, &len, 2);
+                memcpy(buf + pos + 2, s, n);
+                pos += n;
+                break;
+            }
+            default:
+            {
+                void *v = va_arg(valst, void *);
+                memset(buf + pos, 0, 8);
+                memcpy(buf + pos, &v, sizeof(v));
+                break;
+            }
+            }
+            pos += log_arg_size(site->specs[i].type);
+        }
+    }
+
+    log_record_header header;
+    header.len = pos;
+    header.id = format_id;
+    log_record_body body;
+    body.timestamp = clock_ns(CLOCK_MONOTONIC);
+    memcpy(buf, &header, sizeof(header));
+    memcpy(buf + sizeof(header), &body, sizeof(body));
+    return pos;
+}
+
+//线程第一次写日志时创建私有缓冲区，异步模式下把环形缓冲区登记给写线程
+log_buffer *Log::thread_buffer()
+{
+    if (t_log_buffer)
+        return t_log_buffer;
+
+    log_buffer *lb = new log_buffer;
+    lb->buf = new char[m_log_buf_size];
+    lb->ring = NULL;
+    if (m_is_async)
+    {
+        lb->ring = new log_ring(m_ring_size);
+        m_mutex.lock();
+        m_rings.push_back(lb->ring);
+        m_mutex.unlock();
+    }
+    t_log_buffer = lb;
+    return lb;
+}
+
+//按天或按行数切分日志文件，调用者持有m_mutex
+//异步模式下一批日志整体计数，切分点落在批次之间，单个文件的行数可能略超过m_split_lines
+void Log::rotate(long long lines)
+{
+    clock_slot now;
+    log_clock()->now(now);
+    struct tm my_tm = now.local;
+
+    long long before = m_count / m_split_lines;
+    m_count += lines;
+    if (m_today == my_tm.tm_mday && m_count / m_split_lines == before) //everyday log
+        return;
+
+    //积压的日志属于旧文件，切换前写出
+    write_pending();
+
+    char new_log[256] = {0};
+    char tail[16] = {0};
+
+    snprintf(tail, 16, "%d_%02d_%02d_", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday);
+
+    if (m_today != my_tm.tm_mday)
+    {
+        snprintf(new_log, 255, "%s%s%s", dir_name, tail, log_name);
+        m_today = my_tm.tm_mday;
+        m_count = lines;
+    }
+    else
+    {
+        snprintf(new_log, 255, "%s%s%s.%lld", dir_name, tail, log_name, m_count / m_split_lines);
+    }
+
+    int fd = open(new_log, O_WRONLY | O_CREAT | O_APPEND, 0666);
+    if (fd >= 0)
+    {
+        close(m_fd);
+        m_fd = fd;
+        write_header();
+    }
+}
+
+//文本记录："YYYY-MM-DD hh:mm:ss.usec [info]: "前缀加格式化后的内容
+int Log::format_text(log_buffer *lb, const clock_slot *now, int level, const char *format, va_list valst)
+{
+    const char *s = (level >= 0 && level <= 3) ? level_tag[level] : level_tag[1];
+
+    //写入的具体时间内容格式，微秒部分为毫秒精度
+    char *buf = lb->buf;
+    memcpy(buf, now->log_prefix, now->log_prefix_len);
+    int n = now->log_prefix_len + snprintf(buf + now->log_prefix_len, 24, "%06ld %s ", now->real_usec, s);
+
+    //预留换行符的位置，超长的日志被截断
+    int m = vsnprintf(buf + n, m_log_buf_size - n - 1, format, valst);
+    if (m < 0)
+        m = 0;
+    if (m > m_log_buf_size - n - 2)
+        m = m_log_buf_size - n - 2;
+    buf[n + m] = '\n';
+    return n + m + 1;
+}
+
+void Log::write_log(int level, int format_id, const char *format, ...)
+{
+    log_buffer *lb = thread_buffer();
+    clock_slot now;
+    log_clock()->now(now);
 
     va_list valst;
     va_start(valst, format);
+    int len;
+    if (m_binary)
+        len = pack_record(lb->buf, level, format_id, format, valst);
+    else
+        len = format_text(lb, &now, level, format, valst);
+    va_end(valst);
+
+    if (m_use_mmap)
+    {
+        m_writer.append(lb->buf, len);
+        return;
+    }
+
+    if (m_is_async && lb->ring->push(lb->buf, len))
+    {
+        //本线程积压超过大小阈值时提前唤醒写线程，否则等它按时间阈值醒来
+        if (lb->ring->unread() >= (size_t)m_flush_size && !m_poked.load(memory_order_relaxed) && !m_poked.exchange(true))
+            m_wake.post();
+        return;
+    }
+
+    //同步模式，或环形缓冲区已满时追加到积压区，超过大小或时间阈值才写文件
+    m_mutex.lock();
+    rotate(1);
+    append_pending(lb->buf, len);
+    if (m_pending_len >= m_flush_size || now.mono_ms - m_last_flush >= m_flush_interval)
+    {
+        write_pending();
+        m_last_flush = now.mono_ms;
+    }
+    m_mutex.unlock();
+}
+
+//追加到积压区，放不下时先写出积压区，调用者持有m_mutex
+void Log::append_pending(const char *data, int len)
+{
+    if (m_pending_len + len > m_pending_cap)
+        write_pending();
+    if (len > m_pending_cap)
+    {
+        struct iovec iov;
+        iov.iov_base = (void *)data;
+        iov.iov_len = len;
+        writev_all(m_fd, &iov, 1);
+        return;
+    }
+    memcpy(m_pending + m_pending_len, data, len);
+    m_pending_len += len;
+}
+
+//写出积压区，调用者持有m_mutex
+void Log::write_pending()
+{
+    if (0 == m_pending_len)
+        return;
+    struct iovec iov;
+    iov.iov_base = m_pending;
+    iov.iov_len = m_pending_len;
+    writev_all(m_fd, &iov, 1);
+    m_pending_len = 0;
+}
 
-    string log_str;
+//写出积压区，再取出所有线程环形缓冲区中的日志，一次writev写入文件，返回环形缓冲区中取出的字节数
+size_t Log::drain()
+{
     m_mutex.lock();
+    m_last_flush = log_clock()->mono_ms();
+    write_pending();
+    m_iov.resize(m_rings.size() * 2);
+    m_drained.resize(m_rings.size());
 
-    //写入的具体时间内容格式
-    int n = snprintf(m_buf, 48, "%d-%02d-%02d %02d:%02d:%02d.%06ld %s ",
-                     my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
-                     my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, now.tv_usec, s);
-    
-    int m = vsnprintf(m_buf + n, m_log_buf_size - 1, format, valst);
-    m_buf[n + m] = '\n';
-    m_buf[n + m + 1] = '\0';
-    log_str = m_buf;
+    int cnt = 0;
+    size_t total = 0;
+    for (size_t i = 0; i < m_rings.size(); ++i)
+    {
+        cnt += m_rings[i]->peek(&m_iov[cnt], m_drained[i]);
+        total += m_drained[i];
+    }
 
+    if (total > 0)
+    {
+        //按各环形缓冲区累计的记录条数计行
+        long long lines = 0;
+        m_seen_records.resize(m_rings.size(), 0);
+        for (size_t i = 0; i < m_rings.size(); ++i)
+        {
+            size_t records = m_rings[i]->records();
+            lines += records - m_seen_records[i];
+            m_seen_records[i] = records;
+        }
+        rotate(lines);
+        writev_all(m_fd, &m_iov[0], cnt);
+        for (size_t i = 0; i < m_rings.size(); ++i)
+        {
+            m_rings[i]->consume(m_drained[i]);
+        }
+    }
     m_mutex.unlock();
+    return total;
+}
 
-    if (m_is_async && !m_log_queue->full())
+//写线程：按时间阈值定期醒来，或被积压超过大小阈值的线程提前唤醒，成批写出
+void *Log::async_write_log()
+{
+    while (true)
     {
-        m_log_queue->push(log_str);
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        long long deadline = now_ms(now) + m_flush_interval;
+        struct timespec ts;
+        ts.tv_sec = deadline / 1000;
+        ts.tv_nsec = (deadline % 1000) * 1000000;
+        m_wake.timewait(ts);
+
+        m_poked.store(false);
+        if (m_use_mmap)
+            maintain_segments();
+        else
+            drain();
     }
+    return NULL;
+}
+
+//mmap模式第index段的文件名，第0段与按天切分的文件同名，之后加".index"后缀，path至少LOG_PATH_LEN字节
+void Log::segment_path(char *path, const struct tm &my_tm, int index)
+{
+    if (0 == index)
+        snprintf(path, LOG_PATH_LEN, "%s%d_%02d_%02d_%s", dir_name, my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, log_name);
     else
+        snprintf(path, LOG_PATH_LEN, "%s%d_%02d_%02d_%s.%d", dir_name, my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, log_name, index);
+}
+
+//当天已有的最后一段的序号，重启后接着写，不会覆盖
+int Log::last_segment(const struct tm &my_tm)
+{
+    char path[LOG_PATH_LEN];
+    int index = 0;
+    while (true)
     {
-        m_mutex.lock();
-        fputs(log_str.c_str(), m_fp);
-        m_mutex.unlock();
+        segment_path(path, my_tm, index + 1);
+        if (access(path, F_OK) != 0)
+            return index;
+        ++index;
     }
+}
 
-    va_end(valst);
+//mmap模式的后台维护：跨天或写满、达到行数时切换到下一段，准备好新的下一段，截断已写完的旧段
+void Log::maintain_segments()
+{
+    clock_slot now;
+    log_clock()->now(now);
+    struct tm my_tm = now.local;
+    char path[LOG_PATH_LEN];
+
+    m_mutex.lock();
+    if (m_today != my_tm.tm_mday)
+    {
+        //按旧日期准备的下一段作废，换成新日期的文件
+        m_writer.discard_next();
+        m_today = my_tm.tm_mday;
+        int index = last_segment(my_tm);
+        segment_path(path, my_tm, index);
+        m_next_index = index + 1;
+        if (m_writer.prepare(path, file_header()))
+            m_writer.rotate();
+    }
+    if (!m_writer.has_next())
+    {
+        segment_path(path, my_tm, m_next_index++);
+        m_writer.prepare(path, file_header());
+    }
+    if (m_writer.need_switch())
+    {
+        m_writer.rotate();
+        if (!m_writer.has_next())
+        {
+            segment_path(path, my_tm, m_next_index++);
+            m_writer.prepare(path, file_header());
+        }
+    }
+    m_writer.reap();
+    m_mutex.unlock();
 }
 
+//mmap模式下日志已在页缓存中，不需要刷盘
 void Log::flush(void)
+{
+    if (m_use_mmap)
+        return;
+    drain();
+}
+
+void Log::add_limiter(log_limiter *limiter)
+{
+    m_mutex.lock();
+    m_limiters.push_back(limiter);
+    m_mutex.unlock();
+}
+
+void Log::report_suppressed()
 {
     m_mutex.lock();
-    //强制刷新写入流缓冲区
-    fflush(m_fp);
+    vector<log_limiter *> limiters = m_limiters;
     m_mutex.unlock();
+
+    for (size_t i = 0; i < limiters.size(); ++i)
+    {
+        long n = limiters[i]->take_suppressed();
+        if (n > 0)
+        {
+            //格式串按级别分别登记
+            if (3 == limiters[i]->level())
+                LOG_BASE(3, "last message repeated %ld times: %s", n, limiters[i]->format())
+            else
+                LOG_BASE(2, "last message repeated %ld times: %s", n, limiters[i]->format())
+        }
+    }
+}
+
+log_limiter::log_limiter(int level, const char *format)
+{
+    m_level = level;
+    m_format = format;
+    m_tokens = LOG_BURST;
+    m_last = 0;
+    m_suppressed = 0;
+    Log::get_instance()->add_limiter(this);
+}
+
+bool log_limiter::allow()
+{
+    long long now = log_clock()->mono_ms();
+
+    bool ok = false;
+    m_lock.lock();
+    if (m_last)
+    {
+        m_tokens += (now - m_last) * LOG_RATE / 1000.0;
+        if (m_tokens > LOG_BURST)
+            m_tokens = LOG_BURST;
+    }
+    m_last = now;
+    if (m_tokens >= 1)
+    {
+        m_tokens -= 1;
+        ok = true;
+    }
+    else
+    {
+        m_suppressed++;
+    }
+    m_lock.unlock();
+    return ok;
+}
+
+long log_limiter::take_suppressed()
+{
+    m_lock.lock();
+    long n = m_suppressed;
+    m_suppressed = 0;
+    m_lock.unlock();
+    return n;
+}
+
+void Log::set_level(int level)
+{
+    if (level < LOG_MIN_LEVEL)
+        level = LOG_MIN_LEVEL;
+    if (level > 3)
+        level = 3;
+    m_level.store(level, memory_order_relaxed);
+}
+
+//崩溃时只能使用异步信号安全的调用：不等待锁，不分配内存，直接write出积压区和各环形缓冲区
+//环形缓冲区只有持有m_mutex的线程才能消费，拿到锁时照常取出；拿不到锁说明写线程(或崩溃的线程)正在消费，
+//此时只写出已提交的数据，不移动读取位置，也不改动积压区，宁可重复几行也不破坏单消费者的约定
+void Log::crash_flush()
+{
+    //mmap模式的日志已在页缓存中，进程终止不会丢失，只需截掉预分配的部分
+    if (m_use_mmap)
+    {
+        m_writer.crash_close();
+        return;
+    }
+    if (m_fd < 0)
+        return;
+    bool locked = 0 == pthread_mutex_trylock(m_mutex.get());
+
+    if (m_pending_len > 0)
+        write(m_fd, m_pending, m_pending_len);
+    if (locked)
+        m_pending_len = 0;
+    for (size_t i = 0; i < m_rings.size(); ++i)
+    {
+        struct iovec iov[2];
+        size_t bytes;
+        int cnt = m_rings[i]->peek(iov, bytes);
+        if (cnt > 0)
+        {
+            writev_all(m_fd, iov, cnt);
+            if (locked)
+                m_rings[i]->consume(bytes);
+        }
+    }
+
+    if (locked)
+        m_mutex.unlock();
+}
+
+void Log::crash_handler(int sig)
+{
+    Log::get_instance()->crash_flush();
+    //恢复默认动作，信号处理函数返回后再次触发，照常终止进程并生成core
+    signal(sig, SIG_DFL);
+    raise(sig);
 }
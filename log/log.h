@@ -6,10 +6,35 @@
 #include <string>
 #include <stdarg.h>
 #include <pthread.h>
-#include "block_queue.h"
+#include <atomic>
+#include <vector>
+#include <sys/uio.h>
+#include <sys/time.h>
+#include "../lock/locker.h"
+#include "log_ring.h"
+#include "log_format.h"
+#include "mmap_writer.h"
+#include "../timer/coarse_clock.h"
 
 using namespace std;
 
+const int MAX_LOG_FORMATS = 4096; //二进制模式最多登记的格式串数
+const size_t LOG_SEGMENT_SIZE = 32 << 20; //mmap模式每段映射的字节数
+const int LOG_PATH_LEN = 128 + 128 + 48; //分段文件名：目录名、文件名各128，日期和".序号"最长48
+
+//编译期日志级别下限：0 debug，1 info，2 warn，3 error，make DEBUG=0时默认为2
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL 0
+#endif
+
+//WARN/ERROR每个调用点的令牌桶：最多连续写LOG_BURST条，之后每秒补充LOG_RATE条
+const int LOG_BURST = 20;
+const int LOG_RATE = 5;
+
+struct log_buffer;
+struct log_site;
+class log_limiter;
+
 class Log
 {
 public:
@@ -23,28 +48,63 @@ public:
     static void *flush_log_thread(void *args)
     {
         Log::get_instance()->async_write_log();
+        return NULL;
     }
     //可选择的参数有日志文件、日志缓冲区大小、最大行数以及最长日志条队列
-    bool init(const char *file_name, int close_log, int log_buf_size = 8192, int split_lines = 5000000, int max_queue_size = 0);
+    //异步模式下每个写日志的线程拥有一个环形缓冲区，max_queue_size按每条256字节折算为其容量
+    //flush_interval(毫秒)和flush_size(字节)为刷盘策略：积压超过任一阈值才写入文件
+    //binary为二进制模式，日志记录不做格式化，由log/decoder离线解码
+    //use_mmap为mmap模式，写日志的线程直接拷贝到映射的日志文件，文件的切分由后台线程完成
+    bool init(const char *file_name, int close_log, int log_buf_size = 8192, int split_lines = 5000000, int max_queue_size = 0,
+              int flush_interval = 1000, int flush_size = 65536, bool binary = false, bool use_mmap = false);
+
+    //登记调用点的格式串，返回编号，文本模式返回0
+    int register_format(int level, const char *format);
 
-    void write_log(int level, const char *format, ...);
+    //format_id为register_format返回的编号，为0时二进制模式下在本线程格式化后保存
+    void write_log(int level, int format_id, const char *format, ...);
 
+    //立即把积压的日志写入文件
     void flush(void);
 
+    //登记限流的调用点
+    void add_limiter(log_limiter *limiter);
+    //把各调用点被限流丢弃的条数汇总成"repeated N times"写入，由定时器周期调用
+    void report_suppressed();
+
+    //运行时日志级别，低于它的日志不写入，不能低于编译期的LOG_MIN_LEVEL
+    bool enabled(int level)
+    {
+        return level >= m_level.load(memory_order_relaxed);
+    }
+    void set_level(int level);
+    int get_level()
+    {
+        return m_level.load(memory_order_relaxed);
+    }
+
+    //SIGSEGV等崩溃信号的处理函数，尽力写出积压的日志后按默认动作重新触发信号
+    static void crash_handler(int sig);
+
 private:
     Log();
     virtual ~Log();
-    void *async_write_log()
-    {
-        string single_log;
-        //从阻塞队列中取出一个日志string，写入文件
-        while (m_log_queue->pop(single_log))
-        {
-            m_mutex.lock();
-            fputs(single_log.c_str(), m_fp);
-            m_mutex.unlock();
-        }
-    }
+    void *async_write_log();
+    log_buffer *thread_buffer();
+    size_t drain();
+    void write_pending();
+    void append_pending(const char *data, int len);
+    int add_site(int level, const char *format);
+    void append_def(char *buf, int id);
+    string file_header();
+    void write_header();
+    void segment_path(char *path, const struct tm &my_tm, int index);
+    int last_segment(const struct tm &my_tm);
+    void maintain_segments();
+    int pack_record(char *buf, int level, int format_id, const char *format, va_list valst);
+    int format_text(log_buffer *lb, const clock_slot *now, int level, const char *format, va_list valst);
+    void rotate(long long lines);
+    void crash_flush();
 
 private:
     char dir_name[128]; //路径名
@@ -53,17 +113,81 @@ private:
     int m_log_buf_size; //日志缓冲区大小
     long long m_count;  //日志行数记录
     int m_today;        //因为按天分类,记录当前时间是那一天
-    FILE *m_fp;         //打开log的文件指针
-    char *m_buf;
-    block_queue<string> *m_log_queue; //阻塞队列
+    int m_fd;           //打开log的文件描述符
+    size_t m_ring_size;               //每个线程环形缓冲区的字节数
+    vector<log_ring *> m_rings;       //各线程的环形缓冲区，由m_mutex保护
+    vector<struct iovec> m_iov;       //写线程批量写入时使用
+    vector<size_t> m_drained;         //写线程本批从各环形缓冲区取出的字节数
+    vector<size_t> m_seen_records;    //写线程已计入行数的各环形缓冲区记录数
+    char *m_pending;                  //同步模式(及异步模式环形缓冲区满时)积压的日志，由m_mutex保护
+    int m_pending_len;
+    int m_pending_cap;
+    int m_flush_interval;             //刷盘时间阈值，毫秒
+    int m_flush_size;                 //刷盘大小阈值，字节
+    long long m_last_flush;           //上次刷盘的时间，毫秒
     bool m_is_async;                  //是否同步标志位
-    locker m_mutex;
+    bool m_binary;                    //是否二进制模式
+    bool m_use_mmap;                  //是否mmap模式
+    mmap_writer m_writer;             //mmap模式的分段写入
+    int m_next_index;                 //mmap模式下一段文件的序号，由m_mutex保护
+    log_site *m_formats[MAX_LOG_FORMATS]; //格式串登记表，编号为下标加一，登记后不再修改
+    int m_format_count;
+    atomic<bool> m_poked;             //已通知写线程提前刷盘
+    sem m_wake;                       //唤醒写线程
+    locker m_mutex;                   //保护日志文件的写入与切分，以及环形缓冲区列表
+    vector<log_limiter *> m_limiters; //限流的调用点，由m_mutex保护
     int m_close_log; //关闭日志
+    atomic<int> m_level; //运行时日志级别
 };
 
-#define LOG_DEBUG(format, ...) if(0 == m_close_log) {Log::get_instance()->write_log(0, format, ##__VA_ARGS__); Log::get_instance()->flush();}
-#define LOG_INFO(format, ...) if(0 == m_close_log) {Log::get_instance()->write_log(1, format, ##__VA_ARGS__); Log::get_instance()->flush();}
-#define LOG_WARN(format, ...) if(0 == m_close_log) {Log::get_instance()->write_log(2, format, ##__VA_ARGS__); Log::get_instance()->flush();}
-#define LOG_ERROR(format, ...) if(0 == m_close_log) {Log::get_instance()->write_log(3, format, ##__VA_ARGS__); Log::get_instance()->flush();}
+//单个调用点的令牌桶，作为调用点的静态变量，首次执行时登记到Log
+class log_limiter
+{
+public:
+    log_limiter(int level, const char *format);
+
+    //取一个令牌，取不到时计入被丢弃的条数
+    bool allow();
+    //取出并清零被丢弃的条数
+    long take_suppressed();
+
+    int level() { return m_level; }
+    const char *format() { return m_format; }
+
+private:
+    int m_level;
+    const char *m_format;
+    double m_tokens;
+    long long m_last; //上次补充令牌的时间，毫秒
+    long m_suppressed;
+    locker m_lock;
+};
+
+//只有ERROR立即刷盘，其余级别按刷盘策略成批写入
+//每个调用点的格式串只登记一次，编号保存在调用点的静态变量中
+#define LOG_BASE(level, format, ...) {static int log_format_id = Log::get_instance()->register_format(level, format); \
+    Log::get_instance()->write_log(level, log_format_id, format, ##__VA_ARGS__);}
+//WARN和ERROR在故障时可能被同一个调用点刷屏，经令牌桶限流，被丢弃的条数由定时器汇总输出
+#define LOG_LIMITED(level, format, ...) {static log_limiter log_site_limiter(level, format); \
+    if (log_site_limiter.allow()) LOG_BASE(level, format, ##__VA_ARGS__)}
+
+//低于LOG_MIN_LEVEL的调用点在编译期整个去掉，连同参数求值；高于它的再按运行时级别过滤
+#if LOG_MIN_LEVEL <= 0
+#define LOG_DEBUG(format, ...) if(0 == m_close_log && Log::get_instance()->enabled(0)) LOG_BASE(0, format, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(format, ...) {}
+#endif
+#if LOG_MIN_LEVEL <= 1
+#define LOG_INFO(format, ...) if(0 == m_close_log && Log::get_instance()->enabled(1)) LOG_BASE(1, format, ##__VA_ARGS__)
+#else
+#define LOG_INFO(format, ...) {}
+#endif
+#if LOG_MIN_LEVEL <= 2
+#define LOG_WARN(format, ...) if(0 == m_close_log && Log::get_instance()->enabled(2)) LOG_LIMITED(2, format, ##__VA_ARGS__)
+#else
+#define LOG_WARN(format, ...) {}
+#endif
+#define LOG_ERROR(format, ...) if(0 == m_close_log) {static log_limiter log_site_limiter(3, format); \
+    if (log_site_limiter.allow()) {LOG_BASE(3, format, ##__VA_ARGS__) Log::get_instance()->flush();}}
 
 #endif
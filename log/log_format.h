@@ -0,0 +1,180 @@
+/*************************************************************
+*二进制日志格式
+*写日志时不做格式化：每个调用点的格式串登记一次得到编号，记录中只保存编号、单调时钟时间戳和参数的原始字节
+*离线解码工具(log/decoder)按格式串重新渲染成文本日志
+*
+*文件由若干段组成，每段以文件头开始，之后是格式串定义和日志记录
+*文件头记录同一时刻的墙上时间和单调时钟，解码时据此把记录的单调时间换算为墙上时间
+*每次打开或切分日志文件都会重新写出文件头和全部格式串定义，每个文件可以单独解码
+**************************************************************/
+
+#ifndef LOG_FORMAT_H
+#define LOG_FORMAT_H
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+using namespace std;
+
+#define LOG_BINARY_MAGIC "TWSBLOG1"
+
+//参数在记录中的存储类型
+enum LOG_ARG_TYPE
+{
+    LOG_ARG_INT = 0, //int以及char、short，4字节
+    LOG_ARG_LONG,    //long，8字节
+    LOG_ARG_LLONG,   //long long，8字节
+    LOG_ARG_SIZE,    //size_t，8字节
+    LOG_ARG_INTMAX,  //intmax_t，8字节
+    LOG_ARG_PTRDIFF, //ptrdiff_t，8字节
+    LOG_ARG_DOUBLE,  //double，8字节
+    LOG_ARG_LDOUBLE, //long double，16字节
+    LOG_ARG_STR,     //字符串，2字节长度加内容
+    LOG_ARG_PTR      //指针，8字节
+};
+
+struct log_file_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    int64_t anchor_real; //墙上时间，纳秒
+    int64_t anchor_mono; //同一时刻的单调时钟，纳秒
+};
+
+//定义和记录共用的头部，id为0表示格式串定义
+struct log_record_header
+{
+    uint32_t len; //包括头部在内的总字节数
+    uint32_t id;
+};
+
+//格式串定义：log_record_header之后紧跟本结构和格式串(不含'\0')
+struct log_format_def
+{
+    uint32_t format_id;
+    uint32_t level;
+};
+
+//日志记录：log_record_header之后紧跟时间戳和参数
+struct log_record_body
+{
+    int64_t timestamp; //单调时钟，纳秒
+};
+
+//格式串中的一个转换说明，[begin, end)为它在格式串中的位置
+struct log_arg_spec
+{
+    int begin;
+    int end;
+    int stars; //宽度、精度中'*'的个数，各占一个int参数
+    int type;
+};
+
+//解析printf格式串，得到每个转换说明的参数类型
+inline void parse_log_format(const char *format, vector<log_arg_spec> &specs)
+{
+    specs.clear();
+    const char *p = format;
+    while ((p = strchr(p, '%')) != NULL)
+    {
+        log_arg_spec spec;
+        spec.begin = p - format;
+        spec.stars = 0;
+        ++p;
+        if ('%' == *p)
+        {
+            ++p;
+            continue;
+        }
+
+        //标志、宽度、精度
+        while (*p && strchr("-+ #0'", *p))
+            ++p;
+        while (*p && (('0' <= *p && *p <= '9') || '.' == *p || '*' == *p))
+        {
+            if ('*' == *p)
+                spec.stars++;
+            ++p;
+        }
+
+        //长度修饰
+        int length = 0;
+        if ('h' == *p)
+        {
+            ++p;
+            if ('h' == *p)
+                ++p;
+        }
+        else if ('l' == *p)
+        {
+            ++p;
+            length = 1;
+            if ('l' == *p)
+            {
+                ++p;
+                length = 2;
+            }
+        }
+        else if ('z' == *p || 'j' == *p || 't' == *p || 'L' == *p || 'q' == *p)
+        {
+            length = *p;
+            ++p;
+        }
+
+        char conv = *p;
+        if (!conv)
+            break;
+        ++p;
+        spec.end = p - format;
+
+        if (strchr("diouxXc", conv))
+        {
+            if (1 == length)
+                spec.type = LOG_ARG_LONG;
+            else if (2 == length || 'q' == length || 'L' == length)
+                spec.type = LOG_ARG_LLONG;
+            else if ('z' == length)
+                spec.type = LOG_ARG_SIZE;
+            else if ('j' == length)
+                spec.type = LOG_ARG_INTMAX;
+            else if ('t' == length)
+                spec.type = LOG_ARG_PTRDIFF;
+            else
+                spec.type = LOG_ARG_INT;
+        }
+        else if (strchr("fFeEgGaA", conv))
+        {
+            spec.type = 'L' == length ? LOG_ARG_LDOUBLE : LOG_ARG_DOUBLE;
+        }
+        else if ('s' == conv)
+        {
+            spec.type = LOG_ARG_STR;
+        }
+        else
+        {
+            //%p，以及不支持的%n等按指针保存
+            spec.type = LOG_ARG_PTR;
+        }
+        specs.push_back(spec);
+    }
+}
+
+//参数的定长字节数，字符串为长度字段的字节数
+inline int log_arg_size(int type)
+{
+    switch (type)
+    {
+    case LOG_ARG_INT:
+        return 4;
+    case LOG_ARG_LDOUBLE:
+        return 16;
+    case LOG_ARG_STR:
+        return 2;
+    default:
+        return 8;
+    }
+}
+
+#endif
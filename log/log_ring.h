@@ -0,0 +1,118 @@
+/*************************************************************
+*单生产者单消费者的无锁字节环形缓冲区
+*生产者整条写入日志记录，空间不足时写入失败，不会只写入半条
+*消费者一次取出全部可读数据，回绕时分为两段，可直接交给writev
+*head只由生产者修改，tail只由消费者修改，两者分处不同缓存行，避免伪共享
+**************************************************************/
+
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+#include <string.h>
+#include <sys/uio.h>
+#include <atomic>
+
+using namespace std;
+
+class log_ring
+{
+public:
+    //容量向上取整为2的幂，下标用位与取模
+    log_ring(size_t capacity)
+    {
+        m_capacity = 1;
+        while (m_capacity < capacity)
+            m_capacity <<= 1;
+        m_mask = m_capacity - 1;
+        m_buf = new char[m_capacity];
+        m_head.store(0, memory_order_relaxed);
+        m_tail.store(0, memory_order_relaxed);
+        m_cached_tail = 0;
+        m_records.store(0, memory_order_relaxed);
+    }
+
+    ~log_ring()
+    {
+        delete[] m_buf;
+    }
+
+    //生产者调用，空间不足返回false
+    bool push(const char *data, size_t len)
+    {
+        size_t head = m_head.load(memory_order_relaxed);
+        //先用缓存的tail判断，不够时才去读消费者的缓存行
+        if (m_capacity - (head - m_cached_tail) < len)
+        {
+            m_cached_tail = m_tail.load(memory_order_acquire);
+            if (m_capacity - (head - m_cached_tail) < len)
+                return false;
+        }
+
+        size_t pos = head & m_mask;
+        size_t first = m_capacity - pos;
+        if (first >= len)
+        {
+            memcpy(m_buf + pos, data, len);
+        }
+        else
+        {
+            memcpy(m_buf + pos, data, first);
+            memcpy(m_buf, data + first, len - first);
+        }
+        m_head.store(head + len, memory_order_release);
+        m_records.store(m_records.load(memory_order_relaxed) + 1, memory_order_relaxed);
+        return true;
+    }
+
+    //消费者调用，将可读数据填入iov(最多两段)，返回段数，bytes为可读字节数
+    int peek(struct iovec *iov, size_t &bytes)
+    {
+        size_t tail = m_tail.load(memory_order_relaxed);
+        size_t head = m_head.load(memory_order_acquire);
+        bytes = head - tail;
+        if (0 == bytes)
+            return 0;
+
+        size_t pos = tail & m_mask;
+        size_t first = m_capacity - pos;
+        iov[0].iov_base = m_buf + pos;
+        if (first >= bytes)
+        {
+            iov[0].iov_len = bytes;
+            return 1;
+        }
+        iov[0].iov_len = first;
+        iov[1].iov_base = m_buf;
+        iov[1].iov_len = bytes - first;
+        return 2;
+    }
+
+    //消费者调用，释放peek取出的len字节
+    void consume(size_t len)
+    {
+        m_tail.store(m_tail.load(memory_order_relaxed) + len, memory_order_release);
+    }
+
+    //累计写入的记录条数，供消费者统计行数，与peek取出的字节不严格对应
+    size_t records() const
+    {
+        return m_records.load(memory_order_relaxed);
+    }
+
+    //生产者调用，尚未被消费者取走的字节数
+    size_t unread() const
+    {
+        return m_head.load(memory_order_relaxed) - m_tail.load(memory_order_acquire);
+    }
+
+private:
+    char *m_buf;
+    size_t m_capacity;
+    size_t m_mask;
+    alignas(64) atomic<size_t> m_head; //写入位置，只增不减
+    size_t m_cached_tail;              //生产者缓存的读取位置
+    atomic<size_t> m_records;          //累计写入的记录条数
+    alignas(64) atomic<size_t> m_tail; //读取位置，只增不减
+};
+
+#endif
@@ -0,0 +1,267 @@
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mmap_writer.h"
+
+//当前段迟迟无法切换(如磁盘满无法准备新段)时，写日志的线程最多让出CPU的次数，之后丢弃这条日志
+static const int MAX_SWITCH_SPINS = 10000;
+
+mmap_writer::mmap_writer()
+{
+    m_current.store(NULL);
+    m_next.store(NULL);
+    m_segment_size = 0;
+    m_split_lines = 0;
+    m_wake = NULL;
+}
+
+mmap_writer::~mmap_writer()
+{
+}
+
+void mmap_writer::init(sem *wake, size_t segment_size, long long split_lines)
+{
+    m_wake = wake;
+    m_segment_size = segment_size;
+    m_split_lines = split_lines;
+}
+
+//文件已有内容时从按页对齐的位置开始映射，接在原内容之后写
+//段的空间用fallocate预先分配，映射时预先建立页表，写日志时不再缺页分配磁盘块
+log_segment *mmap_writer::open_segment(const char *path, const string &head)
+{
+    int fd = open(path, O_RDWR | O_CREAT, 0666);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        ::close(fd);
+        return NULL;
+    }
+    off_t page = sysconf(_SC_PAGESIZE);
+    off_t file_off = st.st_size & ~(page - 1);
+    size_t start = st.st_size - file_off;
+
+    if (0 != posix_fallocate(fd, file_off, m_segment_size))
+    {
+        ::close(fd);
+        return NULL;
+    }
+    void *base = mmap(NULL, m_segment_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, file_off);
+    if (MAP_FAILED == base)
+    {
+        ftruncate(fd, st.st_size);
+        ::close(fd);
+        return NULL;
+    }
+
+    log_segment *seg = new log_segment;
+    seg->size = m_segment_size;
+    seg->used = 0;
+    seg->file_off = file_off;
+    seg->base = (char *)base;
+    seg->fd = fd;
+    seg->fresh = 0 == st.st_size;
+    snprintf(seg->path, sizeof(seg->path), "%s", path);
+    memcpy(seg->base + start, head.data(), head.size());
+    seg->reserved.store(start + head.size());
+    seg->committed.store(start + head.size());
+    seg->records.store(0);
+    seg->stuck.store(false);
+    return seg;
+}
+
+bool mmap_writer::install(const char *path, const string &head)
+{
+    log_segment *seg = open_segment(path, head);
+    if (!seg)
+        return false;
+    m_open.push_back(seg);
+    m_current.store(seg);
+    return true;
+}
+
+bool mmap_writer::prepare(const char *path, const string &head)
+{
+    if (m_next.load())
+        return true;
+    log_segment *seg = open_segment(path, head);
+    if (!seg)
+        return false;
+    m_open.push_back(seg);
+    m_next.store(seg);
+    return true;
+}
+
+//在seg中预留并拷贝，本段放不下时返回false
+//预留越过段尾的线程负责关闭本段：它之前的预留都在段内，文件截断到它的起始位置即可
+bool mmap_writer::try_append(log_segment *seg, const char *data, size_t len, bool record)
+{
+    size_t off = seg->reserved.fetch_add(len);
+    if (off + len <= seg->size)
+    {
+        memcpy(seg->base + off, data, len);
+        seg->committed.fetch_add(len, memory_order_release);
+        if (record && m_split_lines > 0 && seg->records.fetch_add(1) + 1 == m_split_lines)
+            m_wake->post();
+        return true;
+    }
+    if (off < seg->size)
+        close_segment(seg, off);
+    return false;
+}
+
+//关闭seg并换上准备好的下一段，没有下一段时标记为stuck由后台线程换上
+void mmap_writer::close_segment(log_segment *seg, size_t off)
+{
+    seg->used = off;
+    seg->committed.fetch_add(seg->size - off, memory_order_release);
+    log_segment *next = m_next.exchange(NULL);
+    if (next)
+        m_current.store(next);
+    else
+        seg->stuck.store(true);
+    m_wake->post();
+}
+
+void mmap_writer::append(const char *data, size_t len, bool record)
+{
+    for (int spins = 0; spins < MAX_SWITCH_SPINS; ++spins)
+    {
+        log_segment *seg = m_current.load(memory_order_acquire);
+        if (!seg)
+            return;
+        if (seg->reserved.load(memory_order_relaxed) < seg->size && try_append(seg, data, len, record))
+            return;
+        //本段已关闭，等待换上下一段
+        if (m_current.load(memory_order_acquire) == seg)
+            sched_yield();
+    }
+}
+
+void mmap_writer::append_next(const char *data, size_t len)
+{
+    log_segment *seg = m_next.load();
+    if (seg && seg->reserved.load() < seg->size)
+        try_append(seg, data, len, false);
+}
+
+void mmap_writer::discard_next()
+{
+    log_segment *seg = m_next.exchange(NULL);
+    if (!seg)
+        return;
+    for (size_t i = 0; i < m_open.size(); ++i)
+    {
+        if (m_open[i] == seg)
+        {
+            m_open.erase(m_open.begin() + i);
+            break;
+        }
+    }
+    munmap(seg->base, seg->size);
+    ftruncate(seg->fd, seg->file_off + seg->reserved.load());
+    ::close(seg->fd);
+    if (seg->fresh && 0 == seg->records.load())
+        unlink(seg->path);
+}
+
+bool mmap_writer::need_switch()
+{
+    log_segment *seg = m_current.load();
+    if (!seg)
+        return false;
+    if (seg->stuck.load())
+        return true;
+    return m_split_lines > 0 && seg->records.load() >= m_split_lines && seg->reserved.load() < seg->size;
+}
+
+void mmap_writer::rotate()
+{
+    log_segment *seg = m_current.load();
+    if (!seg)
+        return;
+    if (!seg->stuck.load())
+    {
+        size_t off = seg->reserved.fetch_add(seg->size);
+        if (off < seg->size)
+            close_segment(seg, off);
+    }
+    //关闭时没有准备好的下一段
+    if (seg->stuck.load() && m_current.load() == seg)
+    {
+        log_segment *next = m_next.exchange(NULL);
+        if (next)
+            m_current.store(next);
+    }
+}
+
+//写入已完成的段：释放映射，截掉预分配而未使用的部分
+void mmap_writer::seal(log_segment *seg)
+{
+    munmap(seg->base, seg->size);
+    ftruncate(seg->fd, seg->file_off + seg->used);
+    ::close(seg->fd);
+}
+
+//段的头部不释放：仍可能有线程持有旧的当前段指针，在上面做一次预留后才发现它已关闭
+void mmap_writer::reap()
+{
+    log_segment *current = m_current.load();
+    log_segment *next = m_next.load();
+    for (size_t i = 0; i < m_open.size();)
+    {
+        log_segment *seg = m_open[i];
+        if (seg != current && seg != next && seg->committed.load(memory_order_acquire) == seg->size)
+        {
+            seal(seg);
+            m_open.erase(m_open.begin() + i);
+        }
+        else
+        {
+            ++i;
+        }
+    }
+}
+
+void mmap_writer::close()
+{
+    log_segment *seg = m_current.exchange(NULL);
+    if (seg && !seg->stuck.load())
+    {
+        size_t off = seg->reserved.fetch_add(seg->size);
+        if (off < seg->size)
+        {
+            seg->used = off;
+            seg->committed.fetch_add(seg->size - off, memory_order_release);
+        }
+    }
+    discard_next();
+
+    //等待正在拷贝的线程完成
+    for (int i = 0; i < 100; ++i)
+    {
+        reap();
+        if (m_open.empty())
+            break;
+        usleep(1000);
+    }
+}
+
+void mmap_writer::crash_close()
+{
+    for (size_t i = 0; i < m_open.size(); ++i)
+    {
+        log_segment *seg = m_open[i];
+        size_t reserved = seg->reserved.load();
+        ftruncate(seg->fd, seg->file_off + (reserved < seg->size ? reserved : seg->used));
+    }
+    log_segment *next = m_next.load();
+    if (next && next->fresh && 0 == next->records.load())
+        unlink(next->path);
+}
@@ -0,0 +1,81 @@
+#ifndef MMAP_WRITER_H
+#define MMAP_WRITER_H
+
+#include <stddef.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "../lock/locker.h"
+
+using namespace std;
+
+/*
+* 日志文件的mmap写入(-l 2)
+* 日志文件按段映射到内存，写日志的线程用原子加在当前段中预留空间后直接拷贝，不加锁也没有系统调用
+* 段写满(或需要切分)时越过段尾的那个线程把预先准备好的下一段换成当前段
+* 映射、预分配、截断和关闭文件都由后台线程完成，写日志的线程不等待文件操作
+*/
+struct log_segment
+{
+    atomic<size_t> reserved;  //已预留到的位置，越过size表示本段已关闭
+    atomic<size_t> committed; //已拷贝完成的字节数，关闭的段达到size后可以截断
+    atomic<long long> records; //本段的记录数，用于按行数切分
+    atomic<bool> stuck;       //关闭时还没有准备好的下一段，由后台线程换上
+    size_t size;              //映射的字节数
+    size_t used;              //关闭时实际写入的位置，由越过段尾的线程设置
+    off_t file_off;           //映射在文件中的起始位置，按页对齐
+    char *base;
+    int fd;
+    bool fresh;               //文件是新建的，未使用时可以删除
+    char path[256];
+};
+
+class mmap_writer
+{
+public:
+    mmap_writer();
+    ~mmap_writer();
+
+    //wake为后台线程等待的信号量，段写满或达到split_lines行时唤醒它
+    void init(sem *wake, size_t segment_size, long long split_lines);
+
+    //追加一条记录，record为false表示不计入行数(二进制模式的格式串定义)
+    void append(const char *data, size_t len, bool record = true);
+    //追加到已准备好但尚未启用的下一段，保证下一个文件也包含它
+    void append_next(const char *data, size_t len);
+
+    //以下由后台线程调用，调用者负责互斥
+    //打开path作为当前段，已有内容时接在末尾，head写在段首
+    bool install(const char *path, const string &head);
+    //预先准备下一段
+    bool prepare(const char *path, const string &head);
+    bool has_next() { return NULL != m_next.load(); }
+    //丢弃准备好的下一段并删除其文件
+    void discard_next();
+    //当前段是否需要切分：已写满关闭或达到行数
+    bool need_switch();
+    //关闭当前段，换成准备好的下一段
+    void rotate();
+    //截断并释放写入已完成的旧段
+    void reap();
+    //进程退出时截断当前段，删除未用的下一段
+    void close();
+    //崩溃时调用，只使用异步信号安全的调用
+    void crash_close();
+
+private:
+    log_segment *open_segment(const char *path, const string &head);
+    bool try_append(log_segment *seg, const char *data, size_t len, bool record);
+    void close_segment(log_segment *seg, size_t off);
+    void seal(log_segment *seg);
+
+private:
+    atomic<log_segment *> m_current;
+    atomic<log_segment *> m_next;
+    vector<log_segment *> m_open;    //尚未截断释放的段，只由后台线程访问
+    size_t m_segment_size;
+    long long m_split_lines;
+    sem *m_wake;
+};
+
+#endif
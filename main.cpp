@@ -16,12 +16,17 @@ int main(int argc, char *argv[])
     //初始化(配置写入WebServer对象)
     server.init(config.PORT, user, passwd, databasename, config.LOGWrite, 
                 config.OPT_LINGER, config.TRIGMode,  config.sql_num,  config.thread_num, 
-                config.close_log, config.actor_model);
+                config.close_log, config.actor_model, config.bundle_path,
+                config.log_flush_interval, config.log_flush_size, config.log_binary,
+                config.log_level, config.access_sample, config.async_db_num, config.user_cache, config.store_path, config.snapshot_path);
     
 
     //日志初始化
     server.log_init();
 
+    //站点包初始化
+    server.bundle_init();
+
     //数据库初始化和用户数据获取
     server.sql_pool();
 
@@ -0,0 +1,1641 @@
+/*
+* MySQL协议替身服务器，用于在没有真实数据库的开发机上对登录/注册的数据库路径做压测
+* 用法：./fake_mysql [-P 端口] [-s unix套接字] [-n 预置用户数] [-U] [-l 查询延迟ms] [-j 抖动ms] [-w 写入额外延迟ms]
+*                    [-c 建连延迟ms] [-e 错误率] [-E 错误码] [-k 断连率] [-m 最大连接数] [-v]
+* 实现客户端/服务器协议中本服务器用到的部分：握手认证(接受任意用户名密码)、文本查询、预处理语句(二进制协议)、ping
+* 只有一张内存中的user表(id自增, username, passwd)，启动时含root/123456，-n N再预置u0/p0 ... u(N-1)/p(N-1)，-U时username唯一
+* 支持的语句：
+*   SELECT 列[, 列] FROM user [WHERE 列 比较符 值] [ORDER BY id] [LIMIT n]，列为id、username、passwd、*或COUNT(*)
+*   INSERT INTO user(username, passwd) VALUES(值, 值)[, (值, 值)]...，-U时任一用户名重复整条语句失败(1062)
+*   SET、BEGIN、COMMIT、ROLLBACK、USE直接返回OK
+* 每个连接一个线程，同一连接上的语句与真实数据库一样串行执行：每条查询先睡眠-l加上[0, -j)的随机抖动，INSERT再加-w
+* 错误注入：按-e的概率返回-E指定的错误码(默认1205锁等待超时)，按-k的概率不应答直接断开(客户端得到2013)，超过-m的新连接得到1040
+* 本服务器以"localhost"连接数据库，libmysqlclient此时走unix套接字，默认路径为/var/run/mysqld/mysqld.sock，
+* 无权创建时用-s指定其他路径，并设置环境变量MYSQL_UNIX_PORT为同一路径后启动服务器
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include "../../lock/locker.h"
+
+using namespace std;
+
+//能力标志，不声明CLIENT_SSL、CLIENT_DEPRECATE_EOF和CLIENT_QUERY_ATTRIBUTES，结果集用EOF包结尾，执行包为经典格式
+const uint32_t CLIENT_LONG_PASSWORD = 0x1;
+const uint32_t CLIENT_FOUND_ROWS = 0x2;
+const uint32_t CLIENT_LONG_FLAG = 0x4;
+const uint32_t CLIENT_CONNECT_WITH_DB = 0x8;
+const uint32_t CLIENT_PROTOCOL_41 = 0x200;
+const uint32_t CLIENT_TRANSACTIONS = 0x2000;
+const uint32_t CLIENT_SECURE_CONNECTION = 0x8000;
+const uint32_t CLIENT_MULTI_RESULTS = 0x20000;
+const uint32_t CLIENT_PS_MULTI_RESULTS = 0x40000;
+const uint32_t CLIENT_PLUGIN_AUTH = 0x80000;
+const uint32_t CLIENT_CONNECT_ATTRS = 0x100000;
+const uint32_t CLIENT_PLUGIN_AUTH_LENENC = 0x200000;
+const uint32_t SERVER_CAPS = CLIENT_LONG_PASSWORD | CLIENT_FOUND_ROWS | CLIENT_LONG_FLAG | CLIENT_CONNECT_WITH_DB |
+                             CLIENT_PROTOCOL_41 | CLIENT_TRANSACTIONS | CLIENT_SECURE_CONNECTION | CLIENT_MULTI_RESULTS |
+                             CLIENT_PS_MULTI_RESULTS | CLIENT_PLUGIN_AUTH | CLIENT_CONNECT_ATTRS |
+                             CLIENT_PLUGIN_AUTH_LENENC;
+const uint16_t SERVER_STATUS_AUTOCOMMIT = 0x2;
+
+enum
+{
+    COM_QUIT = 0x01,
+    COM_INIT_DB = 0x02,
+    COM_QUERY = 0x03,
+    COM_PING = 0x0e,
+    COM_STMT_PREPARE = 0x16,
+    COM_STMT_EXECUTE = 0x17,
+    COM_STMT_CLOSE = 0x19,
+    COM_STMT_RESET = 0x1a,
+    COM_SET_OPTION = 0x1b,
+    COM_RESET_CONNECTION = 0x1f
+};
+
+//列类型，只用到这几种
+enum
+{
+    TYPE_TINY = 0x01,
+    TYPE_SHORT = 0x02,
+    TYPE_LONG = 0x03,
+    TYPE_FLOAT = 0x04,
+    TYPE_DOUBLE = 0x05,
+    TYPE_NULL = 0x06,
+    TYPE_LONGLONG = 0x08,
+    TYPE_INT24 = 0x09,
+    TYPE_YEAR = 0x0d,
+    TYPE_VAR_STRING = 0xfd
+};
+
+const char *AUTH_PLUGIN = "caching_sha2_password";
+const int SCRAMBLE_LEN = 20;
+const size_t FLUSH_SIZE = 65536;   //输出缓冲攒到这么多就写出，大结果集不整体驻留内存
+const int ROW_CHUNK = 65536;       //user表按块分配，已发布的行不再移动，扫描时不持锁
+const int MAX_CHUNKS = 16384;
+
+struct fake_config
+{
+    int port;
+    string socket_path;
+    int users;
+    bool unique;
+    int latency_ms;
+    int jitter_ms;
+    int write_ms;
+    int connect_ms;
+    double error_rate;
+    int error_code;
+    double drop_rate;
+    int max_conn;
+    bool verbose;
+};
+
+static fake_config g_config;
+
+static atomic<int> g_connections(0);
+static atomic<uint64_t> g_accepted(0);
+static atomic<uint64_t> g_queries(0);
+static atomic<uint64_t> g_injected(0);
+static atomic<uint64_t> g_dropped(0);
+static atomic<uint64_t> g_rejected(0);
+static volatile sig_atomic_t g_stop = 0;
+
+/****************************** user表 ******************************/
+
+struct user_row
+{
+    string name;
+    string password;
+};
+
+class user_table
+{
+public:
+    user_table()
+    {
+        memset(m_chunks, 0, sizeof(m_chunks));
+        m_count = 0;
+    }
+
+    //整条语句的行要么全部插入要么都不插入，成功时first_id为第一行的id
+    bool insert(const vector<user_row> &rows, bool unique, uint64_t &first_id, string &duplicate)
+    {
+        m_lock.lock();
+        if (unique)
+        {
+            for (size_t i = 0; i < rows.size(); ++i)
+            {
+                bool repeated = false;
+                for (size_t j = 0; j < i && !repeated; ++j)
+                    repeated = rows[j].name == rows[i].name;
+                if (repeated || m_index.count(rows[i].name))
+                {
+                    duplicate = rows[i].name;
+                    m_lock.unlock();
+                    return false;
+                }
+            }
+        }
+        if (m_count + rows.size() > (uint64_t)ROW_CHUNK * MAX_CHUNKS)
+        {
+            m_lock.unlock();
+            return false;
+        }
+        first_id = m_count + 1;
+        for (size_t i = 0; i < rows.size(); ++i)
+        {
+            uint64_t index = m_count;
+            if (!m_chunks[index / ROW_CHUNK])
+                m_chunks[index / ROW_CHUNK] = new user_row[ROW_CHUNK];
+            m_chunks[index / ROW_CHUNK][index % ROW_CHUNK] = rows[i];
+            m_index.insert(make_pair(rows[i].name, index + 1));
+            ++m_count;
+        }
+        m_lock.unlock();
+        return true;
+    }
+
+    void find(const string &name, vector<uint64_t> &ids)
+    {
+        m_lock.lock();
+        pair<unordered_multimap<string, uint64_t>::iterator, unordered_multimap<string, uint64_t>::iterator> range =
+            m_index.equal_range(name);
+        for (; range.first != range.second; ++range.first)
+            ids.push_back(range.first->second);
+        m_lock.unlock();
+        sort(ids.begin(), ids.end());
+    }
+
+    uint64_t count()
+    {
+        m_lock.lock();
+        uint64_t n = m_count;
+        m_lock.unlock();
+        return n;
+    }
+
+    //id从1开始，不超过之前count()返回的值时不用加锁
+    const user_row &row(uint64_t id) { return m_chunks[(id - 1) / ROW_CHUNK][(id - 1) % ROW_CHUNK]; }
+
+private:
+    locker m_lock;
+    user_row *m_chunks[MAX_CHUNKS];
+    uint64_t m_count;
+    unordered_multimap<string, uint64_t> m_index;
+};
+
+static user_table g_table;
+
+/****************************** SQL解析 ******************************/
+
+enum token_type
+{
+    TK_WORD,
+    TK_STRING,
+    TK_NUMBER,
+    TK_PARAM,
+    TK_SYMBOL,
+    TK_END
+};
+
+struct token
+{
+    token_type type;
+    string text; //TK_WORD已转为小写，TK_STRING已去掉引号和转义
+};
+
+static bool tokenize(const string &sql, vector<token> &tokens)
+{
+    size_t i = 0, n = sql.size();
+    while (i < n)
+    {
+        unsigned char c = sql[i];
+        token tk;
+        if (isspace(c))
+        {
+            ++i;
+            continue;
+        }
+        if (isalpha(c) || '_' == c || '`' == c)
+        {
+            bool quoted = '`' == c;
+            size_t begin = quoted ? ++i : i;
+            while (i < n && (quoted ? '`' != sql[i] : (isalnum((unsigned char)sql[i]) || '_' == sql[i] || '.' == sql[i])))
+                ++i;
+            tk.type = TK_WORD;
+            for (size_t j = begin; j < i; ++j)
+                tk.text += tolower((unsigned char)sql[j]);
+            if (quoted && i++ >= n)
+                return false;
+        }
+        else if (isdigit(c))
+        {
+            size_t begin = i;
+            while (i < n && (isdigit((unsigned char)sql[i]) || '.' == sql[i]))
+                ++i;
+            tk.type = TK_NUMBER;
+            tk.text = sql.substr(begin, i - begin);
+        }
+        else if ('\'' == c || '"' == c)
+        {
+            //mysql_real_escape_string生成的反斜杠转义以及''形式的引号
+            tk.type = TK_STRING;
+            ++i;
+            while (true)
+            {
+                if (i >= n)
+                    return false;
+                char ch = sql[i++];
+                if ('\\' == ch && i < n)
+                {
+                    char e = sql[i++];
+                    switch (e)
+                    {
+                    case '0': tk.text += '\0'; break;
+                    case 'n': tk.text += '\n'; break;
+                    case 'r': tk.text += '\r'; break;
+                    case 't': tk.text += '\t'; break;
+                    case 'Z': tk.text += '\032'; break;
+                    default: tk.text += e; break;
+                    }
+                }
+                else if (ch == (char)c)
+                {
+                    if (i < n && sql[i] == (char)c)
+                    {
+                        tk.text += ch;
+                        ++i;
+                    }
+                    else
+                        break;
+                }
+                else
+                    tk.text += ch;
+            }
+        }
+        else if ('?' == c)
+        {
+            tk.type = TK_PARAM;
+            ++i;
+        }
+        else
+        {
+            tk.type = TK_SYMBOL;
+            tk.text = sql.substr(i++, 1);
+            if (i < n && ('<' == c || '>' == c || '!' == c) && '=' == sql[i])
+                tk.text += sql[i++];
+        }
+        tokens.push_back(tk);
+    }
+    token end;
+    end.type = TK_END;
+    tokens.push_back(end);
+    return true;
+}
+
+enum
+{
+    COL_ID,
+    COL_NAME,
+    COL_PASS,
+    COL_COUNT
+};
+
+enum
+{
+    ST_SELECT,
+    ST_INSERT,
+    ST_OK
+};
+
+//语句中的值：字面量，或第param个'?'
+struct sql_value
+{
+    int param;
+    string text;
+};
+
+struct statement
+{
+    int kind;
+    vector<int> columns;
+    int where_col; //-1为没有WHERE
+    string where_op;
+    sql_value where_value;
+    uint64_t limit;
+    vector<int> insert_cols;
+    vector<vector<sql_value> > rows;
+    int params;
+    vector<uint16_t> param_types; //预处理语句最近一次绑定的参数类型
+};
+
+struct sql_error
+{
+    unsigned int code;
+    string message;
+};
+
+class sql_parser
+{
+public:
+    sql_parser(const vector<token> &tokens, statement &st) : m_tokens(tokens), m_pos(0), m_st(st) {}
+
+    bool parse(sql_error &err)
+    {
+        m_st.where_col = -1;
+        m_st.limit = UINT64_MAX;
+        m_st.params = 0;
+        bool ok;
+        if (accept_word("select"))
+            ok = parse_select();
+        else if (accept_word("insert"))
+            ok = parse_insert();
+        else if (is_word("set") || is_word("begin") || is_word("commit") || is_word("rollback") ||
+                 is_word("start") || is_word("use"))
+        {
+            m_st.kind = ST_OK;
+            return true;
+        }
+        else
+            ok = false;
+        if (ok)
+        {
+            accept_symbol(";");
+            ok = TK_END == peek().type;
+        }
+        if (!ok && !m_error.code)
+            syntax_error();
+        err = m_error;
+        return ok;
+    }
+
+private:
+    const token &peek() { return m_tokens[m_pos]; }
+    bool is_word(const char *word) { return TK_WORD == peek().type && peek().text == word; }
+    bool accept_word(const char *word)
+    {
+        if (!is_word(word))
+            return false;
+        ++m_pos;
+        return true;
+    }
+    bool accept_symbol(const char *symbol)
+    {
+        if (TK_SYMBOL != peek().type || peek().text != symbol)
+            return false;
+        ++m_pos;
+        return true;
+    }
+
+    void syntax_error()
+    {
+        m_error.code = 1064;
+        m_error.message = "You have an error in your SQL syntax near '" +
+                          (TK_END == peek().type ? string("") : peek().text) + "'";
+    }
+
+    bool parse_column(int &column)
+    {
+        if (TK_WORD != peek().type)
+            return false;
+        const string &name = peek().text;
+        if ("id" == name || "user.id" == name)
+            column = COL_ID;
+        else if ("username" == name || "user.username" == name)
+            column = COL_NAME;
+        else if ("passwd" == name || "user.passwd" == name)
+            column = COL_PASS;
+        else
+        {
+            m_error.code = 1054;
+            m_error.message = "Unknown column '" + name + "' in 'field list'";
+            return false;
+        }
+        ++m_pos;
+        return true;
+    }
+
+    bool parse_table()
+    {
+        if (TK_WORD != peek().type)
+            return false;
+        string name = peek().text;
+        size_t dot = name.rfind('.');
+        if ("user" != (string::npos == dot ? name : name.substr(dot + 1)))
+        {
+            m_error.code = 1146;
+            m_error.message = "Table '" + name + "' doesn't exist";
+            return false;
+        }
+        ++m_pos;
+        return true;
+    }
+
+    bool parse_value(sql_value &value)
+    {
+        value.param = -1;
+        if (TK_PARAM == peek().type)
+            value.param = m_st.params++;
+        else if (TK_STRING == peek().type || TK_NUMBER == peek().type)
+            value.text = peek().text;
+        else if (is_word("null"))
+            value.text.clear();
+        else
+            return false;
+        ++m_pos;
+        return true;
+    }
+
+    bool parse_select()
+    {
+        m_st.kind = ST_SELECT;
+        do
+        {
+            int column;
+            if (accept_symbol("*"))
+            {
+                m_st.columns.push_back(COL_ID);
+                m_st.columns.push_back(COL_NAME);
+                m_st.columns.push_back(COL_PASS);
+            }
+            else if (accept_word("count"))
+            {
+                if (!accept_symbol("(") || !(accept_symbol("*") || parse_column(column)) || !accept_symbol(")"))
+                    return false;
+                m_st.columns.push_back(COL_COUNT);
+            }
+            else if (parse_column(column))
+                m_st.columns.push_back(column);
+            else
+                return false;
+        } while (accept_symbol(","));
+
+        //COUNT(*)之外还有普通列需要GROUP BY，不支持
+        for (size_t i = 0; i < m_st.columns.size(); ++i)
+        {
+            if (COL_COUNT == m_st.columns[i] && m_st.columns.size() > 1)
+            {
+                m_error.code = 1140;
+                m_error.message = "Mixing of GROUP columns with no GROUP columns is illegal";
+                return false;
+            }
+        }
+
+        if (!accept_word("from") || !parse_table())
+            return false;
+        if (accept_word("where"))
+        {
+            if (!parse_column(m_st.where_col) || TK_SYMBOL != peek().type)
+                return false;
+            m_st.where_op = peek().text;
+            if ("=" != m_st.where_op && ">" != m_st.where_op && "<" != m_st.where_op && ">=" != m_st.where_op &&
+                "<=" != m_st.where_op)
+                return false;
+            ++m_pos;
+            if (!parse_value(m_st.where_value))
+                return false;
+        }
+        if (accept_word("order"))
+        {
+            int column;
+            if (!accept_word("by") || !parse_column(column) || COL_ID != column)
+                return false;
+            accept_word("asc");
+        }
+        if (accept_word("limit"))
+        {
+            if (TK_NUMBER != peek().type)
+                return false;
+            m_st.limit = strtoull(peek().text.c_str(), NULL, 10);
+            ++m_pos;
+        }
+        return true;
+    }
+
+    bool parse_insert()
+    {
+        m_st.kind = ST_INSERT;
+        if (!accept_word("into") || !parse_table() || !accept_symbol("("))
+            return false;
+        do
+        {
+            int column;
+            if (!parse_column(column))
+                return false;
+            m_st.insert_cols.push_back(column);
+        } while (accept_symbol(","));
+        if (!accept_symbol(")") || !(accept_word("values") || accept_word("value")))
+            return false;
+        do
+        {
+            if (!accept_symbol("("))
+                return false;
+            vector<sql_value> row;
+            do
+            {
+                sql_value value;
+                if (!parse_value(value))
+                    return false;
+                row.push_back(value);
+            } while (accept_symbol(","));
+            if (!accept_symbol(")"))
+                return false;
+            if (row.size() != m_st.insert_cols.size())
+            {
+                m_error.code = 1136;
+                m_error.message = "Column count doesn't match value count at row 1";
+                return false;
+            }
+            m_st.rows.push_back(row);
+        } while (accept_symbol(","));
+        return true;
+    }
+
+private:
+    const vector<token> &m_tokens;
+    size_t m_pos;
+    statement &m_st;
+    sql_error m_error = {0, ""};
+};
+
+static bool parse_sql(const string &sql, statement &st, sql_error &err)
+{
+    vector<token> tokens;
+    if (!tokenize(sql, tokens))
+    {
+        err.code = 1064;
+        err.message = "You have an error in your SQL syntax: unterminated literal";
+        return false;
+    }
+    sql_parser parser(tokens, st);
+    return parser.parse(err);
+}
+
+/****************************** 协议编码 ******************************/
+
+static void put_int(string &out, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; ++i)
+        out += (char)((value >> (8 * i)) & 0xff);
+}
+
+static void put_lenenc_int(string &out, uint64_t value)
+{
+    if (value < 251)
+        put_int(out, value, 1);
+    else if (value < 0x10000)
+    {
+        out += (char)0xfc;
+        put_int(out, value, 2);
+    }
+    else if (value < 0x1000000)
+    {
+        out += (char)0xfd;
+        put_int(out, value, 3);
+    }
+    else
+    {
+        out += (char)0xfe;
+        put_int(out, value, 8);
+    }
+}
+
+static void put_lenenc_str(string &out, const string &value)
+{
+    put_lenenc_int(out, value.size());
+    out += value;
+}
+
+//按协议格式从包中读取，越界后ok置为false，之后读到的都是0或空串
+struct packet_reader
+{
+    const string &data;
+    size_t pos;
+    bool ok;
+
+    packet_reader(const string &d, size_t start) : data(d), pos(start), ok(true) {}
+
+    bool need(size_t n)
+    {
+        if (pos + n > data.size())
+            ok = false;
+        return ok;
+    }
+    uint64_t get_int(int bytes)
+    {
+        uint64_t value = 0;
+        if (!need(bytes))
+            return 0;
+        for (int i = 0; i < bytes; ++i)
+            value |= (uint64_t)(unsigned char)data[pos + i] << (8 * i);
+        pos += bytes;
+        return value;
+    }
+    uint64_t get_lenenc_int()
+    {
+        uint64_t first = get_int(1);
+        if (first < 0xfb)
+            return first;
+        if (0xfc == first)
+            return get_int(2);
+        if (0xfd == first)
+            return get_int(3);
+        if (0xfe == first)
+            return get_int(8);
+        ok = false;
+        return 0;
+    }
+    string get_bytes(size_t n)
+    {
+        if (!need(n))
+            return "";
+        string value = data.substr(pos, n);
+        pos += n;
+        return value;
+    }
+    string get_lenenc_str() { return get_bytes(get_lenenc_int()); }
+    string get_nul_str()
+    {
+        size_t end = data.find('\0', pos);
+        if (string::npos == end)
+        {
+            ok = false;
+            return "";
+        }
+        string value = data.substr(pos, end - pos);
+        pos = end + 1;
+        return value;
+    }
+};
+
+struct error_info
+{
+    unsigned int code;
+    const char *state;
+    const char *message;
+};
+
+//注入错误和协议错误的SQLSTATE与默认消息，其他错误码用HY000
+static const error_info g_errors[] = {
+    {1040, "08004", "Too many connections"},
+    {1043, "08S01", "Bad handshake"},
+    {1047, "08S01", "Unknown command"},
+    {1054, "42S22", "Unknown column"},
+    {1062, "23000", "Duplicate entry"},
+    {1064, "42000", "You have an error in your SQL syntax"},
+    {1136, "21S01", "Column count doesn't match value count"},
+    {1140, "42000", "Mixing of GROUP columns with no GROUP columns is illegal"},
+    {1146, "42S02", "Table doesn't exist"},
+    {1251, "08004", "Client does not support authentication protocol requested by server"},
+    {1205, "HY000", "Lock wait timeout exceeded; try restarting transaction"},
+    {1213, "40001", "Deadlock found when trying to get lock; try restarting transaction"},
+    {1243, "HY000", "Unknown prepared statement handler given to mysqld_stmt_execute"},
+    {1210, "HY000", "Incorrect arguments to mysqld_stmt_execute"},
+    {1290, "HY000", "The MySQL server is running with the --read-only option so it cannot execute this statement"},
+    {1317, "70100", "Query execution was interrupted"}};
+
+static const error_info &find_error(unsigned int code)
+{
+    static const error_info generic = {0, "HY000", "Injected error"};
+    for (size_t i = 0; i < sizeof(g_errors) / sizeof(g_errors[0]); ++i)
+    {
+        if (g_errors[i].code == code)
+            return g_errors[i];
+    }
+    return generic;
+}
+
+//列定义(Protocol::ColumnDefinition41)
+static string column_def(int column, const string &db)
+{
+    static const char *names[] = {"id", "username", "passwd", "COUNT(*)"};
+    string out;
+    bool number = COL_ID == column || COL_COUNT == column;
+    put_lenenc_str(out, "def");
+    put_lenenc_str(out, COL_COUNT == column ? "" : db);
+    put_lenenc_str(out, COL_COUNT == column ? "" : "user");
+    put_lenenc_str(out, COL_COUNT == column ? "" : "user");
+    put_lenenc_str(out, names[column]);
+    put_lenenc_str(out, COL_COUNT == column ? "" : names[column]);
+    out += (char)0x0c;
+    put_int(out, number ? 63 : 255, 2); //binary / utf8mb4
+    put_int(out, number ? 20 : 200, 4);
+    out += (char)(number ? TYPE_LONGLONG : TYPE_VAR_STRING);
+    //NOT_NULL | PRI_KEY | UNSIGNED | BINARY | AUTO_INCREMENT
+    put_int(out, COL_ID == column ? 0x2a3 : (COL_COUNT == column ? 0x81 : 0), 2);
+    out += (char)0;
+    put_int(out, 0, 2);
+    return out;
+}
+
+//预处理语句参数的列定义
+static string param_def()
+{
+    string out;
+    put_lenenc_str(out, "def");
+    for (int i = 0; i < 3; ++i)
+        put_lenenc_str(out, "");
+    put_lenenc_str(out, "?");
+    put_lenenc_str(out, "");
+    out += (char)0x0c;
+    put_int(out, 63, 2);
+    put_int(out, 0, 4);
+    out += (char)TYPE_VAR_STRING;
+    put_int(out, 0x80, 2);
+    out += (char)0;
+    put_int(out, 0, 2);
+    return out;
+}
+
+static unsigned int random_uint()
+{
+    static __thread unsigned int seed = 0;
+    if (!seed)
+        seed = (unsigned int)time(NULL) ^ (unsigned int)(uintptr_t)&seed;
+    return rand_r(&seed);
+}
+
+static bool chance(double rate)
+{
+    return rate > 0 && random_uint() / ((double)RAND_MAX + 1) < rate;
+}
+
+static void sleep_ms(int ms)
+{
+    if (ms > 0)
+        usleep(ms * 1000);
+}
+
+/****************************** 连接 ******************************/
+
+class fake_conn
+{
+public:
+    fake_conn(int fd, uint32_t id) : m_fd(fd), m_id(id), m_seq(0), m_next_stmt(1) {}
+    ~fake_conn() { close(m_fd); }
+
+    void run()
+    {
+        if (g_connections.fetch_add(1) >= g_config.max_conn)
+        {
+            ++g_rejected;
+            m_seq = 0;
+            send_error(1040, "", false);
+            flush();
+        }
+        else if (handshake())
+        {
+            string packet;
+            while (!g_stop && read_packet(packet) && command(packet))
+                flush();
+        }
+        --g_connections;
+    }
+
+private:
+    bool read_full(char *buf, size_t len)
+    {
+        while (len > 0)
+        {
+            ssize_t n = recv(m_fd, buf, len, 0);
+            if (n < 0 && EINTR == errno)
+                continue;
+            if (n <= 0)
+                return false;
+            buf += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    //读取一个完整的包，长度为0xffffff时拼接后续分片
+    bool read_packet(string &payload)
+    {
+        payload.clear();
+        while (true)
+        {
+            unsigned char header[4];
+            if (!read_full((char *)header, 4))
+                return false;
+            size_t len = header[0] | (header[1] << 8) | (header[2] << 16);
+            m_seq = header[3] + 1;
+            size_t old = payload.size();
+            payload.resize(old + len);
+            if (len && !read_full(&payload[old], len))
+                return false;
+            if (len < 0xffffff)
+                return true;
+        }
+    }
+
+    void send_packet(const string &payload)
+    {
+        size_t pos = 0;
+        while (true)
+        {
+            size_t len = payload.size() - pos < 0xffffff ? payload.size() - pos : 0xffffff;
+            put_int(m_out, len, 3);
+            m_out += (char)m_seq++;
+            m_out.append(payload, pos, len);
+            pos += len;
+            if (len < 0xffffff)
+                break;
+        }
+        if (m_out.size() >= FLUSH_SIZE)
+            flush();
+    }
+
+    bool flush()
+    {
+        size_t sent = 0;
+        while (sent < m_out.size())
+        {
+            ssize_t n = send(m_fd, m_out.data() + sent, m_out.size() - sent, MSG_NOSIGNAL);
+            if (n < 0 && EINTR == errno)
+                continue;
+            if (n <= 0)
+            {
+                m_out.clear();
+                return false;
+            }
+            sent += n;
+        }
+        m_out.clear();
+        return true;
+    }
+
+    void send_ok(uint64_t affected = 0, uint64_t insert_id = 0)
+    {
+        string out(1, '\0');
+        put_lenenc_int(out, affected);
+        put_lenenc_int(out, insert_id);
+        put_int(out, SERVER_STATUS_AUTOCOMMIT, 2);
+        put_int(out, 0, 2);
+        send_packet(out);
+    }
+
+    void send_eof()
+    {
+        string out(1, (char)0xfe);
+        put_int(out, 0, 2);
+        put_int(out, SERVER_STATUS_AUTOCOMMIT, 2);
+        send_packet(out);
+    }
+
+    //握手之前客户端还未协商4.1协议，错误包不带SQLSTATE
+    void send_error(unsigned int code, const string &message, bool with_state = true)
+    {
+        const error_info &info = find_error(code);
+        string out(1, (char)0xff);
+        put_int(out, code, 2);
+        if (with_state)
+        {
+            out += '#';
+            out += info.state;
+        }
+        out += message.empty() ? info.message : message;
+        send_packet(out);
+    }
+
+    bool handshake()
+    {
+        sleep_ms(g_config.connect_ms);
+
+        char scramble[SCRAMBLE_LEN];
+        for (int i = 0; i < SCRAMBLE_LEN; ++i)
+            scramble[i] = 1 + random_uint() % 127;
+
+        //Protocol::HandshakeV10
+        string out(1, (char)10);
+        out += "8.0.36-fake_mysql";
+        out += '\0';
+        put_int(out, m_id, 4);
+        out.append(scramble, 8);
+        out += '\0';
+        put_int(out, SERVER_CAPS & 0xffff, 2);
+        out += (char)255;
+        put_int(out, SERVER_STATUS_AUTOCOMMIT, 2);
+        put_int(out, SERVER_CAPS >> 16, 2);
+        out += (char)(SCRAMBLE_LEN + 1);
+        out.append(10, '\0');
+        out.append(scramble + 8, SCRAMBLE_LEN - 8);
+        out += '\0';
+        out += AUTH_PLUGIN;
+        out += '\0';
+        m_seq = 0;
+        send_packet(out);
+        if (!flush())
+            return false;
+
+        //Protocol::HandshakeResponse41
+        string packet;
+        if (!read_packet(packet))
+            return false;
+        packet_reader reader(packet, 0);
+        uint32_t caps = reader.get_int(4);
+        if (!(caps & CLIENT_PROTOCOL_41))
+        {
+            send_error(1251, "Client does not support authentication protocol requested by server");
+            flush();
+            return false;
+        }
+        reader.get_int(4 + 1);
+        reader.get_bytes(23);
+        string user = reader.get_nul_str();
+        string auth;
+        if (caps & CLIENT_PLUGIN_AUTH_LENENC)
+            auth = reader.get_lenenc_str();
+        else if (caps & CLIENT_SECURE_CONNECTION)
+            auth = reader.get_bytes(reader.get_int(1));
+        else
+            auth = reader.get_nul_str();
+        if (caps & CLIENT_CONNECT_WITH_DB)
+            m_db = reader.get_nul_str();
+        string plugin = (caps & CLIENT_PLUGIN_AUTH) ? reader.get_nul_str() : "";
+        if (!reader.ok)
+        {
+            send_error(1043, "Bad handshake");
+            flush();
+            return false;
+        }
+
+        //接受任意密码：caching_sha2_password按缓存命中的快速认证应答，其他插件直接OK；空密码时客户端只发一个0字节
+        if (AUTH_PLUGIN == plugin && !auth.empty() && string(1, '\0') != auth)
+            send_packet(string("\x01\x03", 2));
+        send_ok();
+        if (g_config.verbose)
+            printf("[%u] connect user=%s db=%s plugin=%s\n", m_id, user.c_str(), m_db.c_str(), plugin.c_str());
+        return flush();
+    }
+
+    //返回false时断开连接
+    bool command(const string &packet)
+    {
+        if (packet.empty())
+            return false;
+        switch ((unsigned char)packet[0])
+        {
+        case COM_QUIT:
+            return false;
+        case COM_INIT_DB:
+            m_db = packet.substr(1);
+            send_ok();
+            return true;
+        case COM_PING:
+        case COM_STMT_RESET:
+            send_ok();
+            return true;
+        case COM_RESET_CONNECTION:
+            m_stmts.clear();
+            send_ok();
+            return true;
+        case COM_SET_OPTION:
+            send_eof();
+            return true;
+        case COM_QUERY:
+            return query(packet.substr(1));
+        case COM_STMT_PREPARE:
+            prepare(packet.substr(1));
+            return true;
+        case COM_STMT_EXECUTE:
+            return execute(packet);
+        case COM_STMT_CLOSE:
+        {
+            packet_reader reader(packet, 1);
+            m_stmts.erase(reader.get_int(4));
+            return true;
+        }
+        default:
+            send_error(1047, "");
+            return true;
+        }
+    }
+
+    //执行前的延迟和错误注入，返回false时不应答直接断开
+    bool inject(const statement &st, bool &failed)
+    {
+        ++g_queries;
+        int delay = g_config.latency_ms;
+        if (g_config.jitter_ms > 0)
+            delay += random_uint() % g_config.jitter_ms;
+        if (ST_INSERT == st.kind)
+            delay += g_config.write_ms;
+        sleep_ms(delay);
+
+        failed = false;
+        if (chance(g_config.drop_rate))
+        {
+            ++g_dropped;
+            return false;
+        }
+        if (chance(g_config.error_rate))
+        {
+            ++g_injected;
+            send_error(g_config.error_code, "");
+            failed = true;
+        }
+        return true;
+    }
+
+    bool query(const string &sql)
+    {
+        if (g_config.verbose)
+            printf("[%u] query %s\n", m_id, sql.c_str());
+        statement st;
+        sql_error err;
+        if (!parse_sql(sql, st, err))
+        {
+            send_error(err.code, err.message);
+            return true;
+        }
+        if (st.params)
+        {
+            send_error(1064, "You have an error in your SQL syntax near '?'");
+            return true;
+        }
+        bool failed;
+        if (!inject(st, failed))
+            return false;
+        if (!failed)
+            run(st, vector<string>(), false);
+        return true;
+    }
+
+    void prepare(const string &sql)
+    {
+        if (g_config.verbose)
+            printf("[%u] prepare %s\n", m_id, sql.c_str());
+        statement st;
+        sql_error err;
+        if (!parse_sql(sql, st, err))
+        {
+            send_error(err.code, err.message);
+            return;
+        }
+        uint32_t id = m_next_stmt++;
+        int columns = ST_SELECT == st.kind ? st.columns.size() : 0;
+
+        //COM_STMT_PREPARE_OK，随后是参数和列的定义
+        string out(1, '\0');
+        put_int(out, id, 4);
+        put_int(out, columns, 2);
+        put_int(out, st.params, 2);
+        out += '\0';
+        put_int(out, 0, 2);
+        send_packet(out);
+        for (int i = 0; i < st.params; ++i)
+            send_packet(param_def());
+        if (st.params)
+            send_eof();
+        for (int i = 0; i < columns; ++i)
+            send_packet(column_def(st.columns[i], m_db));
+        if (columns)
+            send_eof();
+        st.param_types.assign(st.params, TYPE_VAR_STRING);
+        m_stmts[id] = st;
+    }
+
+    //按类型解出二进制协议中的一个参数，转为文本
+    static bool decode_param(packet_reader &reader, uint16_t type, string &value)
+    {
+        bool is_unsigned = type & 0x8000;
+        char buf[64];
+        switch (type & 0xff)
+        {
+        case TYPE_NULL:
+            value.clear();
+            return true;
+        case TYPE_TINY:
+        {
+            uint64_t v = reader.get_int(1);
+            snprintf(buf, sizeof(buf), is_unsigned ? "%llu" : "%lld",
+                     is_unsigned ? (unsigned long long)v : (long long)(int8_t)v);
+            break;
+        }
+        case TYPE_SHORT:
+        case TYPE_YEAR:
+        {
+            uint64_t v = reader.get_int(2);
+            snprintf(buf, sizeof(buf), is_unsigned ? "%llu" : "%lld",
+                     is_unsigned ? (unsigned long long)v : (long long)(int16_t)v);
+            break;
+        }
+        case TYPE_LONG:
+        case TYPE_INT24:
+        {
+            uint64_t v = reader.get_int(4);
+            snprintf(buf, sizeof(buf), is_unsigned ? "%llu" : "%lld",
+                     is_unsigned ? (unsigned long long)v : (long long)(int32_t)v);
+            break;
+        }
+        case TYPE_LONGLONG:
+        {
+            uint64_t v = reader.get_int(8);
+            snprintf(buf, sizeof(buf), is_unsigned ? "%llu" : "%lld",
+                     is_unsigned ? (unsigned long long)v : (long long)v);
+            break;
+        }
+        case TYPE_FLOAT:
+        {
+            uint32_t bits = reader.get_int(4);
+            float v;
+            memcpy(&v, &bits, sizeof(v));
+            snprintf(buf, sizeof(buf), "%.9g", v);
+            break;
+        }
+        case TYPE_DOUBLE:
+        {
+            uint64_t bits = reader.get_int(8);
+            double v;
+            memcpy(&v, &bits, sizeof(v));
+            snprintf(buf, sizeof(buf), "%.17g", v);
+            break;
+        }
+        //日期时间类型用不到
+        case 0x07:
+        case 0x0a:
+        case 0x0b:
+        case 0x0c:
+            return false;
+        default:
+            value = reader.get_lenenc_str();
+            return reader.ok;
+        }
+        value = buf;
+        return reader.ok;
+    }
+
+    bool execute(const string &packet)
+    {
+        packet_reader reader(packet, 1);
+        uint32_t id = reader.get_int(4);
+        reader.get_int(1 + 4); //flags, iteration_count
+        map<uint32_t, statement>::iterator it = m_stmts.find(id);
+        if (m_stmts.end() == it)
+        {
+            char message[128];
+            snprintf(message, sizeof(message), "Unknown prepared statement handler (%u) given to mysqld_stmt_execute", id);
+            send_error(1243, message);
+            return true;
+        }
+        statement &st = it->second;
+
+        vector<string> params(st.params);
+        if (st.params)
+        {
+            string nulls = reader.get_bytes((st.params + 7) / 8);
+            if (reader.get_int(1))
+            {
+                for (int i = 0; i < st.params; ++i)
+                    st.param_types[i] = reader.get_int(2);
+            }
+            for (int i = 0; i < st.params && reader.ok; ++i)
+            {
+                if (nulls.size() == (size_t)(st.params + 7) / 8 && (nulls[i / 8] >> (i % 8)) & 1)
+                    continue;
+                if (!decode_param(reader, st.param_types[i], params[i]))
+                {
+                    send_error(1210, "");
+                    return true;
+                }
+            }
+            if (!reader.ok)
+            {
+                send_error(1210, "");
+                return true;
+            }
+        }
+        if (g_config.verbose)
+        {
+            printf("[%u] execute %u", m_id, id);
+            for (size_t i = 0; i < params.size(); ++i)
+                printf(" '%s'", params[i].c_str());
+            printf("\n");
+        }
+
+        bool failed;
+        if (!inject(st, failed))
+            return false;
+        if (!failed)
+            run(st, params, true);
+        return true;
+    }
+
+    static const string &resolve(const sql_value &value, const vector<string> &params)
+    {
+        return value.param >= 0 ? params[value.param] : value.text;
+    }
+
+    void run(const statement &st, const vector<string> &params, bool binary)
+    {
+        if (ST_OK == st.kind)
+            send_ok();
+        else if (ST_INSERT == st.kind)
+            run_insert(st, params);
+        else
+            run_select(st, params, binary);
+    }
+
+    void run_insert(const statement &st, const vector<string> &params)
+    {
+        vector<user_row> rows(st.rows.size());
+        for (size_t i = 0; i < st.rows.size(); ++i)
+        {
+            for (size_t j = 0; j < st.insert_cols.size(); ++j)
+            {
+                if (COL_NAME == st.insert_cols[j])
+                    rows[i].name = resolve(st.rows[i][j], params);
+                else if (COL_PASS == st.insert_cols[j])
+                    rows[i].password = resolve(st.rows[i][j], params);
+            }
+        }
+        uint64_t first_id = 0;
+        string duplicate;
+        if (!g_table.insert(rows, g_config.unique, first_id, duplicate))
+        {
+            if (duplicate.empty())
+                send_error(1114, "The table 'user' is full");
+            else
+                send_error(1062, "Duplicate entry '" + duplicate + "' for key 'user.username'");
+            return;
+        }
+        send_ok(rows.size(), first_id);
+    }
+
+    static bool compare(int cmp, const string &op)
+    {
+        if ("=" == op)
+            return 0 == cmp;
+        if (">" == op)
+            return cmp > 0;
+        if ("<" == op)
+            return cmp < 0;
+        if (">=" == op)
+            return cmp >= 0;
+        return cmp <= 0;
+    }
+
+    static bool match(const statement &st, uint64_t id, const user_row &row, const string &value)
+    {
+        if (st.where_col < 0)
+            return true;
+        if (COL_ID == st.where_col)
+        {
+            uint64_t v = strtoull(value.c_str(), NULL, 10);
+            return compare(id < v ? -1 : (id > v ? 1 : 0), st.where_op);
+        }
+        const string &field = COL_NAME == st.where_col ? row.name : row.password;
+        return compare(field.compare(value), st.where_op);
+    }
+
+    static void add_value(string &out, int column, uint64_t id, const user_row *row, uint64_t count, bool binary)
+    {
+        char buf[32];
+        if (COL_ID == column || COL_COUNT == column)
+        {
+            uint64_t v = COL_ID == column ? id : count;
+            if (binary)
+                put_int(out, v, 8);
+            else
+            {
+                snprintf(buf, sizeof(buf), "%llu", (unsigned long long)v);
+                put_lenenc_str(out, buf);
+            }
+            return;
+        }
+        put_lenenc_str(out, COL_NAME == column ? row->name : row->password);
+    }
+
+    void send_row(const statement &st, uint64_t id, const user_row *row, uint64_t count, bool binary)
+    {
+        string out;
+        if (binary)
+        {
+            //ProtocolBinary::ResultsetRow：0x00、偏移2位的NULL位图、各列的值
+            out += '\0';
+            out.append((st.columns.size() + 7 + 2) / 8, '\0');
+        }
+        for (size_t i = 0; i < st.columns.size(); ++i)
+            add_value(out, st.columns[i], id, row, count, binary);
+        send_packet(out);
+    }
+
+    void run_select(const statement &st, const vector<string> &params, bool binary)
+    {
+        string value = st.where_col >= 0 ? resolve(st.where_value, params) : "";
+
+        //按用户名等值查询走索引，按id比较时缩小扫描范围，其余逐行比较
+        vector<uint64_t> ids;
+        bool indexed = COL_NAME == st.where_col && "=" == st.where_op;
+        uint64_t lo = 1, hi = g_table.count();
+        if (indexed)
+            g_table.find(value, ids);
+        else if (COL_ID == st.where_col)
+        {
+            uint64_t v = strtoull(value.c_str(), NULL, 10);
+            if ("=" == st.where_op || ">=" == st.where_op)
+                lo = v > lo ? v : lo;
+            else if (">" == st.where_op)
+                lo = v + 1 > lo ? v + 1 : lo;
+            if (("=" == st.where_op || "<=" == st.where_op) && v < hi)
+                hi = v;
+            else if ("<" == st.where_op && v <= hi)
+                hi = v ? v - 1 : 0;
+        }
+
+        string out;
+        put_lenenc_int(out, st.columns.size());
+        send_packet(out);
+        for (size_t i = 0; i < st.columns.size(); ++i)
+            send_packet(column_def(st.columns[i], m_db));
+        send_eof();
+
+        if (COL_COUNT == st.columns[0])
+        {
+            uint64_t count = 0;
+            if (indexed)
+                count = ids.size();
+            else if (COL_ID == st.where_col)
+                count = hi >= lo ? hi - lo + 1 : 0;
+            else
+            {
+                for (uint64_t id = lo; id <= hi; ++id)
+                    count += match(st, id, g_table.row(id), value);
+            }
+            if (st.limit)
+                send_row(st, 0, NULL, count, binary);
+        }
+        else if (indexed)
+        {
+            for (size_t i = 0; i < ids.size() && i < st.limit; ++i)
+                send_row(st, ids[i], &g_table.row(ids[i]), 0, binary);
+        }
+        else
+        {
+            uint64_t sent = 0;
+            for (uint64_t id = lo; id <= hi && sent < st.limit; ++id)
+            {
+                const user_row &row = g_table.row(id);
+                if (match(st, id, row, value))
+                {
+                    send_row(st, id, &row, 0, binary);
+                    ++sent;
+                }
+            }
+        }
+        send_eof();
+    }
+
+private:
+    int m_fd;
+    uint32_t m_id;
+    uint8_t m_seq;                     //下一个要发送的包的序号
+    string m_out;
+    string m_db;
+    uint32_t m_next_stmt;
+    map<uint32_t, statement> m_stmts;
+};
+
+/****************************** 监听与主循环 ******************************/
+
+static void *conn_thread(void *arg)
+{
+    fake_conn *conn = (fake_conn *)arg;
+    conn->run();
+    delete conn;
+    return NULL;
+}
+
+static int listen_tcp(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int flag = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(fd, 1024) < 0)
+    {
+        fprintf(stderr, "listen on port %d failed: %s\n", port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int listen_unix(const string &path)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "socket path too long: %s\n", path.c_str());
+        close(fd);
+        return -1;
+    }
+    strcpy(address.sun_path, path.c_str());
+    //上次异常退出留下的套接字文件
+    struct stat st;
+    if (0 == stat(path.c_str(), &st) && S_ISSOCK(st.st_mode))
+        unlink(path.c_str());
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(fd, 1024) < 0)
+    {
+        fprintf(stderr, "listen on %s failed: %s (use -s to choose another path)\n", path.c_str(), strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    g_stop = 1;
+}
+
+static void print_stats(const char *prefix)
+{
+    printf("%sconnections %d (accepted %llu, rejected %llu), queries %llu, injected errors %llu, drops %llu, users %llu\n",
+           prefix, g_connections.load(), (unsigned long long)g_accepted.load(), (unsigned long long)g_rejected.load(),
+           (unsigned long long)g_queries.load(), (unsigned long long)g_injected.load(),
+           (unsigned long long)g_dropped.load(), (unsigned long long)g_table.count());
+    fflush(stdout);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-P port] [-s socket] [-n users] [-U] [-l latency_ms] [-j jitter_ms] [-w write_ms]\n"
+            "          [-c connect_ms] [-e error_rate] [-E error_code] [-k drop_rate] [-m max_conn] [-v]\n"
+            "  -P  TCP port, 0 to disable (default 3306)\n"
+            "  -s  unix socket path, empty to disable (default /var/run/mysqld/mysqld.sock)\n"
+            "  -n  preload users u0/p0 .. u(n-1)/p(n-1)\n"
+            "  -U  reject duplicate usernames with 1062\n"
+            "  -l  latency of every query, -j uniform jitter added on top, -w extra latency of INSERT\n"
+            "  -c  delay before the handshake\n"
+            "  -e  fraction of queries answered with error -E (default 1205)\n"
+            "  -k  fraction of queries dropped by closing the connection\n"
+            "  -m  connections beyond this get 1040 Too many connections\n"
+            "  -v  print every statement\n",
+            name);
+}
+
+int main(int argc, char *argv[])
+{
+    g_config.port = 3306;
+    g_config.socket_path = "/var/run/mysqld/mysqld.sock";
+    g_config.users = 0;
+    g_config.unique = false;
+    g_config.latency_ms = 0;
+    g_config.jitter_ms = 0;
+    g_config.write_ms = 0;
+    g_config.connect_ms = 0;
+    g_config.error_rate = 0;
+    g_config.error_code = 1205;
+    g_config.drop_rate = 0;
+    g_config.max_conn = 151;
+    g_config.verbose = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "P:s:n:Ul:j:w:c:e:E:k:m:vh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'P': g_config.port = atoi(optarg); break;
+        case 's': g_config.socket_path = optarg; break;
+        case 'n': g_config.users = atoi(optarg); break;
+        case 'U': g_config.unique = true; break;
+        case 'l': g_config.latency_ms = atoi(optarg); break;
+        case 'j': g_config.jitter_ms = atoi(optarg); break;
+        case 'w': g_config.write_ms = atoi(optarg); break;
+        case 'c': g_config.connect_ms = atoi(optarg); break;
+        case 'e': g_config.error_rate = atof(optarg); break;
+        case 'E': g_config.error_code = atoi(optarg); break;
+        case 'k': g_config.drop_rate = atof(optarg); break;
+        case 'm': g_config.max_conn = atoi(optarg); break;
+        case 'v': g_config.verbose = true; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    //与initdb.sql一致的初始数据
+    vector<user_row> rows(1);
+    rows[0].name = "root";
+    rows[0].password = "123456";
+    uint64_t first_id;
+    string duplicate;
+    g_table.insert(rows, false, first_id, duplicate);
+    rows.resize(ROW_CHUNK);
+    for (int i = 0; i < g_config.users; i += ROW_CHUNK)
+    {
+        int n = g_config.users - i < ROW_CHUNK ? g_config.users - i : ROW_CHUNK;
+        rows.resize(n);
+        for (int j = 0; j < n; ++j)
+        {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "u%d", i + j);
+            rows[j].name = buf;
+            snprintf(buf, sizeof(buf), "p%d", i + j);
+            rows[j].password = buf;
+        }
+        g_table.insert(rows, false, first_id, duplicate);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    struct pollfd fds[2];
+    int nfds = 0;
+    if (g_config.port > 0)
+    {
+        int fd = listen_tcp(g_config.port);
+        if (fd < 0)
+            return 1;
+        fds[nfds].fd = fd;
+        fds[nfds++].events = POLLIN;
+    }
+    if (!g_config.socket_path.empty())
+    {
+        int fd = listen_unix(g_config.socket_path);
+        if (fd < 0)
+            return 1;
+        fds[nfds].fd = fd;
+        fds[nfds++].events = POLLIN;
+    }
+    if (!nfds)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    printf("fake_mysql: port %d, socket %s, %llu users, latency %d+%dms (write +%dms), error rate %g (%d), drop rate %g\n",
+           g_config.port, g_config.socket_path.c_str(), (unsigned long long)g_table.count(), g_config.latency_ms,
+           g_config.jitter_ms, g_config.write_ms, g_config.error_rate, g_config.error_code, g_config.drop_rate);
+    fflush(stdout);
+
+    //每10秒有新查询时打印一次统计
+    uint32_t next_id = 1;
+    uint64_t reported = 0;
+    time_t report_at = time(NULL) + 10;
+    while (!g_stop)
+    {
+        int n = poll(fds, nfds, 1000);
+        for (int i = 0; n > 0 && i < nfds; ++i)
+        {
+            if (!(fds[i].revents & POLLIN))
+                continue;
+            int connfd = accept(fds[i].fd, NULL, NULL);
+            if (connfd < 0)
+                continue;
+            int flag = 1;
+            setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+            ++g_accepted;
+            pthread_t tid;
+            fake_conn *conn = new fake_conn(connfd, next_id++);
+            if (pthread_create(&tid, NULL, conn_thread, conn) != 0)
+            {
+                delete conn;
+                continue;
+            }
+            pthread_detach(tid);
+        }
+        if (time(NULL) >= report_at)
+        {
+            if (g_queries.load() != reported)
+                print_stats("");
+            reported = g_queries.load();
+            report_at = time(NULL) + 10;
+        }
+    }
+
+    if (!g_config.socket_path.empty())
+        unlink(g_config.socket_path.c_str());
+    print_stats("exit: ");
+    return 0;
+}
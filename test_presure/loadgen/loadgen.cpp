@@ -0,0 +1,861 @@
+/*
+* HTTP压测工具，取代按客户端fork进程、每个请求新建连接的webbench
+* 用法：./loadgen [-t 线程数] [-c 连接数] [-d 秒] [-R 每秒请求数] [-P 流水线深度] [-K] [-m get|login|register]
+*                 [-u 用户数] [-T 超时ms] [-S] http://主机:端口/路径
+* 每个线程一个epoll，负责一部分连接，全部是非阻塞套接字；默认HTTP/1.1长连接，-K时每个请求新建连接
+* -P N：每个连接最多N个请求在途(流水线)，响应按顺序解析
+* 闭环(默认)：连接一有空位就发下一个请求，测的是吞吐上限，延迟从实际发出算起
+* 开环(-R)：总速率平均分给各连接，每个请求有预定的发出时间，由timerfd按纳秒精度唤醒；
+*   服务器变慢时预定时间照常推进，延迟从预定时间而不是实际发出时间算起，排队等待的时间也计入(修正coordinated omission)
+* 请求体：login按u0/p0 ... u(N-1)/p(N-1)随机选用户登录(与fake_mysql -n预置的用户一致，-u 0时用root/123456)，register每次注册新用户
+* 延迟记录在对数线性直方图中(相对误差约0.1%)，各线程结束后合并，输出p50/p90/p99/p99.9/p99.99/max，-S时输出完整的百分位分布
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <vector>
+#include <deque>
+
+using namespace std;
+
+const int HIST_SUB_BITS = 10;                     //每个2的幂区间分1024格，相对误差不超过1/1024
+const int HIST_SUB_COUNT = 1 << HIST_SUB_BITS;
+const int HIST_BUCKETS = 40;                      //最大约2^49微秒
+const int HIST_SIZE = HIST_SUB_COUNT * (HIST_BUCKETS + 1);
+const int MAX_EVENTS = 1024;
+const size_t READ_SIZE = 65536;
+
+/****************************** 直方图 ******************************/
+
+//对数线性直方图：小于1024的值每格1，之后每个2的幂区间等分为1024格
+class histogram
+{
+public:
+    histogram() : m_counts(HIST_SIZE, 0), m_total(0), m_max(0), m_sum(0), m_sum_sq(0) {}
+
+    void record(uint64_t value)
+    {
+        ++m_counts[index_of(value)];
+        ++m_total;
+        if (value > m_max)
+            m_max = value;
+        m_sum += value;
+        m_sum_sq += (double)value * value;
+    }
+
+    void merge(const histogram &other)
+    {
+        for (int i = 0; i < HIST_SIZE; ++i)
+            m_counts[i] += other.m_counts[i];
+        m_total += other.m_total;
+        if (other.m_max > m_max)
+            m_max = other.m_max;
+        m_sum += other.m_sum;
+        m_sum_sq += other.m_sum_sq;
+    }
+
+    uint64_t total() const { return m_total; }
+    uint64_t max() const { return m_max; }
+    double mean() const { return m_total ? m_sum / m_total : 0; }
+    double stdev() const
+    {
+        if (m_total < 2)
+            return 0;
+        double mean = m_sum / m_total;
+        double variance = m_sum_sq / m_total - mean * mean;
+        return variance > 0 ? sqrt(variance) : 0;
+    }
+
+    //不小于percent%的样本都不超过返回值，返回值取所在格的上界，不超过实际最大值
+    uint64_t value_at(double percent) const
+    {
+        if (!m_total)
+            return 0;
+        uint64_t target = (uint64_t)ceil(percent / 100 * m_total);
+        if (target < 1)
+            target = 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < HIST_SIZE; ++i)
+        {
+            seen += m_counts[i];
+            if (seen >= target)
+            {
+                uint64_t value = highest_of(i);
+                return value < m_max ? value : m_max;
+            }
+        }
+        return m_max;
+    }
+
+    uint64_t count_at_or_below(uint64_t value) const
+    {
+        uint64_t seen = 0;
+        int last = index_of(value);
+        for (int i = 0; i <= last; ++i)
+            seen += m_counts[i];
+        return seen;
+    }
+
+private:
+    static int index_of(uint64_t value)
+    {
+        if (value < (uint64_t)HIST_SUB_COUNT)
+            return value;
+        int magnitude = 63 - __builtin_clzll(value) - HIST_SUB_BITS + 1;
+        if (magnitude > HIST_BUCKETS)
+            return HIST_SIZE - 1;
+        return magnitude * HIST_SUB_COUNT + (int)((value >> (magnitude - 1)) - HIST_SUB_COUNT);
+    }
+
+    static uint64_t highest_of(int index)
+    {
+        int magnitude = index / HIST_SUB_COUNT;
+        uint64_t sub = index % HIST_SUB_COUNT;
+        if (!magnitude)
+            return sub;
+        return ((sub + HIST_SUB_COUNT + 1) << (magnitude - 1)) - 1;
+    }
+
+private:
+    vector<uint64_t> m_counts;
+    uint64_t m_total;
+    uint64_t m_max;
+    double m_sum;
+    double m_sum_sq;
+};
+
+/****************************** 配置与统计 ******************************/
+
+enum
+{
+    MODE_GET,
+    MODE_LOGIN,
+    MODE_REGISTER
+};
+
+struct bench_config
+{
+    string host;
+    int port;
+    string path;
+    int threads;
+    int connections;
+    int duration;
+    double rate;      //每秒请求数，0为闭环
+    int depth;
+    bool keep_alive;
+    int mode;
+    int users;
+    int timeout_ms;
+    bool spectrum;
+    struct sockaddr_storage address;
+    socklen_t address_len;
+};
+
+static bench_config g_config;
+static volatile sig_atomic_t g_stop = 0;
+
+struct bench_stats
+{
+    uint64_t requests;     //收到完整响应的请求
+    uint64_t bytes;
+    uint64_t connects;
+    uint64_t connect_errors;
+    uint64_t read_errors;  //连接在响应完整之前断开或响应格式错误
+    uint64_t write_errors;
+    uint64_t timeouts;
+    uint64_t status[6];    //按状态码首位统计，下标0为其他
+    histogram latency;     //微秒
+
+    bench_stats() : requests(0), bytes(0), connects(0), connect_errors(0), read_errors(0), write_errors(0), timeouts(0)
+    {
+        memset(status, 0, sizeof(status));
+    }
+};
+
+static int64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/****************************** 连接 ******************************/
+
+enum
+{
+    CONN_IDLE,        //未连接，等待reconnect_at
+    CONN_CONNECTING,
+    CONN_OPEN
+};
+
+struct bench_conn
+{
+    int fd;
+    int state;
+    int64_t reconnect_at;
+    string out;
+    size_t out_pos;
+    string in;
+    size_t in_pos;
+    deque<int64_t> inflight;  //在途请求的起点时间(开环为预定时间)，按发出顺序
+    int64_t next_send;        //开环：下一个请求的预定发出时间
+    int64_t interval;         //开环：本连接相邻请求的间隔
+    uint32_t epoll_events;
+    bool close_after;         //-K或服务器要求关闭，读完在途响应后断开
+    bool started;             //已经连上过一次
+};
+
+class bench_worker
+{
+public:
+    bench_worker(int id, int first, int count) : m_id(id), m_first(first), m_conns(count), m_sequence(0)
+    {
+        m_seed = (unsigned int)now_ns() ^ (id * 2654435761u);
+    }
+
+    bench_stats &stats() { return m_stats; }
+
+    void run(int64_t start, int64_t end)
+    {
+        m_epollfd = epoll_create1(EPOLL_CLOEXEC);
+        m_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.u64 = UINT64_MAX;
+        epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_timerfd, &event);
+
+        for (size_t i = 0; i < m_conns.size(); ++i)
+        {
+            bench_conn &conn = m_conns[i];
+            conn.fd = -1;
+            conn.state = CONN_IDLE;
+            conn.reconnect_at = start;
+            conn.out_pos = 0;
+            conn.in_pos = 0;
+            conn.epoll_events = 0;
+            conn.close_after = false;
+            conn.started = false;
+            if (g_config.rate > 0)
+            {
+                //各连接的相位错开，总体上是均匀的请求流
+                conn.interval = (int64_t)(1e9 * g_config.connections / g_config.rate);
+                conn.next_send = start + conn.interval * (m_first + (int64_t)i) / g_config.connections;
+            }
+        }
+
+        m_start = start;
+        struct epoll_event events[MAX_EVENTS];
+        int64_t checked_at = start;
+        while (!g_stop)
+        {
+            int64_t now = now_ns();
+            if (now >= end)
+                break;
+            //到期的重连和发送，同时算出下一次需要醒来的时间
+            int64_t wake = end;
+            for (size_t i = 0; i < m_conns.size(); ++i)
+            {
+                int64_t due = service(m_conns[i], now);
+                if (due < wake)
+                    wake = due;
+            }
+            if (now - checked_at >= 10000000LL)
+            {
+                check_timeouts(now);
+                checked_at = now;
+            }
+            arm_timer(wake < now + 10000000LL ? wake : now + 10000000LL);
+
+            int n = epoll_wait(m_epollfd, events, MAX_EVENTS, -1);
+            for (int i = 0; i < n; ++i)
+            {
+                if (UINT64_MAX == events[i].data.u64)
+                {
+                    uint64_t expirations;
+                    while (read(m_timerfd, &expirations, sizeof(expirations)) > 0)
+                        ;
+                    continue;
+                }
+                bench_conn &conn = m_conns[events[i].data.u64];
+                if (CONN_CONNECTING == conn.state)
+                    finish_connect(conn);
+                else if (CONN_OPEN == conn.state)
+                {
+                    if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+                        on_readable(conn);
+                    if (CONN_OPEN == conn.state && (events[i].events & EPOLLOUT))
+                        flush(conn);
+                }
+            }
+        }
+
+        for (size_t i = 0; i < m_conns.size(); ++i)
+        {
+            if (m_conns[i].fd >= 0)
+                close(m_conns[i].fd);
+        }
+        close(m_timerfd);
+        close(m_epollfd);
+    }
+
+private:
+    void arm_timer(int64_t at)
+    {
+        struct itimerspec spec;
+        memset(&spec, 0, sizeof(spec));
+        if (at <= 0)
+            at = 1;
+        spec.it_value.tv_sec = at / 1000000000LL;
+        spec.it_value.tv_nsec = at % 1000000000LL;
+        timerfd_settime(m_timerfd, TFD_TIMER_ABSTIME, &spec, NULL);
+    }
+
+    void watch(bench_conn &conn, uint32_t events)
+    {
+        if (conn.epoll_events == events)
+            return;
+        struct epoll_event event;
+        event.events = events;
+        event.data.u64 = &conn - &m_conns[0];
+        epoll_ctl(m_epollfd, conn.epoll_events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, conn.fd, &event);
+        conn.epoll_events = events;
+    }
+
+    //断开连接，在途请求计为错误，稍后重连
+    void drop(bench_conn &conn, uint64_t *counter, int64_t now)
+    {
+        if (counter)
+            *counter += conn.inflight.size();
+        if (conn.fd >= 0)
+            close(conn.fd);
+        conn.fd = -1;
+        conn.state = CONN_IDLE;
+        conn.epoll_events = 0;
+        conn.inflight.clear();
+        conn.out.clear();
+        conn.out_pos = 0;
+        conn.in.clear();
+        conn.in_pos = 0;
+        conn.close_after = false;
+        //出错时等一会儿再连，正常关闭(-K)立即重连
+        conn.reconnect_at = counter ? now + 10000000LL : now;
+    }
+
+    void start_connect(bench_conn &conn)
+    {
+        conn.fd = socket(g_config.address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (conn.fd < 0)
+        {
+            ++m_stats.connect_errors;
+            conn.reconnect_at = now_ns() + 10000000LL;
+            return;
+        }
+        int flag = 1;
+        setsockopt(conn.fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+        ++m_stats.connects;
+        int ret = connect(conn.fd, (struct sockaddr *)&g_config.address, g_config.address_len);
+        if (ret < 0 && EINPROGRESS != errno)
+        {
+            ++m_stats.connect_errors;
+            drop(conn, NULL, now_ns());
+            conn.reconnect_at += 10000000LL;
+            return;
+        }
+        conn.state = CONN_CONNECTING;
+        watch(conn, EPOLLOUT);
+    }
+
+    void finish_connect(bench_conn &conn)
+    {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(conn.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err)
+        {
+            ++m_stats.connect_errors;
+            drop(conn, NULL, now_ns());
+            conn.reconnect_at += 10000000LL;
+            return;
+        }
+        //开环的计划从第一次连上开始，压测开始时建立连接的耗时(如服务器listen队列满时SYN重传)不计入请求延迟；
+        //之后的重连发生在计划之中，期间到期的请求照常计入
+        if (!conn.started && g_config.rate > 0)
+            conn.next_send += now_ns() - m_start;
+        conn.started = true;
+        conn.state = CONN_OPEN;
+        watch(conn, EPOLLIN);
+    }
+
+    void build_request(string &out)
+    {
+        char body[256];
+        const char *target = g_config.path.c_str();
+        int body_len = 0;
+        if (MODE_LOGIN == g_config.mode)
+        {
+            target = "/2CGISQL.cgi";
+            if (g_config.users > 0)
+            {
+                unsigned int k = rand_r(&m_seed) % g_config.users;
+                body_len = snprintf(body, sizeof(body), "user=u%u&password=p%u", k, k);
+            }
+            else
+                body_len = snprintf(body, sizeof(body), "user=root&password=123456");
+        }
+        else if (MODE_REGISTER == g_config.mode)
+        {
+            //进程号、线程号和序号组成的新用户名，多次压测之间也不重复
+            target = "/3CGISQL.cgi";
+            body_len = snprintf(body, sizeof(body), "user=r%dt%dn%llu&password=pw", (int)getpid(), m_id,
+                                (unsigned long long)m_sequence++);
+        }
+
+        char header[512];
+        int header_len;
+        const char *connection = g_config.keep_alive ? "keep-alive" : "close";
+        if (MODE_GET == g_config.mode)
+            header_len = snprintf(header, sizeof(header), "GET %s HTTP/1.1\r\nHost: %s:%d\r\nConnection: %s\r\n\r\n",
+                                  target, g_config.host.c_str(), g_config.port, connection);
+        else
+            header_len = snprintf(header, sizeof(header),
+                                  "POST %s HTTP/1.1\r\nHost: %s:%d\r\nConnection: %s\r\n"
+                                  "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: %d\r\n\r\n",
+                                  target, g_config.host.c_str(), g_config.port, connection, body_len);
+        out.append(header, header_len);
+        out.append(body, body_len);
+    }
+
+    //处理到期的重连和发送，返回本连接下一次需要处理的时间
+    int64_t service(bench_conn &conn, int64_t now)
+    {
+        if (CONN_IDLE == conn.state)
+        {
+            if (now < conn.reconnect_at)
+                return conn.reconnect_at;
+            start_connect(conn);
+            return CONN_IDLE == conn.state ? conn.reconnect_at : INT64_MAX;
+        }
+        if (CONN_OPEN != conn.state || conn.close_after)
+            return INT64_MAX;
+
+        //不是长连接时每个连接只发一个请求
+        int depth = g_config.keep_alive ? g_config.depth : 1;
+        bool sent = false;
+        while ((int)conn.inflight.size() < depth)
+        {
+            int64_t start;
+            if (g_config.rate > 0)
+            {
+                //落后于计划时连续补发，延迟从预定时间算起
+                if (conn.next_send > now)
+                    break;
+                start = conn.next_send;
+                conn.next_send += conn.interval;
+            }
+            else
+                start = now;
+            build_request(conn.out);
+            conn.inflight.push_back(start);
+            sent = true;
+            if (!g_config.keep_alive)
+            {
+                conn.close_after = true;
+                break;
+            }
+        }
+        if (sent)
+            flush(conn);
+        if (g_config.rate > 0 && (int)conn.inflight.size() < depth && CONN_OPEN == conn.state && !conn.close_after)
+            return conn.next_send;
+        return INT64_MAX;
+    }
+
+    void flush(bench_conn &conn)
+    {
+        while (conn.out_pos < conn.out.size())
+        {
+            ssize_t n = send(conn.fd, conn.out.data() + conn.out_pos, conn.out.size() - conn.out_pos, MSG_NOSIGNAL);
+            if (n < 0 && EINTR == errno)
+                continue;
+            if (n < 0 && EAGAIN == errno)
+            {
+                watch(conn, EPOLLIN | EPOLLOUT);
+                return;
+            }
+            if (n <= 0)
+            {
+                drop(conn, &m_stats.write_errors, now_ns());
+                return;
+            }
+            conn.out_pos += n;
+        }
+        conn.out.clear();
+        conn.out_pos = 0;
+        watch(conn, EPOLLIN);
+    }
+
+    void on_readable(bench_conn &conn)
+    {
+        char buf[READ_SIZE];
+        while (true)
+        {
+            ssize_t n = recv(conn.fd, buf, sizeof(buf), 0);
+            if (n > 0)
+            {
+                m_stats.bytes += n;
+                conn.in.append(buf, n);
+                if ((size_t)n < sizeof(buf))
+                    break;
+                continue;
+            }
+            if (n < 0 && EINTR == errno)
+                continue;
+            if (n < 0 && EAGAIN == errno)
+                break;
+            //对端关闭：先解析已收到的响应，剩余的在途请求计为读错误
+            parse(conn);
+            if (CONN_OPEN == conn.state)
+                drop(conn, conn.inflight.empty() ? NULL : &m_stats.read_errors, now_ns());
+            return;
+        }
+        parse(conn);
+    }
+
+    //按顺序解析收到的完整响应，每个响应对应在途队列的队首
+    void parse(bench_conn &conn)
+    {
+        while (CONN_OPEN == conn.state)
+        {
+            const char *data = conn.in.data() + conn.in_pos;
+            size_t avail = conn.in.size() - conn.in_pos;
+            const char *end = (const char *)memmem(data, avail, "\r\n\r\n", 4);
+            if (!end)
+                break;
+            size_t header_len = end - data + 4;
+            if (avail < 12 || strncmp(data, "HTTP/1.", 7) || conn.inflight.empty())
+            {
+                drop(conn, &m_stats.read_errors, now_ns());
+                return;
+            }
+            int status = atoi(data + 9);
+            long long content_length = -1;
+            bool close_conn = strncmp(data, "HTTP/1.1", 8) != 0;
+            const char *line = data;
+            while ((line = (const char *)memchr(line, '\n', end - line)))
+            {
+                ++line;
+                if (!strncasecmp(line, "Content-Length:", 15))
+                    content_length = atoll(line + 15);
+                else if (!strncasecmp(line, "Connection:", 11))
+                {
+                    const char *value = line + 11;
+                    while (' ' == *value)
+                        ++value;
+                    close_conn = !strncasecmp(value, "close", 5);
+                }
+            }
+            //没有Content-Length时响应体读到连接关闭为止，这里不支持，按格式错误处理
+            if (content_length < 0)
+            {
+                drop(conn, &m_stats.read_errors, now_ns());
+                return;
+            }
+            if (avail < header_len + content_length)
+                break;
+
+            int64_t now = now_ns();
+            m_stats.latency.record((now - conn.inflight.front()) / 1000);
+            conn.inflight.pop_front();
+            ++m_stats.requests;
+            ++m_stats.status[status >= 100 && status < 600 ? status / 100 : 0];
+            conn.in_pos += header_len + content_length;
+
+            if (close_conn)
+            {
+                //服务器不再接受后续请求，已发出的在途请求计为读错误
+                drop(conn, conn.inflight.empty() ? NULL : &m_stats.read_errors, now);
+                return;
+            }
+        }
+        if (conn.in_pos > 0 && (conn.in_pos == conn.in.size() || conn.in_pos >= READ_SIZE))
+        {
+            conn.in.erase(0, conn.in_pos);
+            conn.in_pos = 0;
+        }
+        if (CONN_OPEN == conn.state && conn.close_after && conn.inflight.empty())
+            drop(conn, NULL, now_ns());
+    }
+
+    //队首请求等待超过-T的连接断开重连，它和其后的在途请求计为超时
+    void check_timeouts(int64_t now)
+    {
+        int64_t limit = (int64_t)g_config.timeout_ms * 1000000LL;
+        for (size_t i = 0; i < m_conns.size(); ++i)
+        {
+            bench_conn &conn = m_conns[i];
+            if (CONN_CONNECTING == conn.state && now - conn.reconnect_at > limit)
+            {
+                ++m_stats.connect_errors;
+                drop(conn, NULL, now);
+            }
+            else if (CONN_OPEN == conn.state && !conn.inflight.empty() && now - conn.inflight.front() > limit)
+                drop(conn, &m_stats.timeouts, now);
+        }
+    }
+
+private:
+    int m_id;
+    int m_first; //本线程第一个连接的全局序号，用于错开开环的相位
+    vector<bench_conn> m_conns;
+    uint64_t m_sequence;
+    unsigned int m_seed;
+    int64_t m_start;
+    int m_epollfd;
+    int m_timerfd;
+    bench_stats m_stats;
+};
+
+/****************************** 主程序 ******************************/
+
+struct worker_args
+{
+    bench_worker *worker;
+    int64_t start;
+    int64_t end;
+};
+
+static void *worker_thread(void *arg)
+{
+    worker_args *args = (worker_args *)arg;
+    args->worker->run(args->start, args->end);
+    return NULL;
+}
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    g_stop = 1;
+}
+
+static bool parse_url(const char *url, bench_config &config)
+{
+    const char *p = url;
+    if (!strncmp(p, "http://", 7))
+        p += 7;
+    const char *slash = strchr(p, '/');
+    string authority = slash ? string(p, slash - p) : string(p);
+    config.path = slash ? slash : "/";
+    size_t colon = authority.rfind(':');
+    config.port = 80;
+    if (string::npos != colon)
+    {
+        config.port = atoi(authority.c_str() + colon + 1);
+        authority.erase(colon);
+    }
+    config.host = authority;
+
+    struct addrinfo hints, *result;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    char port[16];
+    snprintf(port, sizeof(port), "%d", config.port);
+    if (config.host.empty() || getaddrinfo(config.host.c_str(), port, &hints, &result))
+        return false;
+    memcpy(&config.address, result->ai_addr, result->ai_addrlen);
+    config.address_len = result->ai_addrlen;
+    freeaddrinfo(result);
+    return true;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [options] http://host:port/path\n"
+            "  -t  threads (default 2)\n"
+            "  -c  connections (default 10)\n"
+            "  -d  duration in seconds (default 10)\n"
+            "  -R  open loop: total requests per second, latency corrected for coordinated omission\n"
+            "      (default 0: closed loop, as fast as the server answers)\n"
+            "  -P  pipeline depth per connection (default 1)\n"
+            "  -K  no keep-alive: one request per connection\n"
+            "  -m  get | login | register (default get)\n"
+            "  -u  login as random u<k>/p<k>, k < users (default 0: root/123456)\n"
+            "  -T  request timeout in ms (default 5000)\n"
+            "  -S  print the full percentile spectrum\n",
+            name);
+}
+
+static void print_latency(const histogram &latency)
+{
+    static const double percents[] = {50, 75, 90, 99, 99.9, 99.99};
+    printf("  Latency (us)  mean %.1f  stdev %.1f  max %llu\n", latency.mean(), latency.stdev(),
+           (unsigned long long)latency.max());
+    for (size_t i = 0; i < sizeof(percents) / sizeof(percents[0]); ++i)
+        printf("  %8g%%  %10llu\n", percents[i], (unsigned long long)latency.value_at(percents[i]));
+}
+
+//按HdrHistogram的格式输出：每当剩余比例减半，再细分5档
+static void print_spectrum(const histogram &latency)
+{
+    printf("\n  Detailed percentile spectrum:\n");
+    printf("  %12s %14s %12s %18s\n", "Value(us)", "Percentile", "TotalCount", "1/(1-Percentile)");
+    uint64_t total = latency.total();
+    double percent = 0;
+    while (total && percent < 100)
+    {
+        uint64_t value = latency.value_at(percent);
+        uint64_t count = latency.count_at_or_below(value);
+        if (count >= total)
+        {
+            printf("  %12llu %14.12f %12llu\n", (unsigned long long)latency.max(), 1.0, (unsigned long long)total);
+            break;
+        }
+        printf("  %12llu %14.12f %12llu %18.2f\n", (unsigned long long)value, percent / 100, (unsigned long long)count,
+               1 / (1 - percent / 100));
+        double half_distance = pow(2, floor(log2(100 / (100 - percent))) + 1);
+        percent += 100 / (5 * half_distance);
+    }
+    printf("  #[Mean = %.3f, StdDeviation = %.3f]\n", latency.mean(), latency.stdev());
+    printf("  #[Max = %llu, Total count = %llu]\n", (unsigned long long)latency.max(), (unsigned long long)total);
+}
+
+int main(int argc, char *argv[])
+{
+    g_config.threads = 2;
+    g_config.connections = 10;
+    g_config.duration = 10;
+    g_config.rate = 0;
+    g_config.depth = 1;
+    g_config.keep_alive = true;
+    g_config.mode = MODE_GET;
+    g_config.users = 0;
+    g_config.timeout_ms = 5000;
+    g_config.spectrum = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:c:d:R:P:Km:u:T:Sh")) != -1)
+    {
+        switch (opt)
+        {
+        case 't': g_config.threads = atoi(optarg); break;
+        case 'c': g_config.connections = atoi(optarg); break;
+        case 'd': g_config.duration = atoi(optarg); break;
+        case 'R': g_config.rate = atof(optarg); break;
+        case 'P': g_config.depth = atoi(optarg); break;
+        case 'K': g_config.keep_alive = false; break;
+        case 'm':
+            if (!strcmp(optarg, "get"))
+                g_config.mode = MODE_GET;
+            else if (!strcmp(optarg, "login"))
+                g_config.mode = MODE_LOGIN;
+            else if (!strcmp(optarg, "register"))
+                g_config.mode = MODE_REGISTER;
+            else
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'u': g_config.users = atoi(optarg); break;
+        case 'T': g_config.timeout_ms = atoi(optarg); break;
+        case 'S': g_config.spectrum = true; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind + 1 != argc || !parse_url(argv[optind], g_config))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (g_config.threads < 1)
+        g_config.threads = 1;
+    if (g_config.connections < g_config.threads)
+        g_config.connections = g_config.threads;
+    if (g_config.depth < 1)
+        g_config.depth = 1;
+
+    static const char *modes[] = {"get", "login", "register"};
+    printf("Running %ds test @ %s\n", g_config.duration, argv[optind]);
+    printf("  %d threads, %d connections, pipeline %d, %s, %s", g_config.threads, g_config.connections,
+           g_config.depth, g_config.keep_alive ? "keep-alive" : "one request per connection", modes[g_config.mode]);
+    if (g_config.rate > 0)
+        printf(", open loop %g req/s\n", g_config.rate);
+    else
+        printf(", closed loop\n");
+    fflush(stdout);
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_signal);
+
+    //连接尽量平均分给各线程
+    vector<bench_worker *> workers;
+    vector<worker_args> args(g_config.threads);
+    vector<pthread_t> tids(g_config.threads);
+    int64_t start = now_ns() + 10000000LL;
+    int64_t end = start + (int64_t)g_config.duration * 1000000000LL;
+    int first = 0;
+    for (int i = 0; i < g_config.threads; ++i)
+    {
+        int count = g_config.connections / g_config.threads + (i < g_config.connections % g_config.threads);
+        workers.push_back(new bench_worker(i, first, count));
+        first += count;
+        args[i].worker = workers[i];
+        args[i].start = start;
+        args[i].end = end;
+        pthread_create(&tids[i], NULL, worker_thread, &args[i]);
+    }
+
+    bench_stats total;
+    for (int i = 0; i < g_config.threads; ++i)
+    {
+        pthread_join(tids[i], NULL);
+        bench_stats &stats = workers[i]->stats();
+        total.requests += stats.requests;
+        total.bytes += stats.bytes;
+        total.connects += stats.connects;
+        total.connect_errors += stats.connect_errors;
+        total.read_errors += stats.read_errors;
+        total.write_errors += stats.write_errors;
+        total.timeouts += stats.timeouts;
+        for (int j = 0; j < 6; ++j)
+            total.status[j] += stats.status[j];
+        total.latency.merge(stats.latency);
+        delete workers[i];
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+    if (elapsed > g_config.duration)
+        elapsed = g_config.duration;
+
+    print_latency(total.latency);
+    if (g_config.spectrum)
+        print_spectrum(total.latency);
+    printf("\n  %llu requests in %.2fs, %.2fMB read, %llu connections opened\n", (unsigned long long)total.requests,
+           elapsed, total.bytes / 1048576.0, (unsigned long long)total.connects);
+    printf("  Status: 2xx %llu, 3xx %llu, 4xx %llu, 5xx %llu, other %llu\n", (unsigned long long)total.status[2],
+           (unsigned long long)total.status[3], (unsigned long long)total.status[4],
+           (unsigned long long)total.status[5], (unsigned long long)(total.status[0] + total.status[1]));
+    printf("  Errors: connect %llu, read %llu, write %llu, timeout %llu\n", (unsigned long long)total.connect_errors,
+           (unsigned long long)total.read_errors, (unsigned long long)total.write_errors,
+           (unsigned long long)total.timeouts);
+    printf("Requests/sec: %.2f\n", elapsed > 0 ? total.requests / elapsed : 0);
+    printf("Transfer/sec: %.2fMB\n", elapsed > 0 ? total.bytes / 1048576.0 / elapsed : 0);
+    return 0;
+}
@@ -6,17 +6,17 @@
 #include <exception>
 #include <pthread.h>
 #include "../lock/locker.h"
-#include "../CGImysql/sql_connection_pool.h"
 
 template <typename T>
 class threadpool
 {
 public:
     /*thread_number是线程池中线程的数量，max_requests是请求队列中最多允许的、等待处理的请求的数量*/
-    threadpool(int actor_model, connection_pool *connPool, int thread_number = 8, int max_request = 10000);
+    threadpool(int actor_model, int thread_number = 8, int max_request = 10000);
     ~threadpool();
     bool append(T *request, int state);
     bool append_p(T *request);
+    bool resume(T *request);
 
 private:
     /*工作线程运行的函数，它不断从工作队列中取出任务并执行之*/
@@ -30,13 +30,12 @@ private:
     std::list<T *> m_workqueue; //请求队列
     locker m_queuelocker;       //保护请求队列的互斥锁
     sem m_queuestat;            //是否有任务需要处理
-    connection_pool *m_connPool;  //数据库
     int m_actor_model;          //模型切换
 };
 
 /*线程池构造函数，在此pthread_create线程，并注册worker，当线程唤醒时work->run内部有socket, db, http处理流程*/
 template <typename T>
-threadpool<T>::threadpool( int actor_model, connection_pool *connPool, int thread_number, int max_requests) : m_actor_model(actor_model),m_thread_number(thread_number), m_max_requests(max_requests), m_threads(NULL),m_connPool(connPool)
+threadpool<T>::threadpool( int actor_model, int thread_number, int max_requests) : m_actor_model(actor_model),m_thread_number(thread_number), m_max_requests(max_requests), m_threads(NULL)
 {
     if (thread_number <= 0 || max_requests <= 0)
         throw std::exception();
@@ -72,6 +71,7 @@ bool threadpool<T>::append(T *request, int state)
         return false;
     }
     request->m_state = state;
+    request->mark_queued();
     m_workqueue.push_back(request);
     m_queuelocker.unlock();
     m_queuestat.post();
@@ -86,11 +86,18 @@ bool threadpool<T>::append_p(T *request)
         m_queuelocker.unlock();
         return false;
     }
+    request->mark_queued();
     m_workqueue.push_back(request);
     m_queuelocker.unlock();
     m_queuestat.post();
     return true;
 }
+//挂起等待数据库的请求完成后放回队列，工作线程直接生成响应
+template <typename T>
+bool threadpool<T>::resume(T *request)
+{
+    return append(request, 2);
+}
 template <typename T>
 void *threadpool<T>::worker(void *arg)
 {
@@ -117,14 +124,19 @@ void threadpool<T>::run()
         m_queuelocker.unlock();
         if (!request)
             continue;
-        if (1 == m_actor_model)
+        //数据库结果已取回
+        if (2 == request->m_state)
+        {
+            request->m_state = 0;
+            request->process();
+        }
+        else if (1 == m_actor_model)
         {
             if (0 == request->m_state)
             {
                 if (request->read_once())
                 {
                     request->improv = 1;
-                    connectionRAII mysqlcon(&request->mysql, m_connPool);
                     request->process();
                 }
                 else
@@ -148,7 +160,6 @@ void threadpool<T>::run()
         }
         else
         {
-            connectionRAII mysqlcon(&request->mysql, m_connPool);
             request->process();
         }
     }
@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "coarse_clock.h"
+
+coarse_clock::coarse_clock()
+{
+    m_started = false;
+    for (int i = 0; i < CLOCK_SLOTS; ++i)
+    {
+        m_slots[i].seq.store(0);
+        memset(&m_slots[i].slot, 0, sizeof(m_slots[i].slot));
+    }
+    m_index.store(CLOCK_SLOTS - 1);
+    update();
+}
+
+void coarse_clock::start()
+{
+    if (m_started)
+        return;
+    m_started = true;
+    pthread_t tid;
+    pthread_create(&tid, NULL, worker, NULL);
+    pthread_detach(tid);
+}
+
+void *coarse_clock::worker(void *args)
+{
+    coarse_clock *clock = coarse_clock::get_instance();
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (true)
+    {
+        //按绝对时间睡眠，更新本身的耗时不会累积成漂移
+        next.tv_nsec += 1000000;
+        if (next.tv_nsec >= 1000000000)
+        {
+            next.tv_nsec -= 1000000000;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        clock->update();
+    }
+    return NULL;
+}
+
+//只有更新线程写时间槽，写好后再发布下标
+void coarse_clock::update()
+{
+    int cur = m_index.load(memory_order_relaxed);
+    int next = (cur + 1) & (CLOCK_SLOTS - 1);
+    const clock_slot &last = m_slots[cur].slot;
+    clock_slot &slot = m_slots[next].slot;
+    atomic<unsigned int> &seq = m_slots[next].seq;
+
+    //序号变为奇数后再改写，仍在复制这个槽的读者会发现并重读
+    unsigned int begin = seq.load(memory_order_relaxed) + 1;
+    seq.store(begin, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    struct timespec mono, real;
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    clock_gettime(CLOCK_REALTIME, &real);
+    slot.mono_ms = (long long)mono.tv_sec * 1000 + mono.tv_nsec / 1000000;
+    slot.real_usec = real.tv_nsec / 1000000 * 1000;
+
+    //字符串每秒只格式化一次
+    if (real.tv_sec == last.real_sec)
+    {
+        slot.real_sec = last.real_sec;
+        slot.local = last.local;
+        memcpy(slot.log_prefix, last.log_prefix, sizeof(slot.log_prefix));
+        slot.log_prefix_len = last.log_prefix_len;
+        memcpy(slot.http_date, last.http_date, sizeof(slot.http_date));
+        slot.http_date_len = last.http_date_len;
+    }
+    else
+    {
+        slot.real_sec = real.tv_sec;
+        localtime_r(&real.tv_sec, &slot.local);
+        slot.log_prefix_len = snprintf(slot.log_prefix, sizeof(slot.log_prefix), "%d-%02d-%02d %02d:%02d:%02d.",
+                                       slot.local.tm_year + 1900, slot.local.tm_mon + 1, slot.local.tm_mday,
+                                       slot.local.tm_hour, slot.local.tm_min, slot.local.tm_sec);
+        struct tm gmt;
+        gmtime_r(&real.tv_sec, &gmt);
+        slot.http_date_len = strftime(slot.http_date, sizeof(slot.http_date), "%a, %d %b %Y %H:%M:%S GMT", &gmt);
+    }
+
+    seq.store(begin + 1, memory_order_release);
+    m_mono_ms.store(slot.mono_ms, memory_order_relaxed);
+    m_real_sec.store(slot.real_sec, memory_order_relaxed);
+    m_index.store(next, memory_order_release);
+}
@@ -0,0 +1,93 @@
+#ifndef COARSE_CLOCK_H
+#define COARSE_CLOCK_H
+
+#include <time.h>
+#include <string.h>
+#include <atomic>
+
+using namespace std;
+
+const int CLOCK_SLOTS = 16; //时间槽个数，必须是2的幂
+
+/*
+* 进程共享的粗粒度时钟
+* 后台线程每毫秒读一次单调时钟和墙上时间，连同格式化好的日志时间前缀和HTTP Date写入下一个时间槽后发布
+* 定时器、日志和响应头只需读取当前槽，不再各自调用time、gettimeofday和localtime
+* 槽轮转CLOCK_SLOTS毫秒后会被重写，读者格式化期间可能跨过这段时间，因此每个槽带顺序锁(seqlock)：
+* 写者改写前后各把序号加一，读者把整个槽复制出来，复制前后序号不同或为奇数则重读
+* 定时器只需要秒和毫秒，这两个值另外用原子变量发布，不复制整个槽
+*/
+struct clock_slot
+{
+    long long mono_ms;     //单调时钟，毫秒
+    time_t real_sec;       //墙上时间，秒
+    long real_usec;        //墙上时间的微秒部分，精度为毫秒
+    struct tm local;       //本地时间，按天切分日志用
+    char log_prefix[24];   //"YYYY-MM-DD hh:mm:ss."
+    int log_prefix_len;
+    char http_date[32];    //"Sun, 06 Nov 1994 08:49:37 GMT"
+    int http_date_len;
+};
+
+struct clock_cell
+{
+    atomic<unsigned int> seq; //奇数表示正在改写
+    clock_slot slot;
+};
+
+class coarse_clock
+{
+public:
+    //C++11以后,使用局部变量懒汉不用加锁
+    static coarse_clock *get_instance()
+    {
+        static coarse_clock instance;
+        return &instance;
+    }
+
+    //启动更新线程，启动前读到的是构造时的时间
+    void start();
+
+    //把当前槽复制到out，复制期间槽被改写则重读
+    void now(clock_slot &out)
+    {
+        while (true)
+        {
+            const clock_cell &cell = m_slots[m_index.load(memory_order_acquire)];
+            unsigned int seq = cell.seq.load(memory_order_acquire);
+            if (seq & 1)
+                continue;
+            memcpy(&out, &cell.slot, sizeof(out));
+            atomic_thread_fence(memory_order_acquire);
+            if (cell.seq.load(memory_order_relaxed) == seq)
+                return;
+        }
+    }
+    long long mono_ms()
+    {
+        return m_mono_ms.load(memory_order_relaxed);
+    }
+    //单调时钟，秒，定时器的超时时间使用它，不受系统改时的影响
+    time_t mono_sec()
+    {
+        return m_mono_ms.load(memory_order_relaxed) / 1000;
+    }
+    time_t seconds()
+    {
+        return m_real_sec.load(memory_order_relaxed);
+    }
+
+private:
+    coarse_clock();
+    static void *worker(void *args);
+    void update();
+
+private:
+    clock_cell m_slots[CLOCK_SLOTS];
+    atomic<int> m_index;
+    atomic<long long> m_mono_ms;
+    atomic<time_t> m_real_sec;
+    bool m_started;
+};
+
+#endif
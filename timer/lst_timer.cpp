@@ -177,8 +177,8 @@ void sort_timer_lst::tick()
     {
         return;
     }
-    //获取当前时间
-    time_t cur = time(NULL);
+    //获取当前时间，取自粗粒度时钟的单调秒数
+    time_t cur = coarse_clock::get_instance()->mono_sec();
     util_timer *tmp = head;
     //遍历定时器链表
     while (tmp)
@@ -307,6 +307,9 @@ void cb_func(client_data *user_data)
     //删除非活动连接在socket上的注册事件
     epoll_ctl(Utils::u_epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
     assert(user_data);
+    //描述符关闭后可能立即被新连接复用，先撤销旧连接挂起的文件加载和预读
+    if (user_data->conn)
+        user_data->conn->cancel_pending();
     //关闭文件描述符
     close(user_data->sockfd);
     //更新连接数
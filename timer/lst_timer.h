@@ -23,6 +23,7 @@
 
 #include <time.h>
 #include "../log/log.h"
+#include "coarse_clock.h"
 
 /*
 * 将连接资源、定时事件和超时时间封装为定时器类
@@ -37,6 +38,7 @@
 */
 
 class util_timer;
+class http_conn;
 
 //连接资源
 struct client_data
@@ -44,6 +46,7 @@ struct client_data
     sockaddr_in address; //客户端socket地址
     int sockfd;         //socket文件描述符
     util_timer *timer; //定时器
+    http_conn *conn;   //连接对象，关闭时撤销其挂起的异步任务
 };
 
 //定时器类
@@ -53,7 +56,7 @@ public:
     util_timer() : prev(NULL), next(NULL) {}
 
 public:
-    time_t expire; //超时时间
+    time_t expire; //超时时间，单调时钟的秒数
     void (* cb_func)(client_data *); //回调函数，超时调用
     client_data *user_data; //连接资源
     util_timer *prev; //前向定时器
@@ -29,7 +29,9 @@ WebServer::~WebServer()
 }
 
 void WebServer::init(int port, string user, string passWord, string databaseName, int log_init, 
-                     int opt_linger, int trigmode, int sql_num, int thread_num, int close_log, int actor_model)
+                     int opt_linger, int trigmode, int sql_num, int thread_num, int close_log, int actor_model,
+                     string bundle_path, int log_flush_interval, int log_flush_size, int log_binary,
+                     int log_level, int access_sample, int async_db_num, int user_cache, string store_path, string snapshot_path)
 {
     m_port = port;
     m_user = user;
@@ -42,6 +44,16 @@ void WebServer::init(int port, string user, string passWord, string databaseName
     m_TRIGMode = trigmode;
     m_close_log = close_log;
     m_actormodel = actor_model;
+    m_bundle_path = bundle_path;
+    m_log_flush_interval = log_flush_interval;
+    m_log_flush_size = log_flush_size;
+    m_log_binary = log_binary;
+    m_log_level = log_level;
+    m_access_sample = access_sample;
+    m_async_db_num = async_db_num;
+    m_user_cache = user_cache;
+    m_store_path = store_path;
+    m_snapshot_path = snapshot_path;
 }
 
 void WebServer::trig_mode()
@@ -74,30 +86,99 @@ void WebServer::trig_mode()
 
 void WebServer::log_init()
 {
+    //日志、定时器和响应头的Date共用粗粒度时钟，最先启动
+    coarse_clock::get_instance()->start();
+
     if (0 == m_close_log)
     {
-        //初始化日志
+        //初始化日志，二进制日志需用log_decoder解码
+        const char *file_name = m_log_binary ? "./ServerLog.bin" : "./ServerLog";
         if (1 == m_log_init)
-            Log::get_instance()->init("./ServerLog", m_close_log, 2000, 800000, 800);
+            Log::get_instance()->init(file_name, m_close_log, 2000, 800000, 800, m_log_flush_interval, m_log_flush_size, m_log_binary);
+        else if (2 == m_log_init)
+            Log::get_instance()->init(file_name, m_close_log, 2000, 800000, 0, m_log_flush_interval, m_log_flush_size, m_log_binary, true);
         else
-            Log::get_instance()->init("./ServerLog", m_close_log, 2000, 800000, 0);
+            Log::get_instance()->init(file_name, m_close_log, 2000, 800000, 0, m_log_flush_interval, m_log_flush_size, m_log_binary);
+        Log::get_instance()->set_level(m_log_level);
+
+        //访问日志，每个响应一条记录
+        if (!access_log::get_instance()->init("./AccessLog", m_access_sample, m_log_flush_interval))
+        {
+            LOG_ERROR("%s", "open access log failed");
+        }
     }
 }
 
+void WebServer::bundle_init()
+{
+    if (m_bundle_path.empty())
+        return;
+
+    //映射站点包，之后的静态资源全部从包中提供
+    if (!bundle_root::get_instance()->init(m_bundle_path.c_str()))
+    {
+        LOG_ERROR("load site bundle %s failed", m_bundle_path.c_str());
+        printf("load site bundle %s failed\n", m_bundle_path.c_str());
+        exit(1);
+    }
+    LOG_INFO("serve static files from site bundle %s", m_bundle_path.c_str());
+}
+
 void WebServer::sql_pool()
 {
-    //初始化数据库连接池
-    m_connPool = connection_pool::GetInstance();
-    m_connPool->init("localhost", m_user, m_passWord, m_databaseName, 3306, m_sql_num, m_close_log);
+    //用户缓存启动时为空，登录和注册时按需填入
+    user_store::get_instance()->init(m_user_cache > 0 ? m_user_cache : USER_CACHE_DEFAULT);
+
+    if (!m_store_path.empty())
+    {
+        //嵌入式存储：不连接MySQL，非阻塞数据库也不启用
+        if (!log_store::get_instance()->init(m_store_path.c_str(), m_close_log))
+        {
+            LOG_ERROR("open user store %s failed", m_store_path.c_str());
+            printf("open user store %s failed\n", m_store_path.c_str());
+            exit(1);
+        }
+        user_backend::use(log_store::get_instance());
+        m_connPool = NULL;
+        if (m_async_db_num > 0)
+            LOG_WARN("%s", "async db needs MySQL, disabled with local user store");
+        m_async_db_num = 0;
+        //嵌入式存储本身就在本地，不需要快照
+        if (!m_snapshot_path.empty())
+            LOG_WARN("%s", "user snapshot needs MySQL, disabled with local user store");
+        m_snapshot_path = "";
+    }
+    else
+    {
+        //初始化数据库连接池
+        m_connPool = connection_pool::GetInstance();
+        //常驻连接为上限的四分之一，负载上来时再打开
+        m_connPool->init("localhost", m_user, m_passWord, m_databaseName, 3306, (m_sql_num + 3) / 4, m_sql_num, m_close_log);
+        mysql_backend::get_instance()->init(m_connPool, "localhost", m_user, m_passWord, m_databaseName, 3306, m_close_log);
+        user_backend::use(mysql_backend::get_instance());
+    }
+
+    //映射用户快照，之后由后台线程从数据库追赶
+    user_snapshot::get_instance()->init(m_snapshot_path, m_close_log);
+
+    //用户名过滤器由后台线程建立，不阻塞启动
+    user_filter::get_instance()->init(m_close_log);
+
+    //注册写入线程
+    reg_writer::get_instance()->init(m_close_log);
 
-    //初始化数据库读取表
-    users->initmysql_result(m_connPool);
+    //事件循环中使用的非阻塞数据库连接，epoll创建后再建立
+    async_db::get_instance()->init("localhost", m_user, m_passWord, m_databaseName, 3306, m_async_db_num, m_close_log);
 }
 
 void WebServer::thread_pool()
 {
     //成员是http_conn类型的线程池
-    m_pool = new threadpool<http_conn>(m_actormodel, m_connPool, m_thread_num);
+    m_pool = new threadpool<http_conn>(m_actormodel, m_thread_num);
+    http_conn::m_threadpool = m_pool;
+
+    //文件缓存的预读I/O线程，冷文件的磁盘读取不占用工作线程和主线程
+    file_cache::get_instance()->init(IO_THREAD_NUMBER);
 }
 
 void WebServer::eventListen()
@@ -162,6 +243,9 @@ void WebServer::eventListen()
     //listenfd加到epollfd集合中，使内核监听listenfd的事件
     utils.addfd(m_epollfd, m_listenfd, false, m_LISTENTrigmode); 
     http_conn::m_epollfd = m_epollfd;
+    //非阻塞数据库连接的socket也由这个epoll推进
+    async_db::get_instance()->start(m_epollfd);
+    file_cache::get_instance()->start(m_epollfd, m_close_log);
 
     //信号相关设置
     //创建管道套接字
@@ -173,10 +257,21 @@ void WebServer::eventListen()
     utils.setnonblocking(m_pipefd[1]);
     //设置管道读端为ET非阻塞，pipifd加到epollfd监听集合
     utils.addfd(m_epollfd, m_pipefd[0], false, 0); 
-    //传递给主循环的信号值，这里只关注SIGALRM和SIGTERM
+    //传递给主循环的信号值，这里关注SIGALRM、SIGTERM和用于重新加载站点包的SIGHUP
     utils.addsig(SIGPIPE, SIG_IGN);
     utils.addsig(SIGALRM, utils.sig_handler, false);
     utils.addsig(SIGTERM, utils.sig_handler, false);
+    utils.addsig(SIGHUP, utils.sig_handler, false);
+    utils.addsig(SIGUSR1, utils.sig_handler, false);
+    utils.addsig(SIGUSR2, utils.sig_handler, false);
+    //崩溃前写出积压的日志
+    if (0 == m_close_log)
+    {
+        utils.addsig(SIGSEGV, Log::crash_handler, false);
+        utils.addsig(SIGBUS, Log::crash_handler, false);
+        utils.addsig(SIGABRT, Log::crash_handler, false);
+        utils.addsig(SIGFPE, Log::crash_handler, false);
+    }
     //每隔TIMESLOT时间触发SIGALRM信号
     alarm(TIMESLOT);
 
@@ -195,13 +290,14 @@ void WebServer::timer(int connfd, struct sockaddr_in client_address)
     //创建定时器，设置回调函数和超时时间，绑定用户数据，将定时器添加到链表中
     users_timer[connfd].address = client_address;
     users_timer[connfd].sockfd = connfd;
+    users_timer[connfd].conn = users + connfd;
     //创建定时器临时变量
     util_timer *timer = new util_timer;
     //设置定时器对应的连接资源
     timer->user_data = &users_timer[connfd];
     //设置回调函数
     timer->cb_func = cb_func;
-    time_t cur = time(NULL);
+    time_t cur = coarse_clock::get_instance()->mono_sec();
     //设置绝对超时时间
     timer->expire = cur + 3 * TIMESLOT;
     //创建该连接对应的定时器，初始化为前述临时变量
@@ -214,7 +310,7 @@ void WebServer::timer(int connfd, struct sockaddr_in client_address)
 //并对新的定时器在链表上的位置进行调整
 void WebServer::adjust_timer(util_timer *timer)
 {
-    time_t cur = time(NULL);
+    time_t cur = coarse_clock::get_instance()->mono_sec();
     timer->expire = cur + 3 * TIMESLOT; //往后延迟3个单位
     utils.m_timer_lst.adjust_timer(timer);
 
@@ -308,6 +404,28 @@ bool WebServer::dealwithsignal(bool &timeout, bool &stop_server)
                     stop_server = true;
                     break;
                 }
+                //发布新站点包后重新映射，正在发送旧包的连接不受影响
+                case SIGHUP:
+                {
+                    if (bundle_root::get_instance()->reload())
+                    {
+                        LOG_INFO("%s", "site bundle reloaded");
+                    }
+                    else if (bundle_root::get_instance()->enabled())
+                    {
+                        LOG_ERROR("%s", "site bundle reload failed");
+                    }
+                    break;
+                }
+                //不重启调整日志级别：SIGUSR1输出更详细，SIGUSR2只保留更高级别
+                case SIGUSR1:
+                case SIGUSR2:
+                {
+                    Log *log = Log::get_instance();
+                    log->set_level(log->get_level() + (SIGUSR1 == signals[i] ? -1 : 1));
+                    LOG_WARN("log level set to %d", log->get_level());
+                    break;
+                }
             }
         }
     }
@@ -351,8 +469,9 @@ void WebServer::dealwithread(int sockfd)
         {
             LOG_INFO("deal with the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
 
-            //若监测到读事件，将该事件放入请求队列
-            m_pool->append_p(users + sockfd);
+            //主线程直接解析请求并响应缓存命中的静态资源，需要访问数据库或加载冷文件的请求才放入请求队列
+            if (!users[sockfd].process_fast())
+                m_pool->append_p(users + sockfd);
 
             if (timer) //若有数据传输，调整timer在链表上的位置
             {
@@ -438,6 +557,16 @@ void WebServer::eventLoop()
                 if (false == flag)
                     continue;
             }
+            //非阻塞数据库连接的socket和提交请求的eventfd
+            else if (async_db::get_instance()->owns(sockfd))
+            {
+                async_db::get_instance()->on_event(sockfd);
+            }
+            //文件加载和预读完成的通知，在主线程恢复挂起的连接
+            else if (file_cache::get_instance()->owns(sockfd))
+            {
+                file_cache::get_instance()->on_event(sockfd);
+            }
             //处理异常信号
             else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
             {
@@ -467,8 +596,25 @@ void WebServer::eventLoop()
         if (timeout)
         {
             utils.timer_handler();
+            async_db::get_instance()->tick();
+            session_store::get_instance()->expire();
             LOG_INFO("%s", "timer tick");
+            //汇总被限流的日志，同步模式下空闲时积压的日志靠定时器写出
+            //异步模式由写线程按阈值写出，不在事件循环里做阻塞的磁盘写入
+            if (0 == m_close_log)
+            {
+                Log::get_instance()->report_suppressed();
+                if (0 == m_log_init)
+                    Log::get_instance()->flush();
+            }
             timeout = false;
         }
     }
+
+    //收到SIGTERM退出前写出积压的日志
+    if (0 == m_close_log)
+    {
+        Log::get_instance()->report_suppressed();
+        Log::get_instance()->flush();
+    }
 }
\ No newline at end of file
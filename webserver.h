@@ -14,10 +14,13 @@
 
 #include "./threadpool/threadpool.h"
 #include "./http/http_conn.h"
+#include "./CGImysql/mysql_backend.h"
+#include "./CGImysql/log_store.h"
 
 const int MAX_FD = 65536;           //最大文件描述符
 const int MAX_EVENT_NUMBER = 10000; //最大事件数
 const int TIMESLOT = 5;             //最小超时单位
+const int IO_THREAD_NUMBER = 2;     //文件预读I/O线程数
 
 class WebServer
 {
@@ -27,11 +30,14 @@ public:
 
     void init(int port , string user, string passWord, string databaseName,
               int log_init , int opt_linger, int trigmode, int sql_num,
-              int thread_num, int close_log, int actor_model);
+              int thread_num, int close_log, int actor_model, string bundle_path,
+              int log_flush_interval, int log_flush_size, int log_binary,
+              int log_level, int access_sample, int async_db_num, int user_cache, string store_path, string snapshot_path);
 
     void thread_pool();
     void sql_pool();
     void log_init();
+    void bundle_init();
     void trig_mode();
     void eventListen();
     void eventLoop();
@@ -50,6 +56,12 @@ public:
     int m_log_init;
     int m_close_log;
     int m_actormodel;
+    string m_bundle_path;
+    int m_log_flush_interval;
+    int m_log_flush_size;
+    int m_log_binary;
+    int m_log_level;
+    int m_access_sample;
 
     int m_pipefd[2];
     int m_epollfd;
@@ -61,6 +73,10 @@ public:
     string m_passWord;     //登陆数据库密码
     string m_databaseName; //使用数据库名
     int m_sql_num;
+    int m_async_db_num;    //非阻塞数据库连接数，0为不使用
+    int m_user_cache;      //用户缓存容量
+    string m_store_path;   //嵌入式存储的数据文件，为空时使用MySQL
+    string m_snapshot_path; //用户快照文件，为空时不使用
 
     //线程池相关
     threadpool<http_conn> *m_pool;